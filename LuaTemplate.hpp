@@ -57,6 +57,7 @@ template<typename T> std::vector<T> TableFromLuaStack(lua_State* L, int i) {
     lua_pushnumber(L, j+1);
     lua_gettable(L, newi);
     ret.push_back(FromLuaStack<T>(L, -1));
+    lua_pop(L, 1); // the table keeps a reference
   }
   return ret;
 }
@@ -97,6 +98,19 @@ template<> inline void PushOnLuaStack<double>(lua_State* L, const double & topus
   lua_pushnumber(L, topush);
 }
 
+// the lua object holds its own reference to the tensor
+#define MAKE_PUSH_ON_LUA_STACK_TENSOR_TEMPLATE(type, typestring)		\
+  template<> inline void PushOnLuaStack<TH::Tensor<type> >(lua_State* L, const TH::Tensor<type> & topush) { \
+    TH::Tensor<type> t(topush);						\
+    t.retain();								\
+    luaT_pushudata(L, (TH::Types<type>::CTensor*)t, luaT_typenameid(L, typestring)); \
+  }
+MAKE_PUSH_ON_LUA_STACK_TENSOR_TEMPLATE(float, "torch.FloatTensor")
+MAKE_PUSH_ON_LUA_STACK_TENSOR_TEMPLATE(double, "torch.DoubleTensor")
+MAKE_PUSH_ON_LUA_STACK_TENSOR_TEMPLATE(unsigned char, "torch.ByteTensor")
+MAKE_PUSH_ON_LUA_STACK_TENSOR_TEMPLATE(long, "torch.LongTensor")
+#undef MAKE_PUSH_ON_LUA_STACK_TENSOR_TEMPLATE
+
 template<typename T> inline T FromLuaStack(int i) {
   return FromLuaStack<T>(L_global, i);
 }
@@ -1,2 +1,2 @@
 #include "THpp.hpp"
-lua_State* L_global = NULL;
+__thread lua_State* L_global = NULL;
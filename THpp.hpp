@@ -7,7 +7,10 @@ extern "C" {
 #include<luaT.h>
 }
 
-extern lua_State* L_global;
+// State of the lua thread running the current binding, per native thread
+// (several lua states can call the bindings at once). NULL in the worker
+// threads, where THerror throws the message instead.
+extern __thread lua_State* L_global;
 #include<string>
 
 inline void setLuaState(lua_State* L) {
@@ -0,0 +1,138 @@
+#include "arena.hpp"
+#include "stats.hpp"
+
+#include<cstdlib>
+#include<pthread.h>
+
+using namespace std;
+using namespace cv;
+
+#define ARENA_ALIGN 64
+#define ARENA_MIN_CHUNK (1 << 20)
+
+static inline size_t AlignArena(size_t n) {
+  return (n + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+}
+
+//============================================================
+// Arena
+//
+
+Arena::Arena()
+  :offset(0), used_(0), capacity_(0) {
+}
+
+Arena::~Arena() {
+  for (size_t i = 0; i < chunks.size(); ++i)
+    free(chunks[i].data);
+  for (size_t i = 0; i < pools.size(); ++i)
+    delete pools[i];
+}
+
+void Arena::newChunk(size_t size) {
+  Chunk chunk;
+  chunk.size = AlignArena(size);
+  void* data = NULL;
+  if (posix_memalign(&data, ARENA_ALIGN, chunk.size) != 0)
+    CV_Error(CV_StsNoMem, "Arena: out of memory");
+  chunk.data = (unsigned char*)data;
+  chunks.push_back(chunk);
+  offset = 0;
+  capacity_ += chunk.size;
+  STATS_ALLOC("Scratch", chunk.size);
+}
+
+void* Arena::alloc(size_t size) {
+  size = AlignArena(max<size_t>(size, 1));
+  // the chunks double, so that their number stays small until the next reset
+  if (chunks.empty() || (offset + size > chunks.back().size))
+    newChunk(max(size, max(capacity_, (size_t)ARENA_MIN_CHUNK)));
+  void* ret = chunks.back().data + offset;
+  offset += size;
+  used_ += size;
+  return ret;
+}
+
+void Arena::reset() {
+  if (StatsEnabled() && (used_ > 0)) {
+    static Stat* const stat = GetStat("Scratch");
+    UpdatePeak(stat, used_);
+  }
+  if (chunks.size() > 1) {
+    for (size_t i = 0; i < chunks.size(); ++i)
+      free(chunks[i].data);
+    chunks.clear();
+    const size_t capacity = capacity_;
+    capacity_ = 0;
+    newChunk(capacity);
+  }
+  offset = 0;
+  used_ = 0;
+  for (size_t i = 0; i < pools.size(); ++i)
+    pools[i]->reset();
+}
+
+void Arena::addPool(ScratchPoolBase* pool) {
+  pools.push_back(pool);
+}
+
+//============================================================
+// Per-thread arenas
+//
+
+static pthread_key_t arenaKey_g;
+static pthread_once_t arenaKeyOnce_g = PTHREAD_ONCE_INIT;
+static __thread Arena* threadArena_g = NULL;
+
+static void DeleteArena(void* arena) {
+  delete (Arena*)arena;
+}
+
+static void CreateArenaKey() {
+  pthread_key_create(&arenaKey_g, DeleteArena);
+}
+
+Arena & ThreadArena() {
+  if (threadArena_g == NULL) {
+    pthread_once(&arenaKeyOnce_g, CreateArenaKey);
+    threadArena_g = new Arena();
+    pthread_setspecific(arenaKey_g, threadArena_g);
+  }
+  return *threadArena_g;
+}
+
+//============================================================
+// Mat allocator
+//
+
+class ScratchMatAllocator : public MatAllocator {
+public:
+  virtual void allocate(int dims, const int* sizes, int type, int*& refcount,
+			uchar*& datastart, uchar*& data, size_t* step) {
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims-1; i >= 0; --i) {
+      step[i] = total;
+      total *= sizes[i];
+    }
+    // (the reference counter follows the data)
+    const size_t refOffset = AlignArena(total);
+    datastart = data = (uchar*)ThreadArena().alloc(refOffset + sizeof(int));
+    refcount = (int*)(datastart + refOffset);
+    *refcount = 1;
+  }
+  // freed by the reset of the arena
+  virtual void deallocate(int*, uchar*, uchar*) {
+  }
+};
+
+MatAllocator* ScratchAllocator() {
+  static ScratchMatAllocator allocator;
+  return &allocator;
+}
+
+Mat ScratchMat(int rows, int cols, int type) {
+  Mat ret;
+  ret.allocator = ScratchAllocator();
+  ret.create(rows, cols, type);
+  return ret;
+}
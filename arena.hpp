@@ -0,0 +1,133 @@
+#ifndef __ARENA_HPP__
+#define __ARENA_HPP__
+
+#include<vector>
+#include<opencv2/core/core.hpp>
+
+//============================================================
+// Scratch memory
+//
+// Per-thread bump allocator for the temporaries of a call : the images
+// converted from tensors (ScratchMat, through a cv::MatAllocator) and the
+// keypoint and point vectors (ScratchVector, recycled with their capacity).
+// Releasing them costs nothing : the memory is reclaimed as a whole by the
+// ScratchScope of the call (one per binding and per worker task, cf.
+// SCRATCH_SCOPE), so nothing allocated there may outlive it (what is kept,
+// eg. the gray image of a Frame, is copied). Once the arena has grown to the
+// largest call, the calls do not allocate anymore.
+//
+
+class ScratchPoolBase {
+public:
+  virtual ~ScratchPoolBase() {};
+  virtual void reset() = 0;
+};
+
+class Arena {
+public:
+  Arena();
+  ~Arena();
+  // 64 bytes aligned
+  void* alloc(size_t size);
+  // frees everything, and merges the chunks so that the next calls fit in one
+  void reset();
+  // the arena takes the ownership of the pool, which is reset with it
+  void addPool(ScratchPoolBase* pool);
+  inline size_t used() const {return used_;};
+  inline size_t capacity() const {return capacity_;};
+private:
+  Arena(const Arena &);
+  Arena & operator=(const Arena &);
+  void newChunk(size_t size);
+  struct Chunk {
+    unsigned char* data;
+    size_t size;
+  };
+  std::vector<Chunk> chunks; // the last one is the current one
+  size_t offset; // in the current chunk
+  size_t used_, capacity_;
+  std::vector<ScratchPoolBase*> pools;
+};
+
+// arena of the calling thread (freed when the thread exits)
+Arena & ThreadArena();
+
+// allocates on the arena of the calling thread
+cv::MatAllocator* ScratchAllocator();
+
+// uninitialized scratch matrix
+cv::Mat ScratchMat(int rows, int cols, int type);
+
+template<typename T> class ScratchVectorPool : public ScratchPoolBase {
+public:
+  ScratchVectorPool()
+    :used(0) {};
+  virtual ~ScratchVectorPool() {
+    for (size_t i = 0; i < all.size(); ++i)
+      delete all[i];
+  };
+  virtual void reset() {
+    used = 0;
+  };
+  // the vectors are given back in reverse order (cf. ScratchVector)
+  inline std::vector<T>* borrow() {
+    if (used == all.size())
+      all.push_back(new std::vector<T>());
+    std::vector<T>* v = all[used++];
+    v->clear();
+    return v;
+  };
+  inline void giveBack() {
+    if (used > 0)
+      --used;
+  };
+private:
+  std::vector<std::vector<T>*> all;
+  size_t used;
+};
+
+template<typename T> ScratchVectorPool<T> & ThreadScratchVectorPool() {
+  static __thread ScratchVectorPool<T>* pool = NULL;
+  if (pool == NULL) {
+    pool = new ScratchVectorPool<T>();
+    ThreadArena().addPool(pool);
+  }
+  return *pool;
+}
+
+// Empty vector of the calling thread's pool, keeping the capacity it had
+// in the previous calls
+template<typename T> class ScratchVector {
+public:
+  inline ScratchVector()
+    :pool(ThreadScratchVectorPool<T>()), v(pool.borrow()) {};
+  inline ~ScratchVector() {
+    pool.giveBack();
+  };
+  inline std::vector<T> & operator*() {return *v;};
+  inline std::vector<T>* operator->() {return v;};
+private:
+  ScratchVector(const ScratchVector &);
+  ScratchVector & operator=(const ScratchVector &);
+  ScratchVectorPool<T> & pool;
+  std::vector<T>* v;
+};
+
+// Resets the arena of the thread when the call starts (the previous one may
+// have been interrupted by a lua error) and when it ends. Not nested.
+class ScratchScope {
+public:
+  inline ScratchScope() {
+    ThreadArena().reset();
+  };
+  inline ~ScratchScope() {
+    ThreadArena().reset();
+  };
+private:
+  ScratchScope(const ScratchScope &);
+  ScratchScope & operator=(const ScratchScope &);
+};
+
+#define SCRATCH_SCOPE() ScratchScope scratchScope_
+
+#endif
@@ -0,0 +1,34 @@
+#include "async.hpp"
+
+HandleRegistry<Future> futures_g("Future");
+
+int PushFuture(Future* future) {
+  const int handle = futures_g.add(future);
+  PushOnThreadPool(vector<ThreadPool::Task*>(1, future));
+  return handle;
+}
+
+PinnedImage::PinnedImage(lua_State* L, int i)
+  :imb((TH::Tensor<ubyte>::CTensor*)NULL), imf((TH::Tensor<float>::CTensor*)NULL),
+   imd((TH::Tensor<double>::CTensor*)NULL) {
+  frame = FrameFromLuaStack(L, i);
+  if (!frame.empty())
+    return;
+  if (luaT_isudata(L, i, luaT_typenameid(L, "torch.ByteTensor")))
+    imb = PinTensor(FromLuaStack<TH::Tensor<ubyte> >(L, i));
+  else if (luaT_isudata(L, i, luaT_typenameid(L, "torch.FloatTensor")))
+    imf = PinTensor(FromLuaStack<TH::Tensor<float> >(L, i));
+  else
+    imd = PinTensor(FromLuaStack<TH::Tensor<double> >(L, i));
+}
+
+matb PinnedImage::gray() const {
+  if (!frame.empty())
+    return frame->gray();
+  if ((const TH::Tensor<ubyte>::CTensor*)imb != NULL)
+    return TensorToMatGray(imb);
+  else if ((const TH::Tensor<float>::CTensor*)imf != NULL)
+    return TensorToMatGray(imf);
+  else
+    return TensorToMatGray(imd);
+}
@@ -0,0 +1,55 @@
+#ifndef __ASYNC_HPP__
+#define __ASYNC_HPP__
+
+#include "common.hpp"
+#include "threadpool.hpp"
+#include "registry.hpp"
+#include "frame.hpp"
+
+//============================================================
+// Futures
+//
+// The asynchronous bindings check their arguments, push a Future on the
+// shared worker pool and return its handle at once. The tensors a future
+// reads or writes are retained (pinned) until it is released, so that the
+// lua garbage collector cannot free them while a worker uses them ; the
+// lua side must still not modify them before waiting. FutureWait blocks
+// until the task is done, raises its error if any, then calls collect() in
+// the lua thread and releases the future (and its tensors). A future must
+// be waited for exactly once.
+//
+
+class Future : public ThreadPool::Task {
+public:
+  // Lua thread, once run() has returned without error : writes what needs
+  // the TH allocator (output resizes, ...).
+  virtual void collect() {};
+};
+
+extern HandleRegistry<Future> futures_g;
+
+// Pushes the future on the worker pool and returns its handle
+int PushFuture(Future* future);
+
+// Reference to the same tensor, retained until it is destroyed
+template<typename T> TH::Tensor<T> PinTensor(TH::Tensor<T> t) {
+  t.retain();
+  return TH::Tensor<T>((typename TH::Tensor<T>::CTensor*)t, true);
+}
+
+// Image argument (tensor of any type, or frame handle) of an asynchronous
+// binding. It is pinned in the lua thread and converted to gray by the
+// worker.
+class PinnedImage {
+public:
+  PinnedImage(lua_State* L, int i);
+  // (worker)
+  matb gray() const;
+private:
+  Ptr<Frame> frame;
+  TH::Tensor<ubyte>  imb;
+  TH::Tensor<float>  imf;
+  TH::Tensor<double> imd;
+};
+
+#endif
@@ -0,0 +1,243 @@
+--------------------------------------------------------------------------------
+-- Benchmarks
+--
+-- Headless micro-benchmarks of the bindings, on synthetic images, for several
+-- image sizes and thread counts. Each case is run nIters times (after a
+-- warmup run) and reports the median and 99th percentile latencies and the
+-- throughput (megapixels per second at the median latency). The results are
+-- returned as a table and printed as CSV (or one lua table per line with
+-- format='lua'), to be diffed between releases.
+--
+--   opencv24.Benchmark{sizes={{640,480}}, threads={1,4}, cases={'MatchFREAK'}}
+--
+
+local help_desc = [[
+      OpenCV 2.4 wrapper : benchmarks
+]]
+
+-- smooth random 3xHxW image, with features at several scales
+local function syntheticImage(w, h, seed)
+   torch.manualSeed(seed)
+   local im = torch.Tensor(3, h, w):zero()
+   for _,s in ipairs{4, 16, 64} do
+      local small = torch.rand(3, math.max(2, math.ceil(h/s)), math.max(2, math.ceil(w/s)))
+      im:add(1/3, image.scale(small, w, h, 'bilinear'))
+   end
+   return im
+end
+
+-- the second frame is the first one shifted by (dx, dy)
+local function shiftedImage(im, dx, dy)
+   local h, w = im:size(2), im:size(3)
+   local out = im:clone()
+   out:narrow(2, 1+dy, h-dy):narrow(3, 1+dx, w-dx):copy(
+      im:narrow(2, 1, h-dy):narrow(3, 1, w-dx))
+   return out
+end
+
+local function percentile(sorted, p)
+   local i = math.max(1, math.min(#sorted, math.ceil(p * #sorted)))
+   return sorted[i]
+end
+
+-- Each case is function(data) returning the function to time. data holds
+-- the synthetic frames im1, im2 (3xHxW), their byte versions im1_cv, im2_cv
+-- (HxWx3) and gray versions gray1, gray2 (HxW bytes).
+opencv24.benchmark_cases = {
+   TH2CVImage = function(data)
+      return function() opencv24.TH2CVImage(data.im1) end
+   end,
+   CV2THImage = function(data)
+      return function() opencv24.CV2THImage(data.im1_cv) end
+   end,
+   TrackPoints = function(data)
+      return function()
+	 opencv24.TrackPointsLK{im1=data.im1, im2=data.im2, maxPoints=500}
+      end
+   end,
+   DenseOpticalFlowFarnebach = function(data)
+      return function()
+	 opencv24.DenseOpticalFlow{im1=data.gray1, im2=data.gray2, mode='farnebach',
+				   levels=3, iterations=3}
+      end
+   end,
+   -- two flows overlapped on the worker pool
+   DenseOpticalFlowFarnebachAsync = function(data)
+      return function()
+	 local f1 = opencv24.DenseOpticalFlowAsync{im1=data.gray1, im2=data.gray2,
+						   levels=3, iterations=3}
+	 local f2 = opencv24.DenseOpticalFlowAsync{im1=data.gray2, im2=data.gray1,
+						   levels=3, iterations=3}
+	 f1:wait()
+	 f2:wait()
+      end
+   end,
+   DenseOpticalFlowBlock = function(data)
+      return function()
+	 opencv24.DenseOpticalFlow{im1=data.gray1, im2=data.gray2, mode='block',
+				   winsize=8, shiftsize=4, maxrange=8}
+      end
+   end,
+   DenseOpticalFlowBlockLegacy = function(data)
+      return function()
+	 opencv24.DenseOpticalFlow{im1=data.gray1, im2=data.gray2, mode='block_legacy',
+				   winsize=8, shiftsize=4, maxrange=8}
+      end
+   end,
+   ComputeFAST = function(data)
+      return function() opencv24.ComputeFAST(data.im1_cv, 20) end
+   end,
+   ComputeFREAK = function(data)
+      return function() opencv24.ComputeFREAK(data.im1_cv, 20, data.iFREAK) end
+   end,
+   MatchFREAK = function(data)
+      local freaks1 = opencv24.ComputeFREAK(data.im1_cv, 20, data.iFREAK)
+      local freaks2 = opencv24.ComputeFREAK(data.im2_cv, 20, data.iFREAK)
+      return function() opencv24.MatchFREAK(freaks1, freaks2, 512) end
+   end,
+   -- the second image is shifted by (2, 1)
+   MatchFREAKGuided = function(data)
+      local freaks1 = opencv24.ComputeFREAK(data.im1_cv, 20, data.iFREAK)
+      local freaks2 = opencv24.ComputeFREAK(data.im2_cv, 20, data.iFREAK)
+      return function() opencv24.MatchFREAKGuided(freaks1, freaks2, 512, 16, {2, 1}) end
+   end,
+   FindGeometry = function(data)
+      local corresps, distances = opencv24.TrackPointsFREAK{im1=data.im1, im2=data.im2,
+							     iFREAK=data.iFREAK}
+      return function()
+	 opencv24.FindGeometry{corresps=corresps, distances=distances}
+      end
+   end,
+   DetectExtract = function(data)
+      return function()
+	 opencv24.DetectExtract{im=data.im1, detector=data.iDetector,
+				extractor=data.iExtractor, maxPoints=500}
+      end
+   end,
+   -- a batch of 8 jpeg images, decoded in memory
+   DecodeImages = function(data)
+      local jpeg = image.compressJPG(data.im1, 90)
+      local sources = {}
+      for i = 1,8 do
+	 sources[i] = jpeg
+      end
+      return function() opencv24.DecodeImages(sources) end
+   end,
+   CornerHarris = function(data)
+      return function() opencv24.CornerHarris{im=data.im1} end
+   end,
+   HarrisCorners = function(data)
+      return function() opencv24.HarrisCorners{im=data.im1, maxCorners=500} end
+   end,
+   -- LK tracking, FAST and FREAK on the same pair of images, without and
+   -- with frames (cf. opencv24.CreateFrame)
+   PipelineTensors = function(data)
+      return function()
+	 opencv24.TrackPointsLK{im1=data.im1, im2=data.im2, maxPoints=500}
+	 opencv24.ComputeFAST(data.im2, 20)
+	 opencv24.ComputeFREAK(data.im2, 20, data.iFREAK)
+      end
+   end,
+   PipelineFrames = function(data)
+      return function()
+	 local frame1 = opencv24.CreateFrame(data.im1)
+	 local frame2 = opencv24.CreateFrame(data.im2)
+	 opencv24.TrackPointsLK{im1=frame1, im2=frame2, maxPoints=500}
+	 opencv24.ComputeFAST(frame2, 20)
+	 opencv24.ComputeFREAK(frame2, 20, data.iFREAK)
+	 opencv24.DeleteFrame(frame1)
+	 opencv24.DeleteFrame(frame2)
+      end
+   end,
+}
+
+function opencv24.Benchmark(...)
+   local self = {}
+   xlua.unpack_class(
+      self, {...}, 'opencv24.Benchmark', help_desc,
+      {arg='sizes', type='table', default={{320,240}, {640,480}, {1280,720}},
+       help='image sizes, as {width, height} pairs'},
+      {arg='threads', type='table', help='thread counts (default : 1 and the current one)'},
+      {arg='cases', type='table',
+       help='names of the cases to run (default : all, cf. opencv24.benchmark_cases)'},
+      {arg='nIters', type='number', default=20, help='timed runs per case'},
+      {arg='format', type='string', default='csv', help='csv | lua | none'},
+      {arg='file', type='string', help='write the results to this file instead of stdout'})
+   local nThreads0 = opencv24.GetNumThreads()
+   local threads = self.threads or ((nThreads0 > 1) and {1, nThreads0} or {1})
+   local cases = self.cases
+   if cases == nil then
+      cases = {}
+      for name,_ in pairs(opencv24.benchmark_cases) do
+	 table.insert(cases, name)
+      end
+      table.sort(cases)
+   end
+   local out = io.stdout
+   if self.file then
+      out = assert(io.open(self.file, 'w'))
+   end
+   if self.format == 'csv' then
+      out:write('case,width,height,threads,iters,median_ms,p99_ms,mpix_per_s\n')
+   end
+
+   local data = {iFREAK = opencv24.CreateFREAK(),
+		 iDetector = opencv24.CreateFeatureDetector('FAST'),
+		 iExtractor = opencv24.CreateDescriptorExtractor('SURF')}
+   local results = {}
+   for _,size in ipairs(self.sizes) do
+      local w, h = size[1], size[2]
+      data.im1 = syntheticImage(w, h, 1)
+      data.im2 = shiftedImage(data.im1, 2, 1)
+      data.im1_cv = opencv24.TH2CVImage(data.im1)
+      data.im2_cv = opencv24.TH2CVImage(data.im2)
+      data.gray1 = opencv24.TH2CVImage(image.rgb2y(data.im1)[1])
+      data.gray2 = opencv24.TH2CVImage(image.rgb2y(data.im2)[1])
+      for _,nThreads in ipairs(threads) do
+	 opencv24.SetNumThreads(nThreads)
+	 for _,name in ipairs(cases) do
+	    local case = opencv24.benchmark_cases[name]
+	    if case == nil then
+	       error('opencv24.Benchmark : unknown case ' .. name)
+	    end
+	    local run = case(data)
+	    run() -- warmup
+	    local times = {}
+	    local timer = torch.Timer()
+	    for i = 1,self.nIters do
+	       timer:reset()
+	       run()
+	       times[i] = timer:time().real
+	    end
+	    table.sort(times)
+	    local median = percentile(times, 0.5)
+	    local result = {case = name, width = w, height = h, threads = nThreads,
+			    iters = self.nIters, median_ms = 1000 * median,
+			    p99_ms = 1000 * percentile(times, 0.99),
+			    mpix_per_s = w * h / (1e6 * median)}
+	    table.insert(results, result)
+	    if self.format == 'csv' then
+	       out:write(string.format('%s,%d,%d,%d,%d,%.4f,%.4f,%.3f\n',
+				       result.case, w, h, nThreads, self.nIters,
+				       result.median_ms, result.p99_ms,
+				       result.mpix_per_s))
+	    elseif self.format == 'lua' then
+	       out:write(string.format('{case=%q, width=%d, height=%d, threads=%d, iters=%d, median_ms=%.4f, p99_ms=%.4f, mpix_per_s=%.3f}\n',
+				       result.case, w, h, nThreads, self.nIters,
+				       result.median_ms, result.p99_ms,
+				       result.mpix_per_s))
+	    end
+	    out:flush()
+	    collectgarbage()
+	 end
+      end
+   end
+   opencv24.SetNumThreads(nThreads0)
+   opencv24.DeleteFREAK(data.iFREAK)
+   opencv24.DeleteFeatureDetector(data.iDetector)
+   opencv24.DeleteDescriptorExtractor(data.iExtractor)
+   if self.file then
+      out:close()
+   end
+   return results
+end
@@ -0,0 +1,179 @@
+#include "blockflow.hpp"
+
+#include<cstdlib>
+#include<climits>
+
+#if defined(__SSE2__)
+#define BLOCKFLOW_SSE2
+#include<emmintrin.h>
+#endif
+
+//============================================================
+// SAD kernel
+//
+
+// SAD of two w x h blocks. Stops (returning a value >= bound) as soon as
+// the partial sum reaches bound.
+static inline unsigned int BlockSAD(const uchar* a, size_t aStep, const uchar* b,
+				    size_t bStep, int w, int h, unsigned int bound) {
+  unsigned int sad = 0;
+  for (int i = 0; i < h; ++i, a += aStep, b += bStep) {
+    int j = 0;
+#ifdef BLOCKFLOW_SSE2
+    __m128i acc = _mm_setzero_si128();
+    for (; j + 16 <= w; j += 16)
+      acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(a + j)),
+					    _mm_loadu_si128((const __m128i*)(b + j))));
+    for (; j + 8 <= w; j += 8)
+      acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadl_epi64((const __m128i*)(a + j)),
+					    _mm_loadl_epi64((const __m128i*)(b + j))));
+    sad += _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+    for (; j < w; ++j)
+      sad += abs((int)a[j] - (int)b[j]);
+    if (sad >= bound)
+      return sad;
+  }
+  return sad;
+}
+
+//============================================================
+// Search
+//
+
+static const int largeDiamond[8][2] = {{0,-2}, {1,-1}, {2,0}, {1,1},
+				       {0,2}, {-1,1}, {-2,0}, {-1,-1}};
+static const int smallDiamond[4][2] = {{0,-1}, {1,0}, {0,1}, {-1,0}};
+
+class BlockFlowBody : public ParallelLoopBody {
+public:
+  BlockFlowBody(const Mat & prev, const Mat & next, const BlockFlowParams & params,
+		const Mat & seed, Mat & grid)
+    :prev(prev), next(next), p(params), seed(seed), grid(grid) {};
+
+  virtual void operator()(const Range & range) const {
+    const int bs = p.blockSize;
+    const unsigned int earlyExit =
+      (p.earlyExitSAD > 0) ? (unsigned int)(p.earlyExitSAD * bs * bs) : 0;
+    for (int by = range.start; by < range.end; ++by) {
+      const int y = by * p.shift;
+      Point left(0, 0);
+      for (int bx = 0; bx < grid.cols; ++bx) {
+	const int x = bx * p.shift;
+	Candidate c(*this, x, y);
+	c.test(0, 0);
+	if (!seed.empty()) {
+	  const Vec2f & s = seed.at<Vec2f>(y + bs/2, x + bs/2);
+	  c.test(cvRound(s[0]), cvRound(s[1]));
+	}
+	if (bx > 0)
+	  c.test(left.x, left.y);
+	if (c.bestSAD > earlyExit) {
+	  if (p.exhaustive) {
+	    for (int dy = -p.maxRange; dy <= p.maxRange; ++dy)
+	      for (int dx = -p.maxRange; dx <= p.maxRange; ++dx)
+		c.test(dx, dy);
+	  } else {
+	    // large diamond until the center is the best, then small diamond
+	    for (int iter = 0; iter <= 2*p.maxRange; ++iter) {
+	      const Point center = c.best;
+	      for (int k = 0; k < 8; ++k)
+		c.test(center.x + largeDiamond[k][0], center.y + largeDiamond[k][1]);
+	      if (c.best == center)
+		break;
+	    }
+	    const Point center = c.best;
+	    for (int k = 0; k < 4; ++k)
+	      c.test(center.x + smallDiamond[k][0], center.y + smallDiamond[k][1]);
+	  }
+	}
+	grid.at<Vec2i>(by, bx) = Vec2i(c.best.x, c.best.y);
+	left = c.best;
+      }
+    }
+  }
+
+private:
+  // best displacement of the block at (x, y) among the tested ones
+  struct Candidate {
+    Candidate(const BlockFlowBody & body, int x, int y)
+      :body(body), x(x), y(y), best(0, 0), bestSAD(UINT_MAX),
+       a(body.prev.ptr<uchar>(y) + x) {};
+    inline void test(int dx, int dy) {
+      const BlockFlowParams & p = body.p;
+      if ((abs(dx) > p.maxRange) || (abs(dy) > p.maxRange) ||
+	  (x + dx < 0) || (x + dx + p.blockSize > body.next.cols) ||
+	  (y + dy < 0) || (y + dy + p.blockSize > body.next.rows))
+	return;
+      const unsigned int sad = BlockSAD(a, body.prev.step, body.next.ptr<uchar>(y + dy) + x + dx,
+					body.next.step, p.blockSize, p.blockSize, bestSAD);
+      if (sad < bestSAD) {
+	bestSAD = sad;
+	best = Point(dx, dy);
+      }
+    };
+    const BlockFlowBody & body;
+    int x, y;
+    Point best;
+    unsigned int bestSAD;
+    const uchar* a;
+  };
+
+  const Mat & prev;
+  const Mat & next;
+  const BlockFlowParams & p;
+  const Mat & seed;
+  Mat & grid;
+};
+
+//============================================================
+// Full resolution output
+//
+
+class BlockFlowFillBody : public ParallelLoopBody {
+public:
+  BlockFlowFillBody(const Mat & grid, const vector<int> & blockOfX,
+		    const BlockFlowParams & p, Mat & flow)
+    :grid(grid), blockOfX(blockOfX), p(p), flow(flow) {};
+  virtual void operator()(const Range & range) const {
+    for (int y = range.start; y < range.end; ++y) {
+      const int by = max(0, min(grid.rows - 1,
+				cvFloor((y - p.blockSize/2 + p.shift/2) / (float)p.shift)));
+      const Vec2i* g = grid.ptr<Vec2i>(by);
+      Vec2f* f = flow.ptr<Vec2f>(y);
+      for (int x = 0; x < flow.cols; ++x) {
+	const Vec2i & v = g[blockOfX[x]];
+	f[x] = Vec2f((float)v[0], (float)v[1]);
+      }
+    }
+  }
+private:
+  const Mat & grid;
+  const vector<int> & blockOfX;
+  const BlockFlowParams & p;
+  Mat & flow;
+};
+
+void BlockMatchingFlow(const Mat & prev, const Mat & next, const BlockFlowParams & params,
+		       const Mat & seed, Mat & flow) {
+  THassert((prev.type() == CV_8U) && (next.type() == CV_8U) && (prev.size() == next.size()));
+  THassert(seed.empty() || ((seed.type() == CV_32FC2) && (seed.size() == prev.size())));
+  THassert((params.blockSize > 0) && (params.shift > 0) && (params.maxRange >= 0));
+  flow.create(prev.size(), CV_32FC2);
+  const int bs = params.blockSize;
+  if ((prev.rows < bs) || (prev.cols < bs)) {
+    flow.setTo(Scalar::all(0));
+    return;
+  }
+  Mat grid((prev.rows - bs) / params.shift + 1, (prev.cols - bs) / params.shift + 1, CV_32SC2);
+  parallel_for_(Range(0, grid.rows), BlockFlowBody(prev, next, params, seed, grid),
+		ParallelStripes(grid.rows));
+
+  // nearest block center of each column
+  vector<int> blockOfX(prev.cols);
+  for (int x = 0; x < prev.cols; ++x)
+    blockOfX[x] = max(0, min(grid.cols - 1,
+			     cvFloor((x - bs/2 + params.shift/2) / (float)params.shift)));
+  parallel_for_(Range(0, prev.rows), BlockFlowFillBody(grid, blockOfX, params, flow),
+		ParallelStripes(prev.rows, 32));
+}
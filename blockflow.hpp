@@ -0,0 +1,33 @@
+#ifndef __BLOCKFLOW_HPP__
+#define __BLOCKFLOW_HPP__
+
+#include "common.hpp"
+
+//============================================================
+// Block matching flow
+//
+// Replacement of the legacy cvCalcOpticalFlowBM. Blocks of blockSize^2
+// pixels, every shift pixels, are searched in the next frame within
+// +-maxRange, with SSE2 SAD kernels, in parallel over the rows of blocks.
+// The search starts from the best of the predictors (zero, the seed flow,
+// the block on the left) and stops early if its SAD is below
+// earlyExitSAD per pixel. It is then either exhaustive (with partial SAD
+// early termination) or a diamond descent from the predictor. The flow is
+// returned at full resolution (each pixel gets the vector of the nearest
+// block), as CV_32FC2 (x, y).
+//
+
+struct BlockFlowParams {
+  int blockSize;
+  int shift;
+  int maxRange;
+  bool exhaustive;
+  float earlyExitSAD;     // per pixel, <= 0 to disable
+};
+
+// prev and next are CV_8U of the same size. If seed is not empty, it is a
+// full resolution CV_32FC2 flow used as predictor (eg. the previous flow).
+void BlockMatchingFlow(const Mat & prev, const Mat & next, const BlockFlowParams & params,
+		       const Mat & seed, Mat & flow);
+
+#endif
@@ -1,4 +1,5 @@
 #include "common.hpp"
+#include "frame.hpp"
 
 void display(const Mat & im) {
   Mat tmp;
@@ -12,9 +13,14 @@ mat3b TensorToMat3b<ubyte>(const TH::Tensor<ubyte> & im) {
   if (im.size(0) == 3) {
     long h = im.size(1);
     long w = im.size(2);
+    mat3b ret = ScratchMat(h, w, CV_8UC3);
+    STATS_ALLOC("TensorToMat3b", h*w*3);
+    if (im.stride(2) == 1) {
+      PlanarToBGR(im, ret, 1.);
+      return ret;
+    }
     const long* is = im.stride();
     const ubyte* im_p = im.data();
-    mat3b ret(h, w);
     for (int i = 0; i < h; ++i)
       for (int j = 0; j < w; ++j)
 	ret(i,j)=Vec3b(im_p[is[0]*2+is[1]*i+is[2]*j],
@@ -22,9 +28,114 @@ mat3b TensorToMat3b<ubyte>(const TH::Tensor<ubyte> & im) {
 		       im_p[is[0]*0+is[1]*i+is[2]*j]);
     return ret;
   } else if (im.size(2) == 3) {
-    return mat3b(im.size(0), im.size(1), (Vec3b*)im.data());
+    long h = im.size(0);
+    long w = im.size(1);
+    if ((im.stride(2) == 1) && (im.stride(1) == 3))
+      return mat3b(h, w, (Vec3b*)im.data(), im.stride(0));
+    const long* is = im.stride();
+    const ubyte* im_p = im.data();
+    mat3b ret = ScratchMat(h, w, CV_8UC3);
+    STATS_ALLOC("TensorToMat3b", h*w*3);
+    for (int i = 0; i < h; ++i)
+      for (int j = 0; j < w; ++j)
+	ret(i,j)=Vec3b(im_p[is[0]*i+is[1]*j  ],
+		       im_p[is[0]*i+is[1]*j+is[2]  ],
+		       im_p[is[0]*i+is[1]*j+is[2]*2]);
+    return ret;
   } else {
     THerror("TensorToMat3b: tensor must be 3xHxW or HxWx3");
   }
   return mat3b(0,0); //remove warning
 }
+
+DescriptorTensor::DescriptorTensor(lua_State* L, int i)
+  :depth(-1), tb(NULL), tf(NULL), td(NULL) {
+  if (luaT_isudata(L, i, luaT_typenameid(L, "torch.ByteTensor"))) {
+    depth = CV_8U;
+    tb = FromLuaStack<TH::Tensor<ubyte> >(L, i);
+  } else if (luaT_isudata(L, i, luaT_typenameid(L, "torch.FloatTensor"))) {
+    depth = CV_32F;
+    tf = FromLuaStack<TH::Tensor<float> >(L, i);
+  } else {
+    depth = CV_64F;
+    td = FromLuaStack<TH::Tensor<double> >(L, i);
+  }
+}
+
+bool DescriptorTensor::accepts(int descType) const {
+  return (depth != CV_8U) || (CV_MAT_DEPTH(descType) == CV_8U);
+}
+
+template<typename T>
+static void SetDescriptors(const Mat & descs, TH::Tensor<T> & t) {
+  if (descs.empty()) {
+    t.resize(0);
+    return;
+  }
+  t.resize(descs.rows, descs.cols);
+  Mat t_cv(descs.rows, descs.cols, DataType<T>::type, (void*)t.data(),
+	   t.stride(0)*sizeof(T));
+  if (descs.depth() == t_cv.depth())
+    descs.copyTo(t_cv);
+  else
+    descs.convertTo(t_cv, t_cv.type());
+}
+
+void DescriptorTensor::set(const Mat & descs) {
+  THassert(accepts(descs.type()));
+  switch (depth) {
+  case CV_8U:
+    SetDescriptors(descs, tb);
+    break;
+  case CV_32F:
+    SetDescriptors(descs, tf);
+    break;
+  default:
+    SetDescriptors(descs, td);
+  }
+}
+
+void DescriptorTensor::clear() {
+  set(Mat());
+}
+
+vector<DescriptorTensor> DescriptorTensorsFromLuaStack(lua_State* L, int i) {
+  int n = luaL_getn(L, i);
+  vector<DescriptorTensor> ret;
+  for (int j = 0; j < n; ++j) {
+    lua_rawgeti(L, i, j+1);
+    ret.push_back(DescriptorTensor(L, -1));
+    lua_pop(L, 1); // the table keeps a reference
+  }
+  return ret;
+}
+
+matb GrayFromLuaStack(lua_State* L, int i) {
+  Ptr<Frame> frame = FrameFromLuaStack(L, i);
+  if (!frame.empty())
+    return frame->gray();
+  if (luaT_isudata(L, i, luaT_typenameid(L, "torch.ByteTensor")))
+    return TensorToMatGray(FromLuaStack<TH::Tensor<ubyte> >(L, i));
+  else if (luaT_isudata(L, i, luaT_typenameid(L, "torch.FloatTensor")))
+    return TensorToMatGray(FromLuaStack<TH::Tensor<float> >(L, i));
+  else
+    return TensorToMatGray(FromLuaStack<TH::Tensor<double> >(L, i));
+}
+
+template<typename Treal>
+static void CheckGrayTensor(const TH::Tensor<Treal> & im) {
+  if (!((im.nDimension() == 2) ||
+	((im.nDimension() == 3) && ((im.size(0) == 3) || (im.size(2) == 3)))))
+    THerror("TensorToMatGray: tensor must be HxW, 3xHxW or HxWx3");
+}
+
+void CheckImageFromLuaStack(lua_State* L, int i) {
+  if (lua_isnumber(L, i))
+    frames_g.get(lua_tointeger(L, i));
+  else if (luaT_isudata(L, i, luaT_typenameid(L, "torch.ByteTensor")))
+    CheckGrayTensor(FromLuaStack<TH::Tensor<ubyte> >(L, i));
+  else if (luaT_isudata(L, i, luaT_typenameid(L, "torch.FloatTensor")))
+    CheckGrayTensor(FromLuaStack<TH::Tensor<float> >(L, i));
+  else
+    CheckGrayTensor(FromLuaStack<TH::Tensor<double> >(L, i));
+}
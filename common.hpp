@@ -14,6 +14,8 @@ using namespace std;
 using namespace cv;
 
 #include "THpp.hpp"
+#include "stats.hpp"
+#include "arena.hpp"
 
 #if CV_MAJOR_VERSION != 2
 #error OpenCV version must be 2.x.x
@@ -21,6 +23,9 @@ using namespace cv;
 #if CV_MINOR_VERSION < 4
 #error OpenCV version must be >= 2.4.0
 #endif
+#if CV_MINOR_VERSION == 4 && CV_SUBMINOR_VERSION < 3
+#error OpenCV version must be >= 2.4.3 (parallel_for_)
+#endif
 
 typedef Mat_<float> matf;
 typedef Mat_<double> matd;
@@ -35,31 +40,125 @@ template<typename T, typename T2> inline bool epsEqual(T a, T2 b, double eps = 0
 
 void display(const Mat & im);
 
+// Number of stripes to pass to parallel_for_ for a loop of n iterations.
+// parallel_for_ makes one stripe per iteration by default, which does not
+// amortize the per-stripe setup (buffers, ...) : use a few stripes per thread.
+inline double ParallelStripes(long n, long minPerStripe = 1) {
+  return (double)max(1L, min(n / max(1L, minPerStripe), 4L * getNumThreads()));
+}
+
+//============================================================
+// Planar <-> interleaved conversions
+//
+// The planes are converted with convertTo and (de)interleaved with
+// merge/split, which are vectorized in OpenCV. Rows are processed by blocks,
+// in parallel. Planes must have contiguous rows (stride(2) == 1).
+//
+
+// planar RGB (3xHxW) tensor -> interleaved BGR bytes, scaled by scale
+template<typename Treal>
+class PlanarToBGRBody : public ParallelLoopBody {
+public:
+  PlanarToBGRBody(const TH::Tensor<Treal> & im, mat3b & out, double scale)
+    :im(im), out(out), scale(scale) {};
+  virtual void operator()(const Range & range) const {
+    const int w = im.size(2), nRows = range.end - range.start;
+    const Treal* p = im.data() + range.start*im.stride(1);
+    Mat planes[3];
+    for (int k = 0; k < 3; ++k) {
+      Mat plane(nRows, w, DataType<Treal>::type, (void*)(p + (2-k)*im.stride(0)),
+		im.stride(1)*sizeof(Treal));
+      if ((DataType<Treal>::depth == CV_8U) && (scale == 1.))
+	planes[k] = plane;
+      else
+	plane.convertTo(planes[k], CV_8U, scale);
+    }
+    Mat dst = out.rowRange(range.start, range.end);
+    merge(planes, 3, dst);
+  }
+private:
+  const TH::Tensor<Treal> & im;
+  mat3b & out;
+  double scale;
+};
+
+template<typename Treal>
+void PlanarToBGR(const TH::Tensor<Treal> & im, mat3b & out, double scale) {
+  THassert((im.nDimension() == 3) && (im.size(0) == 3) && (im.stride(2) == 1));
+  THassert((out.rows == im.size(1)) && (out.cols == im.size(2)));
+  parallel_for_(Range(0, out.rows), PlanarToBGRBody<Treal>(im, out, scale),
+		ParallelStripes(out.rows, 16));
+}
+
+// interleaved BGR bytes -> planar RGB (3xHxW) tensor, scaled by scale
+template<typename Treal>
+class BGRToPlanarBody : public ParallelLoopBody {
+public:
+  BGRToPlanarBody(const mat3b & in, TH::Tensor<Treal> & im, double scale)
+    :in(in), im(im), scale(scale) {};
+  virtual void operator()(const Range & range) const {
+    const int w = im.size(2), nRows = range.end - range.start;
+    Treal* p = im.data() + range.start*im.stride(1);
+    Mat planes[3];
+    split(in.rowRange(range.start, range.end), planes);
+    for (int k = 0; k < 3; ++k) {
+      Mat plane(nRows, w, DataType<Treal>::type, (void*)(p + (2-k)*im.stride(0)),
+		im.stride(1)*sizeof(Treal));
+      planes[k].convertTo(plane, DataType<Treal>::type, scale);
+    }
+  }
+private:
+  const mat3b & in;
+  TH::Tensor<Treal> & im;
+  double scale;
+};
+
+template<typename Treal>
+void BGRToPlanar(const mat3b & in, TH::Tensor<Treal> & im, double scale) {
+  THassert((im.nDimension() == 3) && (im.size(0) == 3) && (im.stride(2) == 1));
+  THassert((in.rows == im.size(1)) && (in.cols == im.size(2)));
+  parallel_for_(Range(0, in.rows), BGRToPlanarBody<Treal>(in, im, scale),
+		ParallelStripes(in.rows, 16));
+}
+
 template<typename Treal>
 mat3b TensorToMat3b(const TH::Tensor<Treal> & im) {
   if (im.size(0) == 3) {
     long h = im.size(1);
     long w = im.size(2);
+    mat3b ret = ScratchMat(h, w, CV_8UC3);
+    STATS_ALLOC("TensorToMat3b", h*w*3);
+    if (im.stride(2) == 1) {
+      PlanarToBGR(im, ret, 255.);
+      return ret;
+    }
     const long* is = im.stride();
     const Treal* im_p = im.data();
-    mat3b ret(h, w);
     for (int i = 0; i < h; ++i)
       for (int j = 0; j < w; ++j)
-	ret(i,j)=Vec3b(min<Treal>(255., max<Treal>(0.0, im_p[is[0]*2+is[1]*i+is[2]*j]*255.)),
-		       min<Treal>(255., max<Treal>(0.0, im_p[is[0]  +is[1]*i+is[2]*j]*255.)),
-		       min<Treal>(255., max<Treal>(0.0, im_p[is[0]*0+is[1]*i+is[2]*j]*255.)));
+	ret(i,j)=Vec3b(saturate_cast<uchar>(im_p[is[0]*2+is[1]*i+is[2]*j]*255.),
+		       saturate_cast<uchar>(im_p[is[0]  +is[1]*i+is[2]*j]*255.),
+		       saturate_cast<uchar>(im_p[is[0]*0+is[1]*i+is[2]*j]*255.));
     return ret;
   } else if (im.size(2) == 3) {
     long h = im.size(0);
     long w = im.size(1);
+    mat3b ret = ScratchMat(h, w, CV_8UC3);
+    STATS_ALLOC("TensorToMat3b", h*w*3);
+    if ((im.stride(2) == 1) && (im.stride(1) == 3)) {
+      Mat rgb = ScratchMat(h, w, CV_8UC3);
+      Mat(h, w, CV_MAKETYPE(DataType<Treal>::depth, 3), (void*)im.data(),
+	  im.stride(0)*sizeof(Treal)).convertTo(rgb, CV_8UC3, 255.);
+      cvtColor(rgb, ret, CV_RGB2BGR);
+      return ret;
+    }
     const long* is = im.stride();
     const Treal* im_p = im.data();
-    mat3b ret(h, w);
     for (int i = 0; i < h; ++i)
       for (int j = 0; j < w; ++j)
-	ret(i,j)=Vec3b(min<Treal>(255., max<Treal>(0.0, im_p[is[0]*i+is[1]*j+is[2]*2]*255.)),
-		       min<Treal>(255., max<Treal>(0.0, im_p[is[0]*i+is[1]*j+is[2]  ]*255.)),
-		       min<Treal>(255., max<Treal>(0.0, im_p[is[0]*i+is[1]*j+is[2]*0]*255.)));
+	ret(i,j)=Vec3b(saturate_cast<uchar>(im_p[is[0]*i+is[1]*j+is[2]*2]*255.),
+		       saturate_cast<uchar>(im_p[is[0]*i+is[1]*j+is[2]  ]*255.),
+		       saturate_cast<uchar>(im_p[is[0]*i+is[1]*j+is[2]*0]*255.));
     return ret;
   } else {
     THerror("TensorToMat3b: tensor must be 3xHxW or HxWx3");
@@ -67,10 +166,148 @@ mat3b TensorToMat3b(const TH::Tensor<Treal> & im) {
   return mat3b(0,0); //remove warning
 }
 
-// byte case : we may not have to copy
+// byte case : HxWx3 tensors with packed pixels are wrapped without copy
 template<>
 mat3b TensorToMat3b<ubyte>(const TH::Tensor<ubyte> & im);
 
+//============================================================
+// Tensor -> gray conversion
+//
+// Fused TensorToMat3b + cvtColor(CV_BGR2GRAY), without the intermediate
+// colour image : each row is converted to bytes with convertTo (vectorized)
+// into a per-stripe buffer, then combined with the fixed-point weights of
+// cvtColor, which gives the same result. Rows are processed in parallel.
+// Accepts HxW, 3xHxW (RGB planes) and HxWx3 tensors (RGB, or BGR for byte
+// tensors, as in TensorToMat3b). Real tensors are scaled by 255.
+//
+
+// cvtColor CV_BGR2GRAY weights
+enum {GRAY_SHIFT = 14, GRAY_R = 4899, GRAY_G = 9617, GRAY_B = 1868};
+
+// cn is the distance between two pixels of a channel (1 planar, 3 interleaved)
+inline void CombineGrayRow(const uchar* r, const uchar* g, const uchar* b, int cn,
+			   uchar* gray, int w) {
+  if (cn == 1) {
+    for (int j = 0; j < w; ++j)
+      gray[j] = (uchar)((r[j]*GRAY_R + g[j]*GRAY_G + b[j]*GRAY_B
+			 + (1 << (GRAY_SHIFT-1))) >> GRAY_SHIFT);
+  } else {
+    for (int j = 0; j < w; ++j)
+      gray[j] = (uchar)((r[j*cn]*GRAY_R + g[j*cn]*GRAY_G + b[j*cn]*GRAY_B
+			 + (1 << (GRAY_SHIFT-1))) >> GRAY_SHIFT);
+  }
+}
+
+template<typename Treal>
+class TensorToGrayBody : public ParallelLoopBody {
+public:
+  TensorToGrayBody(const TH::Tensor<Treal> & im, matb & out, double scale,
+		   bool planar, bool bgr)
+    :im(im), out(out), scale(scale), planar(planar), bgr(bgr) {};
+  virtual void operator()(const Range & range) const {
+    const int w = out.cols;
+    const long* is = im.stride();
+    const bool isByte = (DataType<Treal>::depth == CV_8U) && (scale == 1.);
+    vector<uchar> buf(3*w);
+    const uchar* c[3];
+    for (int i = range.start; i < range.end; ++i) {
+      int cn;
+      if (planar) {
+	cn = 1;
+	for (int k = 0; k < 3; ++k) {
+	  const Treal* src = im.data() + k*is[0] + i*is[1];
+	  uchar* dst = &(buf[k*w]);
+	  c[k] = dst;
+	  if (is[2] == 1) {
+	    if (isByte) {
+	      c[k] = (const uchar*)src;
+	    } else {
+	      Mat dstRow(1, w, CV_8U, dst);
+	      Mat(1, w, DataType<Treal>::type, (void*)src).convertTo(dstRow, CV_8U, scale);
+	    }
+	  } else {
+	    for (int j = 0; j < w; ++j)
+	      dst[j] = saturate_cast<uchar>(src[j*is[2]]*scale);
+	  }
+	}
+      } else {
+	cn = 3;
+	const Treal* src = im.data() + i*is[0];
+	const uchar* p = &(buf[0]);
+	if ((is[1] == 3) && (is[2] == 1)) {
+	  if (isByte) {
+	    p = (const uchar*)src;
+	  } else {
+	    Mat dstRow(1, w, CV_8UC3, &(buf[0]));
+	    Mat(1, w, CV_MAKETYPE(DataType<Treal>::depth, 3), (void*)src)
+	      .convertTo(dstRow, CV_8UC3, scale);
+	  }
+	} else {
+	  for (int j = 0; j < w; ++j)
+	    for (int k = 0; k < 3; ++k)
+	      buf[3*j+k] = saturate_cast<uchar>(src[j*is[1]+k*is[2]]*scale);
+	}
+	for (int k = 0; k < 3; ++k)
+	  c[k] = p + k;
+      }
+      CombineGrayRow(c[bgr ? 2 : 0], c[1], c[bgr ? 0 : 2], cn, out.ptr(i), w);
+    }
+  }
+private:
+  const TH::Tensor<Treal> & im;
+  matb & out;
+  double scale;
+  bool planar, bgr;
+};
+
+// The result is a view of im for byte HxW tensors with contiguous rows, and a
+// scratch matrix otherwise (cf. arena.hpp)
+template<typename Treal>
+matb TensorToMatGray(const TH::Tensor<Treal> & im) {
+  const bool isByte = (DataType<Treal>::depth == CV_8U);
+  const double scale = isByte ? 1. : 255.;
+  const long* is = im.stride();
+  if (im.nDimension() == 2) {
+    const int h = im.size(0), w = im.size(1);
+    if (is[1] == 1) {
+      Mat src(h, w, DataType<Treal>::type, (void*)im.data(), is[0]*sizeof(Treal));
+      if (isByte)
+	return src;
+      matb ret = ScratchMat(h, w, CV_8U);
+      STATS_ALLOC("TensorToMatGray", h*w);
+      src.convertTo(ret, CV_8U, scale);
+      return ret;
+    }
+    matb ret = ScratchMat(h, w, CV_8U);
+    STATS_ALLOC("TensorToMatGray", h*w);
+    for (int i = 0; i < h; ++i)
+      for (int j = 0; j < w; ++j)
+	ret(i, j) = saturate_cast<uchar>(im.data()[i*is[0]+j*is[1]]*scale);
+    return ret;
+  }
+  if (im.nDimension() != 3)
+    THerror("TensorToMatGray: tensor must be HxW, 3xHxW or HxWx3");
+  const bool planar = (im.size(0) == 3);
+  if (!planar && (im.size(2) != 3))
+    THerror("TensorToMatGray: tensor must be HxW, 3xHxW or HxWx3");
+  const int h = planar ? im.size(1) : im.size(0);
+  const int w = planar ? im.size(2) : im.size(1);
+  matb ret = ScratchMat(h, w, CV_8U);
+  STATS_ALLOC("TensorToMatGray", h*w);
+  parallel_for_(Range(0, h),
+		TensorToGrayBody<Treal>(im, ret, scale, planar, isByte && !planar),
+		ParallelStripes(h, 16));
+  return ret;
+}
+
+// Gray image from a Byte, Float or Double tensor, or a frame handle (cf.
+// frame.hpp), at index i of the lua stack
+matb GrayFromLuaStack(lua_State* L, int i);
+// Raises the lua error GrayFromLuaStack(L, i) would, without converting nor
+// holding anything : for the bindings that get other objects first (cf.
+// registry.hpp)
+void CheckImageFromLuaStack(lua_State* L, int i);
+
 template<typename Treal>
 Mat TensorToMat(TH::Tensor<Treal> & T) {
   const int n = T.nDimension();
@@ -96,20 +333,45 @@ Mat TensorToMat(TH::Tensor<Treal> & T) {
   default:
     {
       T = T.newContiguous();
-      int* sizes = new int[n];
-      size_t* steps = new size_t[n-1];
+      int sizes[CV_MAX_DIM];
+      size_t steps[CV_MAX_DIM];
+      THassert(n <= CV_MAX_DIM);
       for (int i = 0; i < n; ++i)
 	sizes[i] = T.size(i);
       for (int i = 0; i < n-1; ++i)
 	steps[i] = T.stride(i)*sizeof(Treal);
-      Mat ret(T.nDimension(), sizes, DataType<Treal>::type, (void*)T.data(), steps);
-      delete[] steps;
-      delete[] sizes;
-      return ret;
+      return Mat(n, sizes, DataType<Treal>::type, (void*)T.data(), steps);
     }
   }
 }
 
+//============================================================
+// Descriptor tensors
+//
+// Output of the descriptor extractors : a ByteTensor for binary descriptors
+// (CV_8U, eg. ORB, BRIEF), or a Float/DoubleTensor, which can hold both kinds.
+// The descriptors are written with one copyTo/convertTo into the tensor.
+//
+
+class DescriptorTensor {
+public:
+  // tensor at index i of the lua stack
+  DescriptorTensor(lua_State* L, int i);
+  // true if descriptors of depth descType (CV_8U, CV_32F...) fit in the tensor
+  bool accepts(int descType) const;
+  // resizes the tensor to descs.rows x descs.cols and copies the descriptors
+  void set(const Mat & descs);
+  void clear();
+private:
+  int depth;
+  TH::Tensor<ubyte>  tb;
+  TH::Tensor<float>  tf;
+  TH::Tensor<double> td;
+};
+
+// table of descriptor tensors at index i of the lua stack
+vector<DescriptorTensor> DescriptorTensorsFromLuaStack(lua_State* L, int i);
+
 template<typename Treal>
 inline Mat_<Treal> TensorToMat2d(TH::Tensor<Treal> & T) {
   return (Mat_<Treal>)TensorToMat(T);
@@ -0,0 +1,46 @@
+#include "flow.hpp"
+
+FarnebackFlow::FarnebackFlow(double pyrScale, int levels, int winSize,
+			     int iterations, int polyN, double polySigma,
+			     bool usePrevious)
+  :pyrScale(pyrScale), levels(levels), winSize(winSize), iterations(iterations),
+   polyN(polyN), polySigma(polySigma), usePrevious(usePrevious),
+   hasPrev(false), hasFlow(false) {
+}
+
+void FarnebackFlow::reset() {
+  hasPrev = false;
+  hasFlow = false;
+}
+
+bool FarnebackFlow::push(const Mat & frame, Mat flowOut) {
+  THassert(frame.type() == CV_8U);
+  // copyTo only reallocates if the frame size changes
+  frame.copyTo(next);
+  if (!hasPrev || (prev.size() != next.size())) {
+    swap(prev, next);
+    hasPrev = true;
+    hasFlow = false;
+    return false;
+  }
+  int flags = 0;
+  if (usePrevious && hasFlow && (flow_.size() == next.size()))
+    flags = OPTFLOW_USE_INITIAL_FLOW;
+  if (flowOut.empty()) {
+    // no-op in steady state, and keeps the previous flow as initial guess
+    flow_.create(next.size(), CV_32FC2);
+    calcOpticalFlowFarneback(prev, next, flow_, pyrScale, levels, winSize,
+			     iterations, polyN, polySigma, flags);
+  } else {
+    THassert((flowOut.type() == CV_32FC2) && (flowOut.size() == next.size()));
+    if (flags)
+      flow_.copyTo(flowOut);
+    calcOpticalFlowFarneback(prev, next, flowOut, pyrScale, levels, winSize,
+			     iterations, polyN, polySigma, flags);
+    if (usePrevious)
+      flowOut.copyTo(flow_);
+  }
+  swap(prev, next);
+  hasFlow = flowOut.empty() || usePrevious;
+  return true;
+}
@@ -0,0 +1,77 @@
+#ifndef __FLOW_HPP__
+#define __FLOW_HPP__
+
+#include "common.hpp"
+
+//============================================================
+// Persistent Farneback flow
+//
+// Computes the flow between consecutive frames of a video. The previous
+// gray frame and the CV_32FC2 flow buffer are kept across frames, so that
+// a steady-state push() allocates nothing. If usePrevious, the previous flow
+// is the initial guess of the next one (OPTFLOW_USE_INITIAL_FLOW).
+//
+
+class FarnebackFlow {
+public:
+  FarnebackFlow(double pyrScale, int levels, int winSize, int iterations,
+		int polyN, double polySigma, bool usePrevious);
+  // Pushes a new 8-bit gray frame (copied). Returns false if there was no
+  // previous frame (or its size differs), in which case no flow is computed.
+  // If flowOut is not empty, it must be a CV_32FC2 matrix of the frame size,
+  // and the flow is computed directly into it (eg. a wrapped HxWx2 tensor).
+  bool push(const Mat & frame, Mat flowOut = Mat());
+  // last flow computed without flowOut (CV_32FC2)
+  inline const Mat & flow() const {return flow_;};
+  void reset();
+private:
+  double pyrScale;
+  int levels, winSize, iterations, polyN;
+  double polySigma;
+  bool usePrevious;
+  Mat prev, next, flow_;
+  bool hasPrev, hasFlow;
+};
+
+//============================================================
+// Flow layout conversions
+//
+// CV_32FC2 flow <-> planar (2xHxW) tensor, plane 0 being x, with split/merge.
+//
+
+template<typename Treal>
+void FlowToPlanar(const Mat & flow, TH::Tensor<Treal> & out) {
+  THassert(flow.type() == CV_32FC2);
+  out.resize(2, flow.rows, flow.cols);
+  THassert(out.isContiguous());
+  Mat planes[2];
+  for (int k = 0; k < 2; ++k)
+    planes[k] = Mat(flow.rows, flow.cols, DataType<Treal>::type,
+		    (void*)(out.data() + k*out.stride(0)));
+  if (DataType<Treal>::type == CV_32F) {
+    split(flow, planes);
+  } else {
+    Mat planes32f[2];
+    split(flow, planes32f);
+    for (int k = 0; k < 2; ++k)
+      planes32f[k].convertTo(planes[k], DataType<Treal>::type);
+  }
+}
+
+template<typename Treal>
+void PlanarToFlow(const TH::Tensor<Treal> & in, Mat & flow) {
+  THassert((in.nDimension() == 3) && (in.size(0) == 2));
+  const TH::Tensor<Treal> inc = in.newContiguous();
+  const int h = inc.size(1), w = inc.size(2);
+  Mat planes[2];
+  for (int k = 0; k < 2; ++k) {
+    Mat plane(h, w, DataType<Treal>::type, (void*)(inc.data() + k*inc.stride(0)));
+    if (DataType<Treal>::type == CV_32F)
+      planes[k] = plane;
+    else
+      plane.convertTo(planes[k], CV_32F);
+  }
+  merge(planes, 2, flow);
+}
+
+#endif
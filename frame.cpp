@@ -0,0 +1,50 @@
+#include "frame.hpp"
+
+HandleRegistry<Frame> frames_g("Frame");
+
+Frame::Frame(const matb & gray)
+  :gray_(gray.clone()),
+   pyrMaxLevel(-1), pyrLevels(0), fastThreshold(-1) {
+  THassert(gray.type() == CV_8U);
+  pthread_mutex_init(&mutex, NULL);
+}
+
+Frame::~Frame() {
+  pthread_mutex_destroy(&mutex);
+}
+
+int Frame::lkPyramid(Size winSize, int maxLevel, vector<Mat> & pyr) {
+  pthread_mutex_lock(&mutex);
+  if ((pyrMaxLevel < maxLevel) ||
+      (winSize.width > pyrWinSize.width) || (winSize.height > pyrWinSize.height)) {
+    STATS_SCOPE("Frame.lkPyramid");
+    pyrWinSize = Size(max(winSize.width, pyrWinSize.width),
+		      max(winSize.height, pyrWinSize.height));
+    pyrMaxLevel = max(maxLevel, pyrMaxLevel);
+    // (the previous buffers may be shared with a tracker : new ones)
+    pyr_.clear();
+    pyrLevels = buildOpticalFlowPyramid(gray_, pyr_, pyrWinSize, pyrMaxLevel, true);
+  }
+  pyr = pyr_;
+  const int levels = min(maxLevel, pyrLevels);
+  pthread_mutex_unlock(&mutex);
+  return levels;
+}
+
+void Frame::fastKeypoints(int threshold, vector<KeyPoint> & out) {
+  pthread_mutex_lock(&mutex);
+  if (threshold != fastThreshold) {
+    STATS_SCOPE("Frame.fastKeypoints");
+    keypoints.clear();
+    FAST(gray_, keypoints, threshold, true);
+    fastThreshold = threshold;
+  }
+  out = keypoints;
+  pthread_mutex_unlock(&mutex);
+}
+
+Ptr<Frame> FrameFromLuaStack(lua_State* L, int i) {
+  if (!lua_isnumber(L, i))
+    return Ptr<Frame>();
+  return frames_g.get(lua_tointeger(L, i));
+}
@@ -0,0 +1,49 @@
+#ifndef __FRAME_HPP__
+#define __FRAME_HPP__
+
+#include "common.hpp"
+#include "registry.hpp"
+
+//============================================================
+// Frame
+//
+// An image converted once to gray, with the intermediate results that
+// several bindings would otherwise recompute on the same image : the
+// pyramid of calcOpticalFlowPyrLK (TrackPoints, TrackerLKPush) and the FAST
+// keypoints (ComputeFAST, ComputeFREAK). They are computed on first use and
+// kept until the frame is deleted. The bindings that read an image with
+// GrayFromLuaStack accept a frame handle in place of the tensor. A frame can
+// be used by several threads at once (the caches are locked).
+//
+
+class Frame {
+public:
+  // gray : 8-bit gray image (copied : it is usually a view or scratch memory)
+  Frame(const matb & gray);
+  ~Frame();
+  inline const matb & gray() const {return gray_;};
+  // Pyramid with derivatives, as built by buildOpticalFlowPyramid. It is
+  // only rebuilt if more levels or a larger window are asked for. Returns
+  // the number of levels usable as maxLevel.
+  int lkPyramid(Size winSize, int maxLevel, vector<Mat> & pyr);
+  // FAST keypoints with non-maximum suppression (last threshold cached)
+  void fastKeypoints(int threshold, vector<KeyPoint> & out);
+private:
+  Frame(const Frame &);
+  Frame & operator=(const Frame &);
+  pthread_mutex_t mutex;
+  matb gray_;
+  vector<Mat> pyr_;
+  Size pyrWinSize;
+  int pyrMaxLevel, pyrLevels;
+  vector<KeyPoint> keypoints;
+  int fastThreshold;
+};
+
+extern HandleRegistry<Frame> frames_g;
+
+// Returns the frame whose handle is at index i of the lua stack, or an empty
+// pointer if it is not a number (ie. an image tensor)
+Ptr<Frame> FrameFromLuaStack(lua_State* L, int i);
+
+#endif
@@ -0,0 +1,227 @@
+#include "freaktrain.hpp"
+
+#include<cfloat>
+#include<cstring>
+#include<algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && (__GNUC__ >= 5)
+#define FREAKTRAIN_POPCNT_KERNEL
+#endif
+
+//============================================================
+// Co-occurrence kernels
+//
+// bits[k] holds test k of 64 keypoints (one per bit) ; adds the number of
+// keypoints where both tests i and j are set to cooc[i][j], j > i.
+//
+
+typedef void (*CoocKernel)(const unsigned long long* bits, long long* cooc);
+
+static void CoocScalar(const unsigned long long* bits, long long* cooc) {
+  for (int i = 0; i < FREAK_ALL_PAIRS; ++i) {
+    const unsigned long long bi = bits[i];
+    if (bi == 0)
+      continue;
+    long long* row = cooc + i*FREAK_ALL_PAIRS;
+    for (int j = i+1; j < FREAK_ALL_PAIRS; ++j)
+      row[j] += __builtin_popcountll(bi & bits[j]);
+  }
+}
+
+#ifdef FREAKTRAIN_POPCNT_KERNEL
+__attribute__((target("popcnt")))
+static void CoocPopcnt(const unsigned long long* bits, long long* cooc) {
+  for (int i = 0; i < FREAK_ALL_PAIRS; ++i) {
+    const unsigned long long bi = bits[i];
+    if (bi == 0)
+      continue;
+    long long* row = cooc + i*FREAK_ALL_PAIRS;
+    for (int j = i+1; j < FREAK_ALL_PAIRS; ++j)
+      row[j] += __builtin_popcountll(bi & bits[j]);
+  }
+}
+#endif
+
+static CoocKernel GetCoocKernel() {
+#ifdef FREAKTRAIN_POPCNT_KERNEL
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("popcnt"))
+    return CoocPopcnt;
+#endif
+  return CoocScalar;
+}
+
+static const CoocKernel coocKernel_g = GetCoocKernel();
+
+//============================================================
+// FREAKPairStats
+//
+
+FREAKPairStats::FREAKPairStats()
+  :n(0), counts(FREAK_ALL_PAIRS, 0), cooc(FREAK_ALL_PAIRS*FREAK_ALL_PAIRS, 0) {
+}
+
+void FREAKPairStats::addBlock(const unsigned long long* bits) {
+  for (int i = 0; i < FREAK_ALL_PAIRS; ++i)
+    counts[i] += __builtin_popcountll(bits[i]);
+  coocKernel_g(bits, &(cooc[0]));
+}
+
+// FREAK writes the tests in a bitset<1024> : test k is bit k%8 of byte k/8
+// (little-endian)
+void FREAKPairStats::add(const Mat & descs) {
+  THassert((descs.type() == CV_8U) && (descs.cols == FREAK_ALL_PAIRS_BYTES));
+  unsigned long long bits[FREAK_ALL_PAIRS];
+  for (int i0 = 0; i0 < descs.rows; i0 += 64) {
+    const int i1 = min(descs.rows, i0 + 64);
+    memset(bits, 0, sizeof(bits));
+    for (int i = i0; i < i1; ++i) {
+      const unsigned char* row = descs.ptr<unsigned char>(i);
+      const unsigned long long bit = 1ULL << (i - i0);
+      for (int k = 0; k < FREAK_ALL_PAIRS; ++k)
+	if (row[k >> 3] & (1 << (k & 7)))
+	  bits[k] |= bit;
+    }
+    addBlock(bits);
+  }
+  n += descs.rows;
+}
+
+void FREAKPairStats::merge(const FREAKPairStats & other) {
+  n += other.n;
+  for (int i = 0; i < FREAK_ALL_PAIRS; ++i)
+    counts[i] += other.counts[i];
+  for (size_t i = 0; i < cooc.size(); ++i)
+    cooc[i] += other.cooc[i];
+}
+
+namespace {
+  struct PairStat {
+    double mean;
+    int idx;
+  };
+  struct SortMean {
+    bool operator()(const PairStat & a, const PairStat & b) const {
+      return a.mean < b.mean;
+    }
+  };
+}
+
+// Same as FREAK::selectPairs, with the correlation of compareHist
+// (CV_COMP_CORREL) computed from the counts
+vector<int> FREAKPairStats::selectPairs(double corrThres) const {
+  if (n == 0)
+    return vector<int>();
+  const double scale = 1. / (double)n;
+  vector<PairStat> pairStat;
+  for (int k = FREAK_ALL_PAIRS; k--; ) {
+    PairStat tmp = {fabs((double)counts[k] / (double)n - 0.5), k};
+    pairStat.push_back(tmp);
+  }
+  std::sort(pairStat.begin(), pairStat.end(), SortMean());
+
+  vector<int> bestPairs;
+  for (int m = 0; m < FREAK_ALL_PAIRS; ++m) {
+    const int idxB = pairStat[m].idx;
+    const double sB = (double)counts[idxB];
+    const double varB = sB - sB*sB*scale;
+    double corrMax = 0;
+    for (size_t k = 0; k < bestPairs.size(); ++k) {
+      const int idxA = bestPairs[k];
+      const double sA = (double)counts[idxA];
+      const double sAB = (double)cooc[min(idxA, idxB)*FREAK_ALL_PAIRS + max(idxA, idxB)];
+      const double num = sAB - sA*sB*scale;
+      const double denom2 = (sA - sA*sA*scale) * varB;
+      const double corr = fabs((fabs(denom2) > DBL_EPSILON) ? num / sqrt(denom2) : 1.);
+      if (corr > corrMax) {
+	corrMax = corr;
+	if (corrMax >= corrThres)
+	  break;
+      }
+    }
+    if (corrMax < corrThres)
+      bestPairs.push_back(idxB);
+    if (bestPairs.size() >= (size_t)FREAK::NB_PAIRS)
+      break;
+  }
+  if (bestPairs.size() < (size_t)FREAK::NB_PAIRS)
+    bestPairs.clear();
+  return bestPairs;
+}
+
+//============================================================
+// FREAKAllPairs
+//
+
+FREAKAllPairs::FREAKAllPairs(const FREAK & freak)
+  :FREAK(freak) {
+  extAll = true;
+  buildPattern();
+}
+
+// (buildPattern is protected)
+class FREAKPatternBuilder : public FREAK {
+public:
+  static void build(FREAK & freak) {
+    void (FREAK::*buildPatternPtr)() = &FREAKPatternBuilder::buildPattern;
+    (freak.*buildPatternPtr)();
+  }
+};
+
+void BuildFREAKPattern(FREAK & freak) {
+  FREAKPatternBuilder::build(freak);
+}
+
+//============================================================
+// FREAKTrainer
+//
+
+FREAKTrainer::FREAKTrainer(const FREAK & freak, float keypointsThreshold, int maxKeypoints)
+  :freak(freak), keypointsThreshold(keypointsThreshold), maxKeypoints(maxKeypoints) {
+  pthread_mutex_init(&mutex, NULL);
+}
+
+FREAKTrainer::~FREAKTrainer() {
+  pthread_mutex_destroy(&mutex);
+}
+
+void FREAKTrainer::addImage(const matb & gray, FREAKPairStats & stats) const {
+  ScratchVector<KeyPoint> scratchKeypoints;
+  vector<KeyPoint> & keypoints = *scratchKeypoints;
+  {
+    STATS_SCOPE("FREAKTrainer.detect");
+    FAST(gray, keypoints, keypointsThreshold, true);
+    if ((maxKeypoints > 0) && ((int)keypoints.size() > maxKeypoints))
+      KeyPointsFilter::retainBest(keypoints, maxKeypoints);
+  }
+  Mat descs;
+  {
+    STATS_SCOPE("FREAKTrainer.describe");
+    freak.compute(gray, keypoints, descs);
+  }
+  if (descs.rows > 0) {
+    STATS_SCOPE("FREAKTrainer.accumulate");
+    stats.add(descs);
+  }
+}
+
+void FREAKTrainer::merge(const FREAKPairStats & stats) {
+  pthread_mutex_lock(&mutex);
+  this->stats.merge(stats);
+  pthread_mutex_unlock(&mutex);
+}
+
+long long FREAKTrainer::nKeypoints() {
+  pthread_mutex_lock(&mutex);
+  const long long ret = stats.nKeypoints();
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+vector<int> FREAKTrainer::selectPairs(double corrThres) {
+  STATS_SCOPE("FREAKTrainer.select");
+  pthread_mutex_lock(&mutex);
+  vector<int> ret = stats.selectPairs(corrThres);
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
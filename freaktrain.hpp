@@ -0,0 +1,80 @@
+#ifndef __FREAKTRAIN_HPP__
+#define __FREAKTRAIN_HPP__
+
+#include "common.hpp"
+#include "opencv2/features2d/features2d.hpp"
+
+//============================================================
+// FREAK pair selection
+//
+// FREAK::selectPairs computes the 903 tests of the pattern on every keypoint
+// of every image (kept in memory, with the images), into a keypoints x 903
+// float matrix, then keeps greedily the tests whose mean is closest to 0.5
+// and whose correlation to the tests already kept is below a threshold. The
+// correlation of two binary tests only depends on their counts and on the
+// count of keypoints where both are set : FREAKPairStats accumulates these
+// counts, 64 keypoints at a time, so that the memory does not depend on the
+// number of images, which can be streamed in by batches, and the counts of
+// several threads can be summed. The pairs selected are the same as the
+// ones of FREAK::selectPairs on the same keypoints.
+//
+
+#define FREAK_ALL_PAIRS 903  // 43 points
+#define FREAK_ALL_PAIRS_BYTES 128
+
+class FREAKPairStats {
+public:
+  FREAKPairStats();
+  // descs : CV_8U, FREAK_ALL_PAIRS_BYTES bytes per row (cf. FREAKAllPairs)
+  void add(const Mat & descs);
+  void merge(const FREAKPairStats & other);
+  inline long long nKeypoints() const {return n;};
+  // Same selection as FREAK::selectPairs. Empty if there is no keypoint or
+  // if less than FREAK::NB_PAIRS tests pass corrThres (threshold too
+  // restrictive).
+  vector<int> selectPairs(double corrThres) const;
+private:
+  void addBlock(const unsigned long long* bits);
+  long long n;
+  vector<long long> counts;  // tests set
+  vector<long long> cooc;    // both tests set, FREAK_ALL_PAIRS^2 (upper triangle)
+};
+
+// FREAK extracting all the tests (instead of the selected pairs), as used
+// by selectPairs
+class FREAKAllPairs : public FREAK {
+public:
+  // Same pattern as freak, which is only read. The pattern is built here,
+  // so that compute can then be called by several threads at once.
+  explicit FREAKAllPairs(const FREAK & freak);
+};
+
+// FREAK builds its pattern lazily, in the first compute : this builds it
+// beforehand, so that the FREAK can be shared by several threads (cf.
+// ComputeFREAKBatch). Does nothing if the pattern is built.
+void BuildFREAKPattern(FREAK & freak);
+
+// Streaming pair selection : the images are detected (FAST), subsampled to
+// the maxKeypoints strongest keypoints (0 : all), described, and only the
+// statistics are kept.
+class FREAKTrainer {
+public:
+  FREAKTrainer(const FREAK & freak, float keypointsThreshold, int maxKeypoints);
+  ~FREAKTrainer();
+  // (any thread) adds the keypoints of gray to stats
+  void addImage(const matb & gray, FREAKPairStats & stats) const;
+  // (any thread) adds stats to the statistics of the trainer
+  void merge(const FREAKPairStats & stats);
+  long long nKeypoints();
+  vector<int> selectPairs(double corrThres);
+private:
+  FREAKTrainer(const FREAKTrainer &);
+  FREAKTrainer & operator=(const FREAKTrainer &);
+  FREAKAllPairs freak;
+  float keypointsThreshold;
+  int maxKeypoints;
+  FREAKPairStats stats;
+  pthread_mutex_t mutex;
+};
+
+#endif
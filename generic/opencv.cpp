@@ -17,6 +17,7 @@
 #include<opencv/cv.h>
 #include "opencv2/nonfree/features2d.hpp"
 #include "common.hpp"
+#include "harris.hpp"
 
 using namespace TH;
 
@@ -25,50 +26,49 @@ using namespace TH;
 //
 
 static int libopencv24_(TH2CVImage)(lua_State* L) {
+  STATS_SCOPE("TH2CVImage");
   setLuaState(L);
   Tensor<real > im   = FromLuaStack<Tensor<real > >(1);
   Tensor<ubyte> imcv = FromLuaStack<Tensor<ubyte> >(2);
 
-  im.newContiguous();
+  im = im.newContiguous();
 
   if (im.nDimension() == 2) {
     long h = im.size(0), w = im.size(1);
     imcv.resize(h, w);
+    STATS_ALLOC("TH2CVImage", h*w);
     Mat im_cv = TensorToMat(imcv);
     TensorToMat(im).convertTo(im_cv, CV_8U, 255., 0.);
   } else {
     long h = im.size(1), w = im.size(2);
     imcv.resize(h, w, 3);
-    
-    long i, j, k;
-    for (i = 0; i < h; ++i)
-      for (j = 0; j < w; ++j)
-	for (k = 0; k < 3; ++k)
-	  imcv(i,j,k) = (ubyte)(im(2-k,i,j)*(real)255. + (real)(0.5));
+    STATS_ALLOC("TH2CVImage", h*w*3);
+    mat3b im_cv(h, w, (Vec3b*)imcv.data());
+    PlanarToBGR(im, im_cv, 255.);
   }
 
   return 0;
 }
 
 static int libopencv24_(CV2THImage)(lua_State* L) {
+  STATS_SCOPE("CV2THImage");
   setLuaState(L);
   Tensor<ubyte> imcv = FromLuaStack<Tensor<ubyte> >(1);
   Tensor<real > im   = FromLuaStack<Tensor<real > >(2);
 
-  imcv.newContiguous();
+  imcv = imcv.newContiguous();
 
   long h = imcv.size(0), w = imcv.size(1);
   if (imcv.nDimension() == 2) {
     im.resize(h, w);
+    STATS_ALLOC("CV2THImage", h*w*sizeof(real));
     Mat im_cv = TensorToMat(im);
     TensorToMat(imcv).convertTo(im_cv, DataType<real>::type, 1./255.);
   } else {    
     im.resize(3, h, w);
-    long i, j, k;
-    for (i = 0; i < h; ++i)
-      for (j = 0; j < w; ++j)
-	for (k = 0; k < 3; ++k)
-	  im(k,i,j) = ((real)imcv(i,j,2-k))/(real)255.;
+    STATS_ALLOC("CV2THImage", 3*h*w*sizeof(real));
+    mat3b imcv_cv(h, w, (Vec3b*)imcv.data());
+    BGRToPlanar(imcv_cv, im, 1./255.);
   }
 
   return 0;
@@ -79,9 +79,9 @@ static int libopencv24_(CV2THImage)(lua_State* L) {
 //
 
 static int libopencv24_(DenseOpticalFlowFarnebach)(lua_State *L) {
+  STATS_SCOPE("DenseOpticalFlowFarnebach");
   setLuaState(L);
-  Tensor<ubyte> im1  = FromLuaStack<Tensor<ubyte> >(1);
-  Tensor<ubyte> im2  = FromLuaStack<Tensor<ubyte> >(2);
+  SCRATCH_SCOPE();
   Tensor<real>  flow = FromLuaStack<Tensor<real > >(3);
   double pyr_scale   = FromLuaStack<double>(4);
   int    levels      = FromLuaStack<int   >(5);
@@ -91,30 +91,84 @@ static int libopencv24_(DenseOpticalFlowFarnebach)(lua_State *L) {
   double poly_sigma  = FromLuaStack<double>(9);
   int    use_previous= FromLuaStack<bool  >(10);
   
-  matb im1_cv_gray = TensorToMat(im1);
-  matb im2_cv_gray = TensorToMat(im2);
+  matb im1_cv_gray = GrayFromLuaStack(L, 1);
+  matb im2_cv_gray = GrayFromLuaStack(L, 2);
+
+  // a float HxWx2 flow is computed in place : it must be contiguous and, if
+  // it is the initial flow, of the size of the images (otherwise
+  // calcOpticalFlowFarneback would write into a new buffer)
+  if ((DataType<real>::type == CV_32F) && (flow.nDimension() == 3) && (flow.size(2) == 2)) {
+    if (!use_previous)
+      flow.resize(im1_cv_gray.rows, im1_cv_gray.cols, 2);
+    THassert((flow.size(0) == im1_cv_gray.rows) && (flow.size(1) == im1_cv_gray.cols) &&
+	     THTensor_(isContiguous)(flow));
+    Mat flow_cv = TensorToMat(flow);
+    calcOpticalFlowFarneback(im1_cv_gray, im2_cv_gray, flow_cv, pyr_scale, levels,
+			     winsize, iterations, poly_n, poly_sigma,
+			     use_previous*OPTFLOW_USE_INITIAL_FLOW);
+    return 0;
+  }
 
-  int h = im1_cv_gray.size().height, w = im1_cv_gray.size().width;
-  Mat flow_cv(h, w, CV_32FC2);
+  STATS_START(convert, "DenseOpticalFlowFarnebach.convert");
+  Mat flow_cv;
   if (use_previous)
-    for (int i = 1; i < h; ++i)
-      for (int j = 1; j < w; ++j)
-	flow_cv.at<Vec2f>(i,j) = Vec2f(flow(0,i,j), flow(1,i,j));
+    PlanarToFlow(flow, flow_cv);
+  else
+    flow_cv.create(im1_cv_gray.size(), CV_32FC2);
+  STATS_ALLOC("DenseOpticalFlowFarnebach.convert", flow_cv.total()*flow_cv.elemSize());
+  STATS_STOP(convert);
 
+  STATS_START(kernel, "DenseOpticalFlowFarnebach.kernel");
   calcOpticalFlowFarneback(im1_cv_gray, im2_cv_gray, flow_cv, pyr_scale, levels,
 			   winsize, iterations, poly_n, poly_sigma,
 			   use_previous*OPTFLOW_USE_INITIAL_FLOW);
-  
-  for (int i = 0; i < h; ++i)
-    for (int j = 0; j < w; ++j) {
-      Vec2f & v = flow_cv.at<Vec2f>(i, j);
-      flow(0, i, j) = v[0];
-      flow(1, i, j) = v[1];
-    }
+  STATS_STOP(kernel);
+
+  STATS_SCOPE("DenseOpticalFlowFarnebach.output");
+  FlowToPlanar(flow_cv, flow);
   
   return 0;
 }
 
+// Pushes a frame into a FarnebackFlow (cf. CreateFarnebackFlow). flow is
+// either 2xHxW (planar, x first) or, for float tensors, HxWx2 (interleaved,
+// written without copy). Returns false on the first frame (no flow).
+static int libopencv24_(FarnebackFlowPush)(lua_State *L) {
+  STATS_SCOPE("FarnebackFlowPush");
+  setLuaState(L);
+  SCRATCH_SCOPE();
+  int           iFlow = FromLuaStack<int>(1);
+  Tensor<real>  flow  = FromLuaStack<Tensor<real > >(3);
+
+  CheckImageFromLuaStack(L, 2);
+  Ptr<FarnebackFlow> ffPtr = farnebackFlows_g.get(iFlow);
+  FarnebackFlow & ff = *ffPtr;
+  STATS_START(convert, "FarnebackFlowPush.convert");
+  matb im_cv_gray = GrayFromLuaStack(L, 2);
+  STATS_STOP(convert);
+
+  bool computed;
+  if ((DataType<real>::type == CV_32F) && (flow.nDimension() == 3) && (flow.size(2) == 2)) {
+    flow.resize(im_cv_gray.rows, im_cv_gray.cols, 2);
+    if (!THTensor_(isContiguous)(flow)) {
+      ffPtr.release();
+      im_cv_gray.release(); // (THerror does not return)
+      THerror("FarnebackFlowPush: a HxWx2 flow must be contiguous");
+    }
+    STATS_SCOPE("FarnebackFlowPush.kernel");
+    computed = ff.push(im_cv_gray, TensorToMat(flow));
+  } else {
+    STATS_START(kernel, "FarnebackFlowPush.kernel");
+    computed = ff.push(im_cv_gray);
+    STATS_STOP(kernel);
+    STATS_SCOPE("FarnebackFlowPush.output");
+    if (computed)
+      FlowToPlanar(ff.flow(), flow);
+  }
+  lua_pushboolean(L, computed);
+  return 1;
+}
+
 //============================================================
 // Detect Extract
 // 
@@ -122,191 +176,217 @@ static int libopencv24_(DenseOpticalFlowFarnebach)(lua_State *L) {
 // extract a sparse set of features at those detected locations.
 //
 
-static int libopencv24_(DetectExtract)(lua_State *L) {
-  setLuaState(L);
-  Tensor<ubyte> img          = FromLuaStack<Tensor<ubyte> >(1);
-  Tensor<real>  msk          = FromLuaStack<Tensor<real>  >(2);
-  Tensor<real>  positions    = FromLuaStack<Tensor<real>  >(3); 
-  Tensor<real>  feat         = FromLuaStack<Tensor<real>  >(4);
-  const char *  dtype        = lua_tostring(L,5);
-  const char *  etype        = lua_tostring(L,6);
-  size_t        maxPoints    = FromLuaStack<size_t>        (7);
-
-  string detectorType(dtype);
-  string extractorType(etype);
-  
-  Mat feat_cv;
-
-  vector<KeyPoint>         keyPoints;
-  Ptr<FeatureDetector>     detector;
-  Ptr<DescriptorExtractor> extractor;
-  //KeyPointsFilter          kpFilt;
-
-  size_t i,j,foundPts,maskedKeyPoints;
-
-  msk = msk.newContiguous();
+// Detects and extracts on one gray image, into keyPoints and feat_cv. Does
+// not use the lua state nor the TH allocator (it runs in the worker threads
+// of the batch version). A mask of another size than the image is ignored.
+static void libopencv24_(DetectExtractImage)(const matb & img_cv_gray,
+					    const KeypointSelection & selection,
+					    const FeatureDetector & detector,
+					    const DescriptorExtractor & extractor,
+					    vector<KeyPoint> & keyPoints, Mat & feat_cv,
+					    bool verbose) {
+  KeypointSelection sel = selection;
+  if (sel.mask.size() != img_cv_gray.size())
+    sel.mask = matb();
   
-  matb img_cv_gray;
-  if (img.nDimension() == 3) { //color images
-    cvtColor(TensorToMat3b(img), img_cv_gray, CV_BGR2GRAY);
-  } else {
-    img_cv_gray = TensorToMat(img);
+  // detecting keypoints (only around the mask, cf. keypoints.hpp)
+  STATS_START(detect, "DetectExtract.detect");
+  DetectMasked(detector, img_cv_gray, sel.mask, keyPoints);
+  STATS_STOP(detect);
+
+  // the keypoints in the mask, sorted by response, top maxPoints
+  SelectKeypoints(keyPoints, sel, img_cv_gray.size());
+
+  if (keyPoints.empty()) {
+    if (verbose)
+      cout << "No KeyPoints Found" << endl;
+    return;
   }
+  if (verbose)
+    cout << "Found " << keyPoints.size() << " keypoints" << endl;
   
-  // detecting keypoints
-  // "FAST", "STAR", "SIFT", "SURF", "ORB",
-  // "MSER", "GFTT", "HARRIS", "Dense", "SimpleBlob",
-  // Also combined format: 
-  // "Grid" – GridAdaptedFeatureDetector,
-  // "Pyramid" – PyramidAdaptedFeatureDetector )
-  // for example: "GridFAST", "PyramidSTAR" .
-
-  detector = FeatureDetector::create(detectorType);
-  // FIXME should be able to pass a msk_cv here but not working.
-  detector->detect(img_cv_gray,keyPoints);
-    
-  if (keyPoints.size() < 1){
-    cout << "No KeyPoints Found" << endl;
-    feat.resize(0);
+  // computing descriptors
+  STATS_SCOPE("DetectExtract.extract");
+  extractor.compute(img_cv_gray, keyPoints, feat_cv);
+}
+
+// Writes the output of DetectExtractImage (in the lua thread), returns the
+// number of keypoints
+static size_t libopencv24_(DetectExtractOutput)(const vector<KeyPoint> & keyPoints,
+					       const Mat & feat_cv,
+					       Tensor<real> positions,
+					       DescriptorTensor feat) {
+  STATS_SCOPE("DetectExtract.output");
+  if (keyPoints.empty()) {
+    feat.clear();
     positions.resize(0);
     return 0;
   }
+  feat.set(feat_cv);
+  positions.resize(keyPoints.size(), 2);
   
-  
-  // Sort the keypoints, return only the top maxPoints
-  // Again this function does not work.
-  // kpFilt.retainBest(keyPoints, maxPoints);
-  //
-
-  maskedKeyPoints = 0;
-  
-  // Mask isn't currently working in opencv... perhaps there is an
-  // issue with the type or sizes we use. For now: 
-  // knock out keypoints which aren't in the mask by setting value to zero
-  
-  if ((msk.nDimension() == 2) &&
-      (msk.size(0) == img.size(0)) &&
-      (msk.size(1) == img.size(1))){
-    for(i=0;i<keyPoints.size();i++){
-      KeyPoint & kpt = keyPoints[i];
-      int mval = (int)msk(kpt.pt.y,kpt.pt.x);
-      if (mval == 0){
-        kpt.response = 0;
-        maskedKeyPoints++; // keep track of number of points not to return
-      }
-    }
+  for (size_t i = 0; i < keyPoints.size(); ++i) {
+    const KeyPoint & kpt = keyPoints[i];
+    positions(i, 0) = kpt.pt.x;
+    positions(i, 1) = kpt.pt.y;
   }
   
-  if (maxPoints > 0){
-    foundPts = min(keyPoints.size()-maskedKeyPoints, maxPoints);
-  } else {
-    foundPts = keyPoints.size()-maskedKeyPoints;
-  }
+  return keyPoints.size();
+}
 
-  if (foundPts <= 0) {
-    cout << "No KeyPoints Found" << endl;
-    feat.resize(0);
-    positions.resize(0);
-    return 0;
+// The detector (5) and the extractor (6) are either handles (cf.
+// CreateFeatureDetector and CreateDescriptorExtractor) or type names.
+// feat (4) is a ByteTensor (binary descriptors only) or a Float/DoubleTensor.
+// The keypoints are spread over a gridRows (8) x gridCols (9) grid.
+static int libopencv24_(DetectExtract)(lua_State *L) {
+  STATS_SCOPE("DetectExtract");
+  setLuaState(L);
+  SCRATCH_SCOPE();
+  Tensor<real>  msk          = FromLuaStack<Tensor<real>  >(2);
+  Tensor<real>  positions    = FromLuaStack<Tensor<real>  >(3); 
+  DescriptorTensor feat(L, 4);
+  size_t        maxPoints    = FromLuaStack<size_t>        (7);
+  CheckImageFromLuaStack(L, 1);
+
+  KeypointSelection sel;
+  sel.mask = MaskFromTensor(msk);
+  sel.maxPoints = maxPoints;
+  sel.gridRows = max(1, (int)lua_tointeger(L, 8));
+  sel.gridCols = max(1, (int)lua_tointeger(L, 9));
+
+  // (the arguments are checked : the detector is the last lookup that can
+  // raise an error, cf. registry.hpp)
+  Ptr<DescriptorExtractor> extractor = ExtractorFromLuaStack(L, 6);
+  Ptr<FeatureDetector>     detector  = TryDetectorFromLuaStack(L, 5);
+  if (detector.empty()) {
+    extractor.release();
+    DetectorFromLuaStack(L, 5); // (raises the error)
   }
-  
-  
-  // Sort the keypoints by value (See keyPointsCompare function in
-  // element/code/opencv.c) the keypoints which fall outside the mask
-  // have been given a low value.
-
-  sort(keyPoints.begin(), keyPoints.end(), keyPointCompare());
+  if (!feat.accepts(extractor->descriptorType())) {
+    detector.release();
+    extractor.release(); // (THerror does not return)
+    THerror("DetectExtract: float descriptors cannot be stored in a ByteTensor");
+  }
+  STATS_START(convert, "DetectExtract.convert");
+  matb img_cv_gray = GrayFromLuaStack(L, 1);
+  STATS_STOP(convert);
 
-  keyPoints.resize(foundPts);
-  cout << "Found " << keyPoints.size() << " keypoints" << endl;
-  
-  // computing descriptors
+  ScratchVector<KeyPoint> scratchKeyPoints;
+  vector<KeyPoint> & keyPoints = *scratchKeyPoints;
+  Mat feat_cv;
+  libopencv24_(DetectExtractImage)(img_cv_gray, sel, *detector, *extractor,
+				   keyPoints, feat_cv, true);
+  libopencv24_(DetectExtractOutput)(keyPoints, feat_cv, positions, feat);
+  return 0;
+}
 
-  /*
-    The create() function does not seem to work.  The features aren't
-    computed properly so I have replaced it with the messier if else
-    cases below.
-    
-    extractor = DescriptorExtractor::create(extractorType);
-  */
-  if (extractorType.compare("SURF") == 0) {
-    extractor = new SurfDescriptorExtractor; 
-  } else if (extractorType.compare("SIFT") == 0) { 
-    extractor = new SiftDescriptorExtractor;
-  } else if (extractorType.compare("BRIEF") == 0) { 
-    extractor = new BriefDescriptorExtractor;
-  } else if (extractorType.compare("ORB") == 0) { 
-    extractor = new OrbDescriptorExtractor;
-  } else {
-    printf("Warning unrecognized DescriptorExtractor (%s) using SURF\n",
-           etype);
-    extractor = new SurfDescriptorExtractor;
+class libopencv24_(DetectExtractTask) : public BatchTask {
+public:
+  libopencv24_(DetectExtractTask)(const Tensor<ubyte> & img, const KeypointSelection & sel,
+				  const Tensor<real> & positions, const DescriptorTensor & feat,
+				  const FeatureDetector & detector,
+				  const DescriptorExtractor & extractor)
+    :img(img), sel(sel), positions(positions), feat(feat), detector(detector),
+     extractor(extractor) {};
+  virtual void run() {
+    STATS_START(convert, "DetectExtract.convert");
+    matb img_cv_gray = TensorToMatGray(img);
+    STATS_STOP(convert);
+    libopencv24_(DetectExtractImage)(img_cv_gray, sel, detector, extractor,
+				     keyPoints, feat_cv, false);
   }
-  /*
-    } else if (extractorType.compare("OpponentSIFT") == 0) { 
-    extractor = new OpponentSiftDescriptorExtractor;
-    } else if (extractorType.compare("BOW") == 0) { 
-    extractor = new BOWImgDescriptorExtractor;
-    } else if (extractorType.compare("FREAK") == 0) { 
-    extractor = new FreakDescriptorExtractor;
-  */
-  extractor->compute(img_cv_gray, keyPoints, feat_cv);
-  
-  feat.resize(feat_cv.rows,feat_cv.cols);
-  positions.resize(foundPts, 2);
-  
-  for (i = 0; i < foundPts; ++i) {
-    const KeyPoint & kpt = keyPoints[i];
-    positions(i, 0) = kpt.pt.x;
-    positions(i, 1) = kpt.pt.y;
+  virtual void output() {
+    libopencv24_(DetectExtractOutput)(keyPoints, feat_cv, positions, feat);
   }
-  
-  for(i = 0; i < (size_t)feat_cv.rows; i++){ 
-    for(j = 0; j < (size_t)feat_cv.cols; j++){
-      feat(i,j) = feat_cv.at<float>(i,j);
-    }
+private:
+  Tensor<ubyte> img;
+  const KeypointSelection & sel;
+  Tensor<real> positions;
+  DescriptorTensor feat;
+  const FeatureDetector & detector;
+  const DescriptorExtractor & extractor;
+  vector<KeyPoint> keyPoints;
+  Mat feat_cv;
+};
+
+// Batch version of DetectExtract : images, positions and feats are tables,
+// the mask, the detector and the extractor are shared by all images. The
+// images are processed by the worker pool (cf. SetNumThreads).
+static int libopencv24_(DetectExtractBatch)(lua_State *L) {
+  STATS_SCOPE("DetectExtractBatch");
+  setLuaState(L);
+  SCRATCH_SCOPE();
+  vector<Tensor<ubyte> > imgs      = FromLuaStack<vector<Tensor<ubyte> > >(1);
+  Tensor<real>           msk       = FromLuaStack<Tensor<real> >(2);
+  vector<Tensor<real> >  positions = FromLuaStack<vector<Tensor<real> > >(3);
+  vector<DescriptorTensor> feats   = DescriptorTensorsFromLuaStack(L, 4);
+  size_t                 maxPoints = FromLuaStack<size_t>(7);
+
+  THassert((positions.size() == imgs.size()) && (feats.size() == imgs.size()));
+  KeypointSelection sel;
+  sel.mask = MaskFromTensor(msk);
+  sel.maxPoints = maxPoints;
+  sel.gridRows = max(1, (int)lua_tointeger(L, 8));
+  sel.gridCols = max(1, (int)lua_tointeger(L, 9));
+  for (size_t i = 0; i < imgs.size(); ++i)
+    CheckImageTensor(imgs[i]);
+
+  Ptr<DescriptorExtractor> extractor = ExtractorFromLuaStack(L, 6);
+  Ptr<FeatureDetector>     detector  = TryDetectorFromLuaStack(L, 5);
+  if (detector.empty()) {
+    extractor.release();
+    DetectorFromLuaStack(L, 5); // (raises the error)
   }
-  
+  string error;
+  for (size_t i = 0; i < feats.size(); ++i)
+    if (!feats[i].accepts(extractor->descriptorType()))
+      error = "DetectExtractBatch: float descriptors cannot be stored in a ByteTensor";
+  if (error.empty()) {
+    vector<BatchTask*> tasks;
+    for (size_t i = 0; i < imgs.size(); ++i)
+      tasks.push_back(new libopencv24_(DetectExtractTask)(imgs[i], sel, positions[i], feats[i],
+							  *detector, *extractor));
+    error = RunBatchTasks(tasks);
+  }
+  detector.release();
+  extractor.release();
+  if (!error.empty())
+    THerror(error);
   return 0;
 }
 
+// The response is written directly into dst (resized to the image size)
+// by the tiled engine of harris.hpp
 static int libopencv24_(CornerHarris)(lua_State *L) {
+  STATS_SCOPE("CornerHarris");
   setLuaState(L);
-  Tensor<ubyte> src  = FromLuaStack<Tensor<ubyte> >(1);
+  SCRATCH_SCOPE();
   Tensor<real>  dst  = FromLuaStack<Tensor<real > >(2);
   int     blocksize  = FromLuaStack<int   >(3);
   int         ksize  = FromLuaStack<int   >(4);
   double          k  = FromLuaStack<double>(5);
-  int    borderType  = BORDER_REPLICATE;
   
-  matb src_cv_gray;
-  if (src.nDimension() == 3) { //color images
-    cvtColor(TensorToMat3b(src), src_cv_gray, CV_BGR2GRAY);
+  STATS_START(convert, "CornerHarris.convert");
+  matb src_cv_gray = GrayFromLuaStack(L, 1);
+  STATS_STOP(convert);
+
+  const int h = src_cv_gray.rows, w = src_cv_gray.cols;
+  dst.resize(h, w);
+  STATS_SCOPE("CornerHarris.kernel");
+  if (dst.stride(1) == 1) {
+    Mat dst_cv(h, w, DataType<real>::type, (void*)dst.data(), dst.stride(0)*sizeof(real));
+    HarrisResponse(src_cv_gray, dst_cv, blocksize, ksize, k);
   } else {
-    src_cv_gray = TensorToMat(src);
+    Mat_<real> dst_cv(h, w);
+    HarrisResponse(src_cv_gray, dst_cv, blocksize, ksize, k);
+    for (int i = 0; i < h; ++i)
+      for (int j = 0; j < w; ++j)
+	dst(i, j) = dst_cv(i, j);
   }
 
-#ifdef TH_REAL_IS_FLOAT  
-  Mat dst_cv = TensorToMat(dst);
-#else
-  int h = src_cv_gray.size().height, w = src_cv_gray.size().width;
-  Mat dst_cv(h, w, CV_32FC2);
-#endif
-
-  /* cornerHarris(InputArray src,
-     OutputArray dst,
-     int blockSize,
-     int ksize, double k, int borderType=BORDER_DEFAULT ) */
-  cornerHarris(src_cv_gray,dst_cv,blocksize,ksize,k,borderType);
-
-#ifndef TH_REAL_IS_FLOAT
-  for (int i = 0; i < h; ++i)
-    for (int j = 0; j < w; ++j)
-      *(Vec2f*)(&(dst(i, j, 0))) = dst_cv.at<Vec2f>(i, j);
-#endif
-
   return 0;
 }
+
 //============================================================
 // Register functions in LUA
 //
@@ -315,7 +395,9 @@ static const luaL_reg libopencv24_(Main__) [] = {
   {"TH2CVImage",       libopencv24_(TH2CVImage)},
   {"CV2THImage",       libopencv24_(CV2THImage)},
   {"DenseOpticalFlowFarnebach", libopencv24_(DenseOpticalFlowFarnebach)},
+  {"FarnebackFlowPush", libopencv24_(FarnebackFlowPush)},
   {"DetectExtract",    libopencv24_(DetectExtract)},
+  {"DetectExtractBatch", libopencv24_(DetectExtractBatch)},
   {"CornerHarris",     libopencv24_(CornerHarris)},
   {NULL, NULL}  /* sentinel */
 };
@@ -0,0 +1,424 @@
+#include "geometry.hpp"
+#include<algorithm>
+#include<cfloat>
+#include<cstring>
+
+// hypotheses drawn per round
+#define GEOMETRY_ROUND 64
+// SPRT : cost of a hypothesis (sample and model), in point checks
+#define SPRT_MODEL_COST 200.
+// SPRT : probability for a point to be consistent with a bad model, before
+// it is estimated on the rejected models, and its lower bound
+#define SPRT_DELTA0 0.01
+#define SPRT_DELTA_MIN 1e-3
+
+GeometryParams::GeometryParams()
+  :model(GEOMETRY_HOMOGRAPHY), threshold(3.), confidence(0.995), maxIters(2000), seed(0) {
+}
+
+static inline int SampleSize(GeometryModel model) {
+  switch (model) {
+  case GEOMETRY_HOMOGRAPHY: return 4;
+  case GEOMETRY_AFFINE: return 3;
+  default: return 7;
+  }
+}
+
+// maximum number of models fitting a minimal sample
+static inline int ModelsPerSample(GeometryModel model) {
+  return (model == GEOMETRY_FUNDAMENTAL) ? 3 : 1;
+}
+
+//============================================================
+// Models
+//
+// The models are 9 doubles, row-major.
+//
+
+static inline double Cross(const Point2f & a, const Point2f & b, const Point2f & c) {
+  return (double)(b.x-a.x)*(c.y-a.y) - (double)(b.y-a.y)*(c.x-a.x);
+}
+
+// false if three points of the sample are (nearly) collinear in one of the
+// images, or if their triangle is flipped between the images
+static bool GoodSample(const Point2f* s1, const Point2f* s2, int m) {
+  for (int i = 0; i < m; ++i)
+    for (int j = i+1; j < m; ++j)
+      for (int k = j+1; k < m; ++k) {
+	const double c1 = Cross(s1[i], s1[j], s1[k]), c2 = Cross(s2[i], s2[j], s2[k]);
+	if ((fabs(c1) < 1.) || (fabs(c2) < 1.) || ((c1 > 0) != (c2 > 0)))
+	  return false;
+      }
+  return true;
+}
+
+// Models fitting the minimal sample s1 <-> s2 (up to ModelsPerSample, in
+// models). Returns their number, 0 for a degenerate sample.
+static int MinimalModels(GeometryModel model, const Point2f* s1, const Point2f* s2,
+			 double* models) {
+  switch (model) {
+  case GEOMETRY_HOMOGRAPHY: {
+    if (!GoodSample(s1, s2, 4))
+      return 0;
+    const Mat H = getPerspectiveTransform(s1, s2);
+    for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 3; ++j)
+	models[3*i+j] = H.at<double>(i, j);
+    return 1;
+  }
+  case GEOMETRY_AFFINE: {
+    if (!GoodSample(s1, s2, 3))
+      return 0;
+    const Mat A = getAffineTransform(s1, s2);
+    for (int i = 0; i < 2; ++i)
+      for (int j = 0; j < 3; ++j)
+	models[3*i+j] = A.at<double>(i, j);
+    models[6] = models[7] = 0.;
+    models[8] = 1.;
+    return 1;
+  }
+  default: {
+    // (the C interface returns the number of solutions, stacked in 9x3)
+    CvMat p1 = cvMat(1, 7, CV_32FC2, (void*)s1), p2 = cvMat(1, 7, CV_32FC2, (void*)s2);
+    CvMat F = cvMat(9, 3, CV_64F, models);
+    return max(0, cvFindFundamentalMat(&p1, &p2, &F, CV_FM_7POINT, 0., 0., NULL));
+  }
+  }
+}
+
+// Squared reprojection error in image 2, or Sampson distance
+static inline double SquaredError(GeometryModel model, const double* M,
+				  const Point2f & p1, const Point2f & p2) {
+  const double x = p1.x, y = p1.y;
+  if (model == GEOMETRY_FUNDAMENTAL) {
+    const double a2 = M[0]*x + M[1]*y + M[2], b2 = M[3]*x + M[4]*y + M[5];
+    const double c2 = M[6]*x + M[7]*y + M[8];
+    const double a1 = M[0]*p2.x + M[3]*p2.y + M[6], b1 = M[1]*p2.x + M[4]*p2.y + M[7];
+    const double e = p2.x*a2 + p2.y*b2 + c2, d = a2*a2 + b2*b2 + a1*a1 + b1*b1;
+    return (d > 0.) ? e*e/d : DBL_MAX;
+  }
+  const double w = M[6]*x + M[7]*y + M[8];
+  if (fabs(w) < DBL_EPSILON)
+    return DBL_MAX;
+  const double dx = (M[0]*x + M[1]*y + M[2])/w - p2.x;
+  const double dy = (M[3]*x + M[4]*y + M[5])/w - p2.y;
+  return dx*dx + dy*dy;
+}
+
+static long Inliers(GeometryModel model, const double* M, const vector<Point2f> & p1,
+		    const vector<Point2f> & p2, double thr2, vector<ubyte> & mask) {
+  long nInliers = 0;
+  mask.resize(p1.size());
+  for (size_t i = 0; i < p1.size(); ++i) {
+    mask[i] = (SquaredError(model, M, p1[i], p2[i]) < thr2) ? 1 : 0;
+    nInliers += mask[i];
+  }
+  return nInliers;
+}
+
+// Least squares model on the inliers. Returns false if it failed.
+static bool RefineModel(GeometryModel model, const vector<Point2f> & p1,
+			const vector<Point2f> & p2, const vector<ubyte> & mask,
+			double* M) {
+  vector<Point2f> in1, in2;
+  for (size_t i = 0; i < p1.size(); ++i)
+    if (mask[i]) {
+      in1.push_back(p1[i]);
+      in2.push_back(p2[i]);
+    }
+  const int n = in1.size();
+  Mat refined;
+  switch (model) {
+  case GEOMETRY_HOMOGRAPHY:
+    if (n > 4)
+      refined = findHomography(in1, in2, 0);
+    break;
+  case GEOMETRY_AFFINE:
+    if (n > 3) {
+      matd A(2*n, 6, 0.), b(2*n, 1), x;
+      for (int i = 0; i < n; ++i) {
+	A(2*i, 0) = A(2*i+1, 3) = in1[i].x;
+	A(2*i, 1) = A(2*i+1, 4) = in1[i].y;
+	A(2*i, 2) = A(2*i+1, 5) = 1.;
+	b(2*i, 0) = in2[i].x;
+	b(2*i+1, 0) = in2[i].y;
+      }
+      if (solve(A, b, x, DECOMP_SVD)) {
+	matd R(3, 3, 0.);
+	for (int k = 0; k < 6; ++k)
+	  R(k/3, k%3) = x(k, 0);
+	R(2, 2) = 1.;
+	refined = R;
+      }
+    }
+    break;
+  default:
+    if (n >= 8)
+      refined = findFundamentalMat(in1, in2, CV_FM_8POINT);
+    break;
+  }
+  if ((refined.rows != 3) || (refined.cols != 3) || !checkRange(refined))
+    return false;
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      M[3*i+j] = refined.at<double>(i, j);
+  return true;
+}
+
+//============================================================
+// PROSAC sampler (Chum and Matas, 2005)
+//
+// The t-th sample is made of the n-th best correspondence and of m-1 drawn
+// among the n-1 better ones, n growing from m to N with t : n is increased
+// when t reaches the number of samples that a uniform RANSAC with maxIters
+// samples would have drawn among the n best only.
+//
+
+class ProsacSampler {
+public:
+  ProsacSampler(long N, int m, long maxIters, bool uniform)
+    :N(N), m(m), t(0), n(uniform ? N : m), Tn(maxIters), TnPrime(1) {
+    for (int i = 0; i < m; ++i)
+      Tn *= (double)(m-i) / (double)(N-i);
+  };
+  void draw(RNG & rng, int* sample) {
+    ++t;
+    if ((t > TnPrime) && (n < N)) {
+      const double Tn1 = Tn * (double)(n+1) / (double)(n+1-m);
+      TnPrime += (long)ceil(Tn1 - Tn);
+      Tn = Tn1;
+      ++n;
+    }
+    if ((n == N) || (TnPrime < t)) {
+      drawDistinct(rng, sample, m, n);
+    } else {
+      drawDistinct(rng, sample, m-1, n-1);
+      sample[m-1] = n-1;
+    }
+  }
+private:
+  static void drawDistinct(RNG & rng, int* sample, int k, long n) {
+    for (int i = 0; i < k; ++i) {
+      bool drawn;
+      do {
+	sample[i] = rng.uniform(0, (int)n);
+	drawn = false;
+	for (int j = 0; j < i; ++j)
+	  drawn = drawn || (sample[j] == sample[i]);
+      } while (drawn);
+    }
+  }
+  long N;
+  int m;
+  long t, n;
+  double Tn;
+  long TnPrime;
+};
+
+//============================================================
+// SPRT (Matas and Chum, 2005)
+//
+// The likelihood ratio of "bad model" vs "good model" is updated with each
+// checked point : a good model has a fraction epsilon of consistent points
+// (the best inlier ratio so far), a bad one a fraction delta. The hypothesis
+// is rejected when the ratio exceeds A, which minimizes the expected time
+// per hypothesis.
+//
+
+struct SPRTParams {
+  double epsilon, delta, A;
+  // likelihood ratio factors of a consistent and an inconsistent point
+  double consistent, inconsistent;
+  // no test until the first model is found
+  SPRTParams()
+    :epsilon(0.), delta(0.), A(DBL_MAX), consistent(1.), inconsistent(1.) {};
+  void update(double epsilon_, double delta_, int modelsPerSample) {
+    epsilon = min(epsilon_, 0.999);
+    delta = min(max(delta_, SPRT_DELTA_MIN), 0.5*epsilon);
+    if (delta < SPRT_DELTA_MIN) {
+      *this = SPRTParams();
+      return;
+    }
+    const double C = (1.-delta) * log((1.-delta) / (1.-epsilon))
+      + delta * log(delta / epsilon);
+    const double K = SPRT_MODEL_COST * C / modelsPerSample + 1.;
+    A = K;
+    for (int i = 0; i < 10; ++i)
+      A = K + log(A);
+    consistent = delta / epsilon;
+    inconsistent = (1.-delta) / (1.-epsilon);
+  }
+};
+
+// Number of hypotheses after which a good one has been drawn (and not
+// rejected by the SPRT) with the given confidence
+static long RequiredIters(double epsilon, int m, double A, double confidence,
+			  long maxIters) {
+  const double pGood = pow(epsilon, m) * (1. - 1./A);
+  if (pGood >= 1.)
+    return 1;
+  const double iters = log(1. - confidence) / log(1. - pGood);
+  return ((pGood <= 0.) || !(iters < maxIters)) ? maxIters : (long)ceil(iters);
+}
+
+//============================================================
+// Estimation
+//
+
+struct GeometryHypothesis {
+  double model[9];
+  // -1 if there is no model, or if it was rejected by the SPRT
+  long nInliers;
+  // checked and consistent points of the rejected models
+  long nTested, nConsistent;
+};
+
+class GeometryRoundBody : public ParallelLoopBody {
+public:
+  GeometryRoundBody(GeometryModel model, const vector<Point2f> & p1,
+		    const vector<Point2f> & p2, const vector<long> & checkOrder,
+		    const vector<int> & samples, double thr2, const SPRTParams & sprt,
+		    vector<GeometryHypothesis> & hyps)
+    :model(model), p1(p1), p2(p2), checkOrder(checkOrder), samples(samples),
+     thr2(thr2), sprt(sprt), hyps(hyps) {};
+  virtual void operator()(const Range & range) const {
+    const int m = SampleSize(model);
+    const long n = p1.size();
+    Point2f s1[7], s2[7];
+    double models[27];
+    for (int h = range.start; h < range.end; ++h) {
+      GeometryHypothesis & hyp = hyps[h];
+      hyp.nInliers = -1;
+      hyp.nTested = hyp.nConsistent = 0;
+      for (int k = 0; k < m; ++k) {
+	s1[k] = p1[samples[h*m+k]];
+	s2[k] = p2[samples[h*m+k]];
+      }
+      const int nModels = MinimalModels(model, s1, s2, models);
+      for (int k = 0; k < nModels; ++k) {
+	const double* M = models + 9*k;
+	long nTested = 0, nConsistent = 0;
+	double lambda = 1.;
+	bool rejected = false;
+	while (nTested < n) {
+	  const long j = checkOrder[nTested++];
+	  if (SquaredError(model, M, p1[j], p2[j]) < thr2) {
+	    ++nConsistent;
+	    lambda *= sprt.consistent;
+	  } else {
+	    lambda *= sprt.inconsistent;
+	  }
+	  if (lambda > sprt.A) {
+	    rejected = true;
+	    break;
+	  }
+	}
+	if (rejected) {
+	  hyp.nTested += nTested;
+	  hyp.nConsistent += nConsistent;
+	} else if (nConsistent > hyp.nInliers) {
+	  hyp.nInliers = nConsistent;
+	  memcpy(hyp.model, M, sizeof(hyp.model));
+	}
+      }
+    }
+  }
+private:
+  GeometryModel model;
+  const vector<Point2f> & p1, & p2;
+  const vector<long> & checkOrder;
+  const vector<int> & samples;
+  double thr2;
+  const SPRTParams & sprt;
+  vector<GeometryHypothesis> & hyps;
+};
+
+struct ScoreLess {
+  const float* scores;
+  ScoreLess(const float* scores) :scores(scores) {};
+  inline bool operator()(long a, long b) const {return scores[a] < scores[b];};
+};
+
+long EstimateGeometry(const vector<Point2f> & x1, const vector<Point2f> & x2,
+		      const float* scores, const GeometryParams & params,
+		      matd & model, vector<ubyte> & inliers) {
+  THassert(x1.size() == x2.size());
+  THassert((params.threshold > 0.) && (params.maxIters > 0));
+  const GeometryModel type = params.model;
+  const long n = x1.size();
+  const int m = SampleSize(type);
+  model.release();
+  inliers.assign(n, 0);
+  if (n < m)
+    return 0;
+
+  // correspondences in the PROSAC order, and random order of the checks
+  vector<long> rank(n);
+  for (long i = 0; i < n; ++i)
+    rank[i] = i;
+  if (scores != NULL)
+    stable_sort(rank.begin(), rank.end(), ScoreLess(scores));
+  vector<Point2f> p1(n), p2(n);
+  for (long i = 0; i < n; ++i) {
+    p1[i] = x1[rank[i]];
+    p2[i] = x2[rank[i]];
+  }
+  RNG rng(params.seed);
+  vector<long> checkOrder(rank.size());
+  for (long i = 0; i < n; ++i)
+    checkOrder[i] = i;
+  for (long i = n-1; i > 0; --i)
+    swap(checkOrder[i], checkOrder[rng.uniform(0, (int)i+1)]);
+
+  const double thr2 = params.threshold * params.threshold;
+  ProsacSampler sampler(n, m, params.maxIters, scores == NULL);
+  SPRTParams sprt;
+  vector<int> samples(GEOMETRY_ROUND * m);
+  vector<GeometryHypothesis> hyps(GEOMETRY_ROUND);
+  double best[9];
+  long nBest = 0, nTestedBad = 0, nConsistentBad = 0;
+  long nIters = 0, maxIters = params.maxIters;
+  while (nIters < maxIters) {
+    const int nHyps = min((long)GEOMETRY_ROUND, maxIters - nIters);
+    for (int h = 0; h < nHyps; ++h)
+      sampler.draw(rng, &(samples[h*m]));
+    parallel_for_(Range(0, nHyps),
+		  GeometryRoundBody(type, p1, p2, checkOrder, samples, thr2, sprt, hyps),
+		  ParallelStripes(nHyps, 4));
+    nIters += nHyps;
+    // (in the order of the hypotheses, for a deterministic result)
+    for (int h = 0; h < nHyps; ++h) {
+      nTestedBad += hyps[h].nTested;
+      nConsistentBad += hyps[h].nConsistent;
+      if (hyps[h].nInliers > nBest) {
+	nBest = hyps[h].nInliers;
+	memcpy(best, hyps[h].model, sizeof(best));
+      }
+    }
+    if (nBest > 0) {
+      const double epsilon = (double)nBest / (double)n;
+      sprt.update(epsilon, (nTestedBad > 0) ? (double)nConsistentBad / nTestedBad : SPRT_DELTA0,
+		  ModelsPerSample(type));
+      maxIters = RequiredIters(epsilon, m, sprt.A, params.confidence, params.maxIters);
+    }
+  }
+  if (nBest < m)
+    return 0;
+
+  vector<ubyte> mask;
+  nBest = Inliers(type, best, p1, p2, thr2, mask);
+  double refined[9];
+  if (RefineModel(type, p1, p2, mask, refined)) {
+    vector<ubyte> refinedMask;
+    const long nRefined = Inliers(type, refined, p1, p2, thr2, refinedMask);
+    if (nRefined >= nBest) {
+      nBest = nRefined;
+      memcpy(best, refined, sizeof(best));
+      mask.swap(refinedMask);
+    }
+  }
+  model = matd(3, 3, best).clone();
+  for (long i = 0; i < n; ++i)
+    inliers[rank[i]] = mask[i];
+  return nBest;
+}
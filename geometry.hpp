@@ -0,0 +1,48 @@
+#ifndef __GEOMETRY_HPP__
+#define __GEOMETRY_HPP__
+
+#include "common.hpp"
+
+//============================================================
+// Robust geometric verification
+//
+// RANSAC on point correspondences, with :
+//  - PROSAC sampling : the samples are drawn among the best ranked
+//    correspondences first (eg. the smallest match distances), the drawing
+//    set growing progressively to all of them,
+//  - SPRT : the correspondences are checked in random order, and a
+//    hypothesis is dropped as soon as it is unlikely to be better than a
+//    random (bad) model,
+//  - the hypotheses drawn by rounds, evaluated in parallel.
+// The samples and the SPRT parameters of a round only depend on the previous
+// rounds, so that the result does not depend on the number of threads.
+//
+
+enum GeometryModel {
+  GEOMETRY_HOMOGRAPHY = 0,  // x2 ~ H x1 (4 points)
+  GEOMETRY_AFFINE = 1,      // x2 = A x1, last row 0 0 1 (3 points)
+  GEOMETRY_FUNDAMENTAL = 2, // x2' F x1 = 0 (7 points)
+};
+
+struct GeometryParams {
+  GeometryModel model;
+  // inlier threshold, in pixels : reprojection error in image 2, or Sampson
+  // distance for the fundamental matrix
+  double threshold;
+  // stops when an all-inlier sample was drawn with this probability
+  double confidence;
+  int maxIters;
+  unsigned int seed;
+  GeometryParams();
+};
+
+// x1[i] <-> x2[i]. If scores is given (lower is better, eg. the Hamming
+// distances), it drives the PROSAC ordering, otherwise the sampling is
+// uniform. model is set to the 3x3 model, refined on the inliers, and
+// inliers[i] to 1 for the inliers, 0 otherwise. Returns the number of
+// inliers, 0 (and an empty model) if no model was found.
+long EstimateGeometry(const vector<Point2f> & x1, const vector<Point2f> & x2,
+		      const float* scores, const GeometryParams & params,
+		      matd & model, vector<ubyte> & inliers);
+
+#endif
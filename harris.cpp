@@ -0,0 +1,137 @@
+#include "harris.hpp"
+
+// rows per tile : a tile costs 2*halo extra rows
+#define HARRIS_TILE_ROWS 64
+
+static inline int NumTiles(int h) {
+  return (h + HARRIS_TILE_ROWS - 1) / HARRIS_TILE_ROWS;
+}
+
+//============================================================
+// Response
+//
+
+class HarrisResponseBody : public ParallelLoopBody {
+public:
+  HarrisResponseBody(const Mat & gray, Mat & dst, int blockSize, int ksize, double k)
+    :gray(gray), dst(dst), blockSize(blockSize), ksize(ksize), k(k),
+     // rows of a tile which differ from the whole image computation
+     halo(blockSize/2 + max(ksize, 3)/2 + 1) {};
+  virtual void operator()(const Range & range) const {
+    Mat tileResponse;
+    for (int t = range.start; t < range.end; ++t) {
+      const int r0 = t*HARRIS_TILE_ROWS, r1 = min(gray.rows, r0 + HARRIS_TILE_ROWS);
+      const int a = max(0, r0 - halo), b = min(gray.rows, r1 + halo);
+      cornerHarris(gray.rowRange(a, b), tileResponse, blockSize, ksize, k,
+		   BORDER_REPLICATE);
+      Mat out = dst.rowRange(r0, r1);
+      tileResponse.rowRange(r0 - a, r1 - a).convertTo(out, dst.type());
+    }
+  }
+private:
+  const Mat & gray;
+  Mat & dst;
+  int blockSize, ksize;
+  double k;
+  int halo;
+};
+
+void HarrisResponse(const Mat & gray, Mat & dst, int blockSize, int ksize, double k) {
+  THassert(gray.type() == CV_8U);
+  THassert((dst.size() == gray.size()) &&
+	   ((dst.type() == CV_32F) || (dst.type() == CV_64F)));
+  const int nTiles = NumTiles(gray.rows);
+  parallel_for_(Range(0, nTiles), HarrisResponseBody(gray, dst, blockSize, ksize, k),
+		ParallelStripes(nTiles));
+}
+
+//============================================================
+// Non-maximum suppression
+//
+
+template<typename T>
+static void TileMaxima(const Mat & tile, const Mat & dilated, int firstRow, int lastRow,
+		       int rowOffset, double threshold, vector<HarrisCorner> & corners) {
+  for (int i = firstRow; i < lastRow; ++i) {
+    const T* r = tile.ptr<T>(i);
+    const T* d = dilated.ptr<T>(i);
+    for (int j = 0; j < tile.cols; ++j)
+      if ((r[j] > threshold) && (r[j] == d[j])) {
+	HarrisCorner c;
+	c.x = (float)j;
+	c.y = (float)(i + rowOffset);
+	c.response = (float)r[j];
+	corners.push_back(c);
+      }
+  }
+}
+
+class HarrisMaximaBody : public ParallelLoopBody {
+public:
+  HarrisMaximaBody(const Mat & response, int radius, double threshold,
+		   vector<vector<HarrisCorner> > & tileCorners)
+    :response(response), radius(radius), threshold(threshold),
+     tileCorners(tileCorners),
+     kernel(getStructuringElement(MORPH_RECT, Size(2*radius+1, 2*radius+1))) {};
+  virtual void operator()(const Range & range) const {
+    Mat dilated;
+    for (int t = range.start; t < range.end; ++t) {
+      const int r0 = t*HARRIS_TILE_ROWS, r1 = min(response.rows, r0 + HARRIS_TILE_ROWS);
+      const int a = max(0, r0 - radius), b = min(response.rows, r1 + radius);
+      const Mat tile = response.rowRange(a, b);
+      dilate(tile, dilated, kernel);
+      if (response.depth() == CV_32F)
+	TileMaxima<float>(tile, dilated, r0 - a, r1 - a, a, threshold, tileCorners[t]);
+      else
+	TileMaxima<double>(tile, dilated, r0 - a, r1 - a, a, threshold, tileCorners[t]);
+    }
+  }
+private:
+  const Mat & response;
+  int radius;
+  double threshold;
+  vector<vector<HarrisCorner> > & tileCorners;
+  Mat kernel;
+};
+
+// strongest first, then in raster order
+struct HarrisCornerCompare {
+  inline bool operator()(const HarrisCorner & a, const HarrisCorner & b) const {
+    if (a.response != b.response)
+      return a.response > b.response;
+    return (a.y < b.y) || ((a.y == b.y) && (a.x < b.x));
+  }
+};
+
+void HarrisCorners(const Mat & gray, int blockSize, int ksize, double k,
+		   int radius, double threshold, double quality,
+		   size_t maxCorners, vector<HarrisCorner> & corners,
+		   Mat * response) {
+  THassert(radius >= 0);
+  Mat resp;
+  if (response != NULL)
+    resp = *response;
+  else
+    resp.create(gray.size(), CV_32F);
+  HarrisResponse(gray, resp, blockSize, ksize, k);
+  if (quality > 0) {
+    double maxResponse;
+    minMaxLoc(resp, NULL, &maxResponse);
+    threshold = max(threshold, quality * maxResponse);
+  }
+
+  const int nTiles = NumTiles(gray.rows);
+  vector<vector<HarrisCorner> > tileCorners(nTiles);
+  parallel_for_(Range(0, nTiles), HarrisMaximaBody(resp, radius, threshold, tileCorners),
+		ParallelStripes(nTiles));
+  corners.clear();
+  for (int t = 0; t < nTiles; ++t)
+    corners.insert(corners.end(), tileCorners[t].begin(), tileCorners[t].end());
+  if ((maxCorners > 0) && (maxCorners < corners.size())) {
+    partial_sort(corners.begin(), corners.begin() + maxCorners, corners.end(),
+		 HarrisCornerCompare());
+    corners.resize(maxCorners);
+  } else {
+    sort(corners.begin(), corners.end(), HarrisCornerCompare());
+  }
+}
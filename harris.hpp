@@ -0,0 +1,31 @@
+#ifndef __HARRIS_HPP__
+#define __HARRIS_HPP__
+
+#include "common.hpp"
+
+//============================================================
+// Tiled Harris corners
+//
+// The response is computed by tiles of rows, in parallel. Each tile is
+// extended by halo rows (the Sobel and block radii) so that its rows match
+// cornerHarris on the whole image, and is written directly into the
+// destination (CV_32F or CV_64F, eg. a wrapped tensor).
+//
+
+struct HarrisCorner {
+  float x, y, response;
+};
+
+// dst must already have the size of gray (CV_8U)
+void HarrisResponse(const Mat & gray, Mat & dst, int blockSize, int ksize, double k);
+
+// Local maxima of the Harris response in (2*radius+1)^2 windows which are
+// above max(threshold, quality * max response), strongest first. At most
+// maxCorners are returned (all if 0). If response is given, the response
+// map is written in it (CV_32F or CV_64F, size of gray).
+void HarrisCorners(const Mat & gray, int blockSize, int ksize, double k,
+		   int radius, double threshold, double quality,
+		   size_t maxCorners, vector<HarrisCorner> & corners,
+		   Mat * response = NULL);
+
+#endif
@@ -27,12 +27,139 @@ function opencv24.TH2CVImage(im)
    end
 end
 
+-- Decodes images in parallel on the worker pool (cf. opencv24.SetNumThreads).
+-- sources is a table of file names and/or ByteTensors holding encoded images
+-- (jpeg, png...). Returns a table of ByteTensors in the layout of
+-- TH2CVImage : HxWx3 BGR, or HxW if gray. If width and height are given,
+-- the images are resized to width x height.
+function opencv24.DecodeImages(sources, gray, width, height)
+   local outputs = {}
+   for i = 1,#sources do
+      outputs[i] = torch.ByteTensor()
+   end
+   libopencv24.DecodeImages(sources, outputs, gray or false, width or 0, height or 0)
+   return outputs
+end
+
+-- Height and width of an image accepted by the bindings : HxW, 3xHxW, or
+-- HxWx3 for byte tensors (cf. opencv24.TH2CVImage), or a frame handle
+local function imageSize(im)
+   if type(im) == 'number' then
+      return libopencv24.FrameSize(im)
+   elseif im:nDimension() == 2 then
+      return im:size(1), im:size(2)
+   elseif (im:type() == 'torch.ByteTensor') and (im:size(3) == 3) then
+      return im:size(1), im:size(2)
+   else
+      return im:size(2), im:size(3)
+   end
+end
+
 function opencv24.CV2THImage(im_cv)
    local im = torch.Tensor()
    im.libopencv24.CV2THImage(im_cv, im)
    return im
 end
 
+-- Futures : the asynchronous functions (DenseOpticalFlowAsync,
+-- TrainFREAKAsync) queue their work on the worker pool and return at once a
+-- future. future:ready() tells whether the work is done, without blocking ;
+-- future:wait() blocks until it is, raises its error if any, and returns
+-- the results of the call. The tensors passed to the call are kept alive
+-- until then but must not be modified, and every future must be waited for
+-- (it holds them).
+local Future = {}
+Future.__index = Future
+
+local function newFuture(handle, results)
+   return setmetatable({handle = handle, results = results}, Future)
+end
+
+function Future:ready()
+   return (self.handle == nil) or libopencv24.FutureReady(self.handle)
+end
+
+function Future:wait()
+   if self.handle ~= nil then
+      local handle = self.handle
+      self.handle = nil
+      libopencv24.FutureWait(handle)
+   end
+   return self.results()
+end
+
+-- Frames : an image converted to gray once, which caches the LK pyramid and
+-- the FAST keypoints computed on it. The handle can be passed in place of the
+-- image to the single-image bindings (TrackPointsLK, TrackerLKPush,
+-- DenseOpticalFlow, FarnebackFlowPush, ComputeFAST, ComputeFREAK,
+-- CornerHarris, HarrisCorners, DetectExtract), so that they share this work :
+--   local frame = opencv24.CreateFrame(im)
+--   local corresps = opencv24.TrackerLKPush(iTracker, frame)
+--   local freaks = opencv24.ComputeFREAK(frame, 20, iFREAK)
+--   opencv24.DeleteFrame(frame)
+function opencv24.CreateFrame(im)
+   return libopencv24.CreateFrame(im)
+end
+
+function opencv24.DeleteFrame(iFrame)
+   libopencv24.DeleteFrame(iFrame)
+end
+
+-- height, width
+function opencv24.FrameSize(iFrame)
+   return libopencv24.FrameSize(iFrame)
+end
+
+-- Video sources : a video file decoded ahead, by a background thread, into a
+-- ring of nSlots (default 4) HxWx3 BGR ByteTensors (the layout of
+-- TH2CVImage, which the bindings take without copying). video:next() returns
+-- the next frame and its one-based number, or nil at the end of the video.
+-- The frame is reused by the decoder after the following call to next() :
+-- it must be cloned to be kept, and must not be resized.
+--   local video = opencv24.OpenVideo('video.avi')
+--   for frame, i in video:frames() do
+--      local corresps = opencv24.TrackPointsLK{im1=prev, im2=frame}
+--      ...
+--   end
+--   video:close()
+local VideoSource = {}
+VideoSource.__index = VideoSource
+
+function opencv24.OpenVideo(path, nSlots)
+   nSlots = nSlots or 4
+   local handle, h, w, fps, nFrames = libopencv24.OpenVideoSource(path)
+   local slots = {}
+   for i = 1,nSlots do
+      slots[i] = torch.ByteTensor(h, w, 3)
+   end
+   libopencv24.VideoSourceStart(handle, slots)
+   return setmetatable({handle = handle, slots = slots, height = h, width = w,
+			fps = fps, nFrames = nFrames}, VideoSource)
+end
+
+function VideoSource:next()
+   if self.handle == nil then
+      return nil
+   end
+   local slot, iFrame = libopencv24.VideoSourceNext(self.handle)
+   if slot == nil then
+      return nil
+   end
+   return self.slots[slot+1], iFrame+1
+end
+
+-- iterator over the remaining frames : for frame, i in video:frames() do
+function VideoSource:frames()
+   return function() return self:next() end
+end
+
+function VideoSource:close()
+   if self.handle ~= nil then
+      libopencv24.CloseVideoSource(self.handle)
+      self.handle = nil
+   end
+end
+
 --------------------------------------------------------------------------------
 -- Tracking
 --
@@ -55,17 +182,10 @@ function opencv24.TrackPointsLK(...)
        help='opencv GoodFeaturesToTrack pyramid depth', default=5},
       {arg='useHarris', type='bool', default = false, help = 'Use Harris detector'})
 
-   if self.im1:size(1) == 3 then
-      self.im1 = opencv24.TH2CVImage(self.im1)
-   end
-   if self.im2:size(1) == 3 then
-      self.im2 = opencv24.TH2CVImage(self.im2)
-   end
-
    local corresps = torch.FloatTensor(self.maxPoints, 4)
    libopencv24.TrackPoints(self.im1, self.im2, corresps, self.maxPoints, self.pointsQuality,
 			   self.pointsMinDistance, self.featuresBlockSize,
-			   self.trackerWinSize, self.useHarris)
+			   self.trackerWinSize, self.trackerMaxLevel, self.useHarris)
    return corresps
 end
 
@@ -84,8 +204,14 @@ function opencv24.TrackPointsFREAK(...)
       {arg='detectionThres', type='number', default=40,
        help='FAST detector threshold'},
       {arg='matchingThres', type='number', default=100,
-       help='FREAK matching threshold (Hamming distance)'})
-   
+       help='FREAK matching threshold (Hamming distance)'},
+      {arg='radius', type='number', default=nil,
+       help='Only match within this distance of the predicted position (cf. opencv24.MatchFREAKGuided)'},
+      {arg='offset', type='table', default=nil,
+       help='Predicted displacement {dx, dy} (with radius)'},
+      {arg='homography', type='torch.Tensor', default=nil,
+       help='Predicted 3x3 homography from image 1 to image 2 (with radius)'})
+
    if not self.im1Freaks then
       self.iFREAK = self.iFREAK or opencv24.CreateFREAK()
       self.im1Freaks = opencv24.ComputeFREAK(self.im1, self.detectionThres, self.iFREAK)
@@ -94,13 +220,109 @@ function opencv24.TrackPointsFREAK(...)
       self.iFREAK = self.iFREAK or opencv24.CreateFREAK()
       self.im2Freaks = opencv24.ComputeFREAK(self.im2, self.detectionThres, self.iFREAK)
    end
-   local matches = opencv24.MatchFREAK(self.im1Freaks, self.im2Freaks, self.matchingThres)   
+   local matches, distances
+   if self.radius then
+      matches, distances = opencv24.MatchFREAKGuided(self.im1Freaks, self.im2Freaks,
+						     self.matchingThres, self.radius,
+						     self.homography or self.offset)
+   else
+      matches, distances = opencv24.MatchFREAK(self.im1Freaks, self.im2Freaks,
+					       self.matchingThres)
+   end
    local tracked = torch.Tensor(matches:size(1), 4)
    for i = 1,matches:size(1) do
       tracked[{i, {1,2}}]:copy(self.im1Freaks.pos[{matches[i][1], {1,2}}])
       tracked[{i, {3,4}}]:copy(self.im2Freaks.pos[{matches[i][2], {1,2}}])
    end
-   return tracked
+   -- (the Hamming distances order the correspondences for FindGeometry)
+   return tracked, distances
+end
+
+local geometry_models = {homography = 0, affine = 1, fundamental = 2}
+
+-- Robust fit of a model to correspondences (as returned by TrackPointsLK,
+-- TrackPointsFREAK or TrackerLKPush) : RANSAC with PROSAC sampling (by
+-- increasing distance, if given) and SPRT early exit, the hypotheses being
+-- evaluated in parallel. Returns the 3x3 model (x2 ~ M x1, or x2' M x1 = 0
+-- for the fundamental matrix, zero if not found), the inlier mask (ByteTensor
+-- N) and the number of inliers.
+function opencv24.FindGeometry(...)
+   local self = {}
+   xlua.unpack_class(
+      self, {...}, 'opencv24.FindGeometry', help_desc,
+      {arg='corresps', type='torch.Tensor', help='Nx4 correspondences (x1, y1, x2, y2)'},
+      {arg='distances', type='torch.Tensor', default=nil,
+       help='N match distances (lower is better), to draw the best matches first'},
+      {arg='model', type='string', default='homography',
+       help='model = homography | affine | fundamental'},
+      {arg='threshold', type='number', default=3,
+       help='inlier threshold (reprojection error or Sampson distance, in pixels)'},
+      {arg='confidence', type='number', default=0.995,
+       help='probability of having drawn an all-inlier sample when stopping'},
+      {arg='maxIters', type='number', default=2000, help='maximum number of hypotheses'},
+      {arg='seed', type='number', default=0, help='random seed'})
+   local model = geometry_models[self.model]
+   if model == nil then
+      error('opencv24.FindGeometry : unknown model ' .. self.model)
+   end
+   local corresps = self.corresps:float()
+   local n = (corresps:nDimension() == 2) and corresps:size(1) or 0
+   local distances = torch.FloatTensor()
+   if self.distances and (n > 0) then
+      distances = self.distances:float()
+   end
+   local M = torch.DoubleTensor()
+   local inliers = torch.ByteTensor()
+   local nInliers = libopencv24.FindGeometry(corresps, distances, model, self.threshold,
+					     self.confidence, self.maxIters, self.seed,
+					     M, inliers)
+   if n == 0 then
+      return M, torch.ByteTensor(), 0
+   end
+   return M, inliers, nInliers
+end
+
+-- Streaming version of TrackPointsLK for videos : the pyramid of the
+-- previous frame and the tracked points are kept between frames, and new
+-- points are only detected when fewer than minPoints are still tracked.
+-- Push the frames with opencv24.TrackerLKPush.
+function opencv24.CreateTrackerLK(...)
+   local self = {}
+   xlua.unpack_class(
+      self, {...}, 'opencv24.CreateTrackerLK', help_desc,
+      {arg='maxPoints', type='number', help='Maximum number of tracked points', default=500},
+      {arg='minPoints', type='number', default=nil,
+       help='Detect new points when fewer are tracked (default maxPoints/2)'},
+      {arg='pointsQuality',type='number',help='Minimum quality of trackedpoints',default=0.02},
+      {arg='pointsMinDistance', type='number',
+       help='Minumum distance between two tracked points', default=3.0},
+      {arg='featuresBlockSize', type='number',
+       help='opencv GoodFeaturesToTrack block size', default=20},
+      {arg='trackerWinSize', type='number',
+       help='opencv calcOpticalFlowPyrLK block size', default=11},
+      {arg='trackerMaxLevel', type='number',
+       help='opencv calcOpticalFlowPyrLK pyramid depth', default=5},
+      {arg='useHarris', type='bool', default = false, help = 'Use Harris detector'})
+   local minPoints = self.minPoints or math.floor(self.maxPoints/2)
+   return libopencv24.CreateTrackerLK(self.maxPoints, self.pointsQuality,
+				      self.pointsMinDistance, self.featuresBlockSize,
+				      self.trackerWinSize, self.trackerMaxLevel,
+				      self.useHarris, minPoints)
+end
+
+function opencv24.DeleteTrackerLK(iTracker)
+   libopencv24.DeleteTrackerLK(iTracker)
+end
+
+-- Returns the Nx4 correspondences (x1, y1, x2, y2) between the previous pushed
+-- frame and im (N = 0 for the first frame)
+function opencv24.TrackerLKPush(iTracker, im, corresps)
+   corresps = corresps or torch.FloatTensor()
+   local n = libopencv24.TrackerLKPush(iTracker, im, corresps)
+   if n == 0 then
+      return torch.FloatTensor()
+   end
+   return corresps:narrow(1, 1, n)
 end
 
 --------------------------------------------------------------------------------
@@ -114,7 +336,7 @@ function opencv24.DenseOpticalFlow(...)
       {arg='im1', type='torch.Tensor', help='image 1'},
       {arg='im2', type='torch.Tensor', help='image 2'},
       {arg='mode', type='string', default='farnebach',
-       help='mode = farnebach | block'},
+       help='mode = farnebach | block | block_legacy'},
       {arg='pyr_scale', type='number', default=0.5,
        help='Ratio between 2 successive pyramid scales (farnebach)'},
       {arg='levels', type='number', default=5, help='Pyramid depth (farnebach)'},
@@ -130,19 +352,18 @@ function opencv24.DenseOpticalFlow(...)
        help='Block coordinate increments (block)'},
       {arg='maxrange', type='number', default=11,
        help='Size of the scanned neighborhood in pixels around the block (block)'},
+      {arg='exhaustive', type='bool', default=false,
+       help='Full search instead of a diamond search from the predictors (block)'},
+      {arg='earlyexit', type='number', default=2,
+       help='Stop if a predictor has a mean absolute difference below this, 0 to disable (block)'},
       {arg='flowguess', type='torch.Tensor', default=nil,
        help="Initial guess for the initialization of the flow (doesn't seem to work too well with farnebach)"}
    )
-   if self.im1:nDimension() == 3 then
-      self.im1 = image.rgb2y(self.im1)[1]
-   end
-   if self.im2:nDimension() == 3 then
-      self.im2 = image.rgb2y(self.im2)[1]
-   end
-   local im1_cv = opencv24.TH2CVImage(self.im1)
-   local im2_cv = opencv24.TH2CVImage(self.im2)
-   winr = image.display{image={im1_cv, im2_cv}, win=winr}
-   local flow = torch.FloatTensor(2, im1_cv:size(1), im1_cv:size(2))
+   -- (colour images are converted to gray by the bindings)
+   local im1_cv = self.im1
+   local im2_cv = self.im2
+   local h, w = imageSize(im1_cv)
+   local flow = torch.FloatTensor(2, h, w)
    if self.flowguess ~= nil then
       flow:copy(self.flowguess)
    else
@@ -156,12 +377,18 @@ function opencv24.DenseOpticalFlow(...)
 						 self.poly_n, self.poly_sigma,
 						 self.flowguess ~= nil)
    elseif self.mode == 'block' then
-      local h2 = math.floor(im1_cv:size(1) - self.winsize
+      -- full resolution flow, y first (as block_legacy)
+      libopencv24.DenseOpticalFlowBM(im1_cv, im2_cv, flow, self.winsize, self.shiftsize,
+				     self.maxrange, self.flowguess ~= nil,
+				     self.exhaustive, self.earlyexit)
+   elseif self.mode == 'block_legacy' then
+      -- legacy cvCalcOpticalFlowBM : one vector per block, y first
+      local h2 = math.floor(h - self.winsize
 			    +self.shiftsize) / self.shiftsize
-      local w2 = math.floor(im1_cv:size(2) - self.winsize
+      local w2 = math.floor(w - self.winsize
 			    + self.shiftsize) / self.shiftsize
-      local dh = math.floor((im1_cv:size(1)-h2)/2)
-      local dw = math.floor((im1_cv:size(2)-w2)/2)
+      local dh = math.floor((h-h2)/2)
+      local dw = math.floor((w-w2)/2)
       local flow2 = flow:narrow(2, dh, h2):narrow(3, dw, w2)
       
       libopencv24.DenseOpticalFlowBlockMatching(im1_cv, im2_cv, flow2,
@@ -173,6 +400,82 @@ function opencv24.DenseOpticalFlow(...)
    return flow:real()
 end
 
+-- Asynchronous Farneback flow : same arguments as DenseOpticalFlow (the
+-- mode is farnebach), returns a future whose wait() returns the flow. The
+-- flow is computed in place in a HxWx2 FloatTensor, which can be passed as
+-- flow to reuse it ; wait() then returns a 2xHxW view of it (x first).
+function opencv24.DenseOpticalFlowAsync(...)
+   local self = {}
+   xlua.unpack_class(
+      self, {...}, 'opencv24.DenseOpticalFlowAsync', help_desc,
+      {arg='im1', type='torch.Tensor', help='image 1 (or frame)'},
+      {arg='im2', type='torch.Tensor', help='image 2 (or frame)'},
+      {arg='pyr_scale', type='number', default=0.5,
+       help='Ratio between 2 successive pyramid scales'},
+      {arg='levels', type='number', default=5, help='Pyramid depth'},
+      {arg='winsize', type='number', default=11, help='Window size'},
+      {arg='iterations', type='number', default=20, 
+       help='Number of iteration at each level'},
+      {arg='poly_n', type='number', default=5,
+       help='Size of the pixel neighborhood used to find polynomial expansion in each pixel'},
+      {arg='poly_sigma', type='number', default=1.1,
+       help='Standard deviation of the Gaussian used to smooth derivatives in the polynomial expansion'},
+      {arg='flowguess', type='torch.Tensor', default=nil,
+       help='Initial guess of the flow (2xHxW, x first)'},
+      {arg='flow', type='torch.FloatTensor', default=nil,
+       help='Output buffer (HxWx2)'})
+   local h, w = imageSize(self.im1)
+   local flow = self.flow or torch.FloatTensor()
+   flow:resize(h, w, 2)
+   if self.flowguess ~= nil then
+      flow:permute(3, 1, 2):copy(self.flowguess)
+   end
+   local handle = libopencv24.DenseOpticalFlowFarnebachAsync(
+      self.im1, self.im2, flow, self.pyr_scale, self.levels, self.winsize,
+      self.iterations, self.poly_n, self.poly_sigma, self.flowguess ~= nil)
+   return newFuture(handle, function() return flow:permute(3, 1, 2) end)
+end
+
+-- Persistent Farneback flow for videos : the previous frame and the flow
+-- buffers are kept between frames. Push the frames with
+-- opencv24.FarnebackFlowPush.
+function opencv24.CreateFarnebackFlow(...)
+   local self = {}
+   xlua.unpack_class(
+      self, {...}, 'opencv24.CreateFarnebackFlow', help_desc,
+      {arg='pyr_scale', type='number', default=0.5,
+       help='Ratio between 2 successive pyramid scales'},
+      {arg='levels', type='number', default=5, help='Pyramid depth'},
+      {arg='winsize', type='number', default=11, help='Window size'},
+      {arg='iterations', type='number', default=20, 
+       help='Number of iteration at each level'},
+      {arg='poly_n', type='number', default=5,
+       help='Size of the pixel neighborhood used to find polynomial expansion in each pixel'},
+      {arg='poly_sigma', type='number', default=1.1,
+       help='Standard deviation of the Gaussian used to smooth derivatives in the polynomial expansion'},
+      {arg='use_previous', type='bool', default=true,
+       help='Use the previous flow as initial guess'})
+   return libopencv24.CreateFarnebackFlow(self.pyr_scale, self.levels, self.winsize,
+					  self.iterations, self.poly_n, self.poly_sigma,
+					  self.use_previous)
+end
+
+function opencv24.DeleteFarnebackFlow(iFlow)
+   libopencv24.DeleteFarnebackFlow(iFlow)
+end
+
+-- Returns the flow between the previous pushed frame and im, or nil for the
+-- first frame. If given, flow is reused as output buffer : a 2xHxW tensor
+-- (x first), or a HxWx2 FloatTensor which is filled without any copy.
+function opencv24.FarnebackFlowPush(iFlow, im, flow)
+   flow = flow or torch.FloatTensor()
+   if flow.libopencv24.FarnebackFlowPush(iFlow, im, flow) then
+      return flow
+   else
+      return nil
+   end
+end
+
 --------------------------------------------------------------------------------
 -- CornerHarris
 --
@@ -188,13 +491,44 @@ function opencv24.CornerHarris(...)
        help='Aperture parameter for the Sobel() operator.'},
       {arg='k', type='number', default=0.04, 
        help='Harris detector free parameter.'})
-   local out = torch.Tensor(self.im:size(2), self.im:size(3))
-   local im_cv = opencv24.TH2CVImage(self.im)
-   out.libopencv24.CornerHarris(im_cv, out, 
+   local out = torch.Tensor(imageSize(self.im))
+   out.libopencv24.CornerHarris(self.im, out, 
                                 self.blocksize,self.ksize,self.k)
    return out
 end
 
+-- Harris corners : local maxima of the Harris response in (2*radius+1)^2
+-- windows, above max(threshold, quality * max response). Returns a Nx3
+-- FloatTensor (x, y, response), strongest first.
+function opencv24.HarrisCorners(...)
+   local self = {}
+   xlua.unpack_class(
+      self, {...}, 'opencv24.HarrisCorners', help_desc,
+      {arg='im', type='torch.Tensor', help='image'},
+      {arg='blocksize', type='number', default=9, 
+       help='Neighborhood size (See. opencv  cornerEigenValsAndVecs())'},
+      {arg='ksize', type='number', default=3, 
+       help='Aperture parameter for the Sobel() operator.'},
+      {arg='k', type='number', default=0.04, 
+       help='Harris detector free parameter.'},
+      {arg='radius', type='number', default=3,
+       help='Non-maximum suppression radius'},
+      {arg='threshold', type='number', default=0,
+       help='Minimum response'},
+      {arg='quality', type='number', default=0.01,
+       help='Minimum response, relative to the maximum response'},
+      {arg='maxCorners', type='number', default=0,
+       help='Maximum number of corners (0 : all)'})
+   local corners = torch.FloatTensor()
+   local n = libopencv24.HarrisCorners(self.im, corners, self.blocksize, self.ksize,
+				       self.k, self.radius, self.threshold,
+				       self.quality, self.maxCorners)
+   if n == 0 then
+      return torch.FloatTensor()
+   end
+   return corners:narrow(1, 1, n)
+end
+
 --------------------------------------------------------------------------------
 -- CornerHarris
 --
@@ -211,8 +545,15 @@ function opencv24.DetectExtract(...)
        help="GFTT etc.",default="FAST"},
       {arg='extractorType', type="string",
        help="FREAK etc.",default="SURF"},
+      {arg='detector', type='number',
+       help='handle from opencv24.CreateFeatureDetector (overrides detectorType)'},
+      {arg='extractor', type='number',
+       help='handle from opencv24.CreateDescriptorExtractor (overrides extractorType)'},
       {arg='maxPoints', type='number', 
        help='Maximum number of tracked points', default=0},
+      {arg='gridRows', type='number', default=1,
+       help='maxPoints are spread over a gridRows x gridCols grid'},
+      {arg='gridCols', type='number', default=1},
       {arg='pointsQuality',type='number',
        help='Minimum quality of trackedpoints',default=0.02},
       {arg='pointsMinDistance', type='number',
@@ -223,15 +564,101 @@ function opencv24.DetectExtract(...)
        help = 'Use Harris detector'},
       {arg='k', type='number', default=0.04, 
        help='Harris detector free parameter.'})
+   local extractor = self.extractor or self.extractorType
    local positions = torch.Tensor(self.maxPoints, 2)
-   local feat      = torch.Tensor(self.maxPoints, 128)
-   local im_cv     = opencv24.TH2CVImage(self.im)
-   feat.libopencv24.DetectExtract(im_cv, self.mask, positions, feat, 
-                                  self.detectorType, self.extractorType,
-                                  self.maxPoints)
+   local feat      = opencv24.DescriptorTensor(extractor)
+   positions.libopencv24.DetectExtract(self.im, self.mask, positions, feat, 
+                                       self.detector or self.detectorType,
+                                       extractor, self.maxPoints,
+                                       self.gridRows, self.gridCols)
    return positions,feat
 end
 
+-- Batch version of DetectExtract : ims is a table of images, processed in
+-- parallel by the worker pool (cf. opencv24.SetNumThreads). Returns a table
+-- of positions and a table of features.
+function opencv24.DetectExtractBatch(...)
+   local self = {}
+   xlua.unpack_class(
+      self, {...}, 'opencv24.DetectExtractBatch', help_desc,
+      {arg='ims', type='table', help='table of images'},
+      {arg='mask', type='torch.Tensor',
+       help='mask areas where not to compute (shared by all images).', 
+       default=torch.Tensor()},
+      {arg='detectorType', type="string",
+       help="GFTT etc.",default="FAST"},
+      {arg='extractorType', type="string",
+       help="FREAK etc.",default="SURF"},
+      {arg='detector', type='number',
+       help='handle from opencv24.CreateFeatureDetector (overrides detectorType)'},
+      {arg='extractor', type='number',
+       help='handle from opencv24.CreateDescriptorExtractor (overrides extractorType)'},
+      {arg='maxPoints', type='number', 
+       help='Maximum number of tracked points', default=0},
+      {arg='gridRows', type='number', default=1,
+       help='maxPoints are spread over a gridRows x gridCols grid'},
+      {arg='gridCols', type='number', default=1})
+   local extractor = self.extractor or self.extractorType
+   local ims_cv = {}
+   local positions = {}
+   local feats = {}
+   for i = 1,#self.ims do
+      ims_cv[i] = opencv24.TH2CVImage(self.ims[i])
+      positions[i] = torch.Tensor()
+      feats[i] = opencv24.DescriptorTensor(extractor)
+   end
+   torch.Tensor().libopencv24.DetectExtractBatch(ims_cv, self.mask, positions, feats,
+						 self.detector or self.detectorType,
+						 extractor, self.maxPoints,
+						 self.gridRows, self.gridCols)
+   return positions, feats
+end
+
+--------------------------------------------------------------------------------
+-- Feature detectors and descriptor extractors
+--
+-- Handles to detectors/extractors created once and reused by DetectExtract.
+-- params is an optional table of opencv Algorithm parameters, for instance
+-- {threshold=20, nonmaxSuppression=true} for FAST.
+--
+
+function opencv24.CreateFeatureDetector(detectorType, params)
+   return libopencv24.CreateFeatureDetector(detectorType, params)
+end
+
+function opencv24.DeleteFeatureDetector(iDetector)
+   libopencv24.DeleteFeatureDetector(iDetector)
+end
+
+-- sets the given parameters (if any) and returns all the parameters
+function opencv24.FeatureDetectorParams(iDetector, params)
+   return libopencv24.FeatureDetectorParams(iDetector, params)
+end
+
+function opencv24.CreateDescriptorExtractor(extractorType, params)
+   return libopencv24.CreateDescriptorExtractor(extractorType, params)
+end
+
+function opencv24.DeleteDescriptorExtractor(iExtractor)
+   libopencv24.DeleteDescriptorExtractor(iExtractor)
+end
+
+function opencv24.DescriptorExtractorParams(iExtractor, params)
+   return libopencv24.DescriptorExtractorParams(iExtractor, params)
+end
+
+-- Empty tensor of the type of the descriptors of an extractor (handle or
+-- type name) : a ByteTensor for binary descriptors (ORB, BRIEF), a
+-- torch.Tensor otherwise
+function opencv24.DescriptorTensor(extractor)
+   local _, binary = libopencv24.DescriptorExtractorInfo(extractor)
+   if binary then
+      return torch.ByteTensor()
+   else
+      return torch.Tensor()
+   end
+end
+
 --------------------------------------------------------------------------------
 -- FREAK
 --
@@ -245,7 +672,6 @@ function opencv24.CreateFREAK(orientedNormalization, scaleNormalization,
    trainedPairs = trainedPairs or torch.IntTensor()
    local iFREAK = libopencv24.CreateFREAK(orientedNormalization, scaleNormalization,
 					  patternSize, nOctave, trainedPairs)
-   opencv24.ComputeFREAK(image.lena(), 40, iFREAK)
    return iFREAK
 end
 
@@ -257,18 +683,42 @@ function opencv24.ComputeFREAKfromKeyPoints(im, kp, iFREAK)
    local freaks = {}
    freaks.descs = torch.ByteTensor()
    freaks.pos   = kp
-   libopencv24.ComputeFREAKfromKeyPoints(opencv24.TH2CVImage(im), 
-                                         freaks.descs, freaks.pos,
+   libopencv24.ComputeFREAKfromKeyPoints(im, freaks.descs, freaks.pos,
                                          detection_threshold, iFREAK);
    return freaks
 end
 
-function opencv24.ComputeFREAK(im, detection_threshold, iFREAK)
+-- The optional mask (HxW, 0 where no keypoint is wanted, not processed),
+-- maxPoints (strongest keypoints kept, 0 for all) and grid (maxPoints spread
+-- over gridRows x gridCols cells) select the keypoints as DetectExtract.
+function opencv24.ComputeFREAK(im, detection_threshold, iFREAK, mask, maxPoints,
+			       gridRows, gridCols)
    local freaks = {}
    freaks.descs = torch.ByteTensor()
    freaks.pos = torch.FloatTensor()
-   libopencv24.ComputeFREAK(opencv24.TH2CVImage(im), freaks.descs, freaks.pos,
-			    detection_threshold, iFREAK);
+   libopencv24.ComputeFREAK(im, freaks.descs, freaks.pos,
+			    detection_threshold, iFREAK, mask, maxPoints,
+			    gridRows, gridCols);
+   return freaks
+end
+
+-- Batch version of ComputeFREAK : returns a table of freaks (cf.
+-- opencv24.ComputeFREAK), the images being processed in parallel by the worker
+-- pool (cf. opencv24.SetNumThreads).
+function opencv24.ComputeFREAKBatch(ims, detection_threshold, iFREAK)
+   local ims_cv = {}
+   local descs = {}
+   local pos = {}
+   for i = 1,#ims do
+      ims_cv[i] = opencv24.TH2CVImage(ims[i])
+      descs[i] = torch.ByteTensor()
+      pos[i] = torch.FloatTensor()
+   end
+   libopencv24.ComputeFREAKBatch(ims_cv, descs, pos, detection_threshold, iFREAK)
+   local freaks = {}
+   for i = 1,#ims do
+      freaks[i] = {descs = descs[i], pos = pos[i]}
+   end
    return freaks
 end
 
@@ -287,35 +737,291 @@ function opencv24.DrawFREAK(im, freaks, r, g, b)
    end
 end
 
+-- returns the matches (one-based indices) and their Hamming distances
 function opencv24.MatchFREAK(freaks1, freaks2, threshold)
    local matches = torch.LongTensor()
-   local nMatches = libopencv24.MatchFREAK(freaks1.descs, freaks2.descs, matches, threshold)
+   local distances = torch.IntTensor()
+   local nMatches = libopencv24.MatchFREAK(freaks1.descs, freaks2.descs, matches,
+					   threshold, distances)
    if nMatches == 0 then
-      return torch.Tensor()
+      return torch.Tensor(), torch.IntTensor()
+   else
+      matches:add(1) -- one-based lua
+      return matches:narrow(1,1,nMatches), distances:narrow(1,1,nMatches)
+   end
+end
+
+-- MatchFREAK restricted to the FREAKs of freaks2 within radius pixels of the
+-- predicted position of each FREAK of freaks1 : its position, shifted by
+-- offset = {dx, dy} or mapped by the 3x3 homography (torch.Tensor) if given.
+-- The positions of freaks2 are bucketed in a grid, so that only the nearby
+-- cells are scanned. Same outputs as opencv24.MatchFREAK.
+function opencv24.MatchFREAKGuided(freaks1, freaks2, threshold, radius, prediction)
+   local H = torch.DoubleTensor()
+   if torch.typename(prediction) then
+      H = prediction:double()
+   elseif prediction then
+      H = torch.DoubleTensor{{1, 0, prediction[1]}, {0, 1, prediction[2]}, {0, 0, 1}}
+   end
+   local matches = torch.LongTensor()
+   local distances = torch.IntTensor()
+   local nMatches = libopencv24.MatchFREAKGuided(freaks1.descs, freaks1.pos:float(),
+						 freaks2.descs, freaks2.pos:float(),
+						 matches, threshold, distances, radius, H)
+   if nMatches == 0 then
+      return torch.Tensor(), torch.IntTensor()
+   else
+      matches:add(1) -- one-based lua
+      return matches:narrow(1,1,nMatches), distances:narrow(1,1,nMatches)
+   end
+end
+
+-- k nearest neighbours of each FREAK of freaks1 in freaks2, in one pass.
+-- Returns :
+--  indices   : #freaks1 x k one-based indices (0 if less than k candidates)
+--  distances : #freaks1 x k Hamming distances (-1 if less than k candidates)
+--  flags     : 1 if the best match passes the ratio test (best < ratio*second,
+--              disabled if ratio <= 0) and, if crossCheck, is mutual
+--  nAccepted : number of flagged matches
+function opencv24.MatchFREAKKnn(freaks1, freaks2, k, ratio, crossCheck)
+   k = k or 2
+   ratio = ratio or 0.8
+   crossCheck = crossCheck or false
+   local indices = torch.LongTensor()
+   local distances = torch.IntTensor()
+   local flags = torch.ByteTensor()
+   local nAccepted = libopencv24.MatchFREAKKnn(freaks1.descs, freaks2.descs, k, ratio,
+					       crossCheck, indices, distances, flags)
+   indices:add(1) -- one-based lua
+   return indices, distances, flags, nAccepted
+end
+
+-- Approximate matching against a large set of FREAKs (LSH index).
+-- nTables hash tables are built, each keyed on keyBits sampled bits. More
+-- tables (or probes) increase the recall and the query time.
+function opencv24.CreateHammingIndex(freaks, nTables, keyBits, seed)
+   nTables = nTables or 8
+   keyBits = keyBits or 16
+   seed = seed or 0
+   return libopencv24.CreateHammingIndex(freaks.descs, nTables, keyBits, seed)
+end
+
+function opencv24.DeleteHammingIndex(iIndex)
+   libopencv24.DeleteHammingIndex(iIndex)
+end
+
+-- Same outputs as opencv24.MatchFREAK, freaks2 being the indexed FREAKs.
+-- nProbes (0, 1 or 2) : Hamming radius of the probed buckets around the key
+function opencv24.QueryHammingIndex(iIndex, freaks, threshold, nProbes)
+   nProbes = nProbes or 1
+   local matches = torch.LongTensor()
+   local distances = torch.IntTensor()
+   local nMatches = libopencv24.QueryHammingIndex(iIndex, freaks.descs, matches,
+						  threshold, distances, nProbes)
+   if nMatches == 0 then
+      return torch.Tensor(), torch.IntTensor()
    else
       matches:add(1) -- one-based lua
-      return matches:narrow(1,1,nMatches)
+      return matches:narrow(1,1,nMatches), distances:narrow(1,1,nMatches)
    end
 end
 
-function opencv24.TrainFREAK(images, iFREAK, keypoints_threshold, correlation_threshold)
+-- Recall of the index on the given FREAKs (exact nearest neighbour found),
+-- also accumulated in the statistics
+function opencv24.EvaluateHammingIndex(iIndex, freaks, nProbes)
+   nProbes = nProbes or 1
+   return libopencv24.EvaluateHammingIndex(iIndex, freaks.descs, nProbes)
+end
+
+-- Table of statistics : size, nTables, keyBits, nQueries, nCandidates,
+-- candidatesPerQuery, queryTime, latencyPerQuery, nRecallQueries, recall
+function opencv24.HammingIndexStats(iIndex, reset)
+   return libopencv24.HammingIndexStats(iIndex, reset or false)
+end
+
+-- FREAK store : the FREAKs of many frames, in a file that is mapped in memory
+-- when opened (cf. store.hpp), so that large sets can be matched without
+-- loading nor copying them.
+--   local writer = opencv24.CreateFREAKStoreWriter('video.frk')
+--   opencv24.FREAKStoreAppend(writer, opencv24.ComputeFREAK(im, 20, iFREAK))
+--   opencv24.CloseFREAKStoreWriter(writer)
+function opencv24.CreateFREAKStoreWriter(path, descSize, posCols)
+   return libopencv24.CreateFREAKStoreWriter(path, descSize or 64, posCols or 4)
+end
+
+function opencv24.FREAKStoreAppend(iWriter, freaks)
+   libopencv24.FREAKStoreAppend(iWriter, freaks.descs, freaks.pos)
+end
+
+function opencv24.CloseFREAKStoreWriter(iWriter)
+   libopencv24.CloseFREAKStoreWriter(iWriter)
+end
+
+-- Returns a store : store.descs and store.pos hold the FREAKs of all the
+-- frames (they can be passed as freaks to MatchFREAK, CreateHammingIndex...)
+-- and store:frame(i) the FREAKs of the i-th frame. These tensors are views of
+-- the mapped file, which stays mapped until they (and their narrows) are
+-- garbage collected, even after opencv24.CloseFREAKStore.
+function opencv24.OpenFREAKStore(path)
+   local iStore, descs, pos, frames = libopencv24.OpenFREAKStore(path)
+   local store = {iStore = iStore, descs = descs, pos = pos, frames = frames,
+		  nFrames = frames:size(1) - 1}
+   function store:frame(i)
+      local first = self.frames[i]
+      local n = self.frames[i+1] - first
+      if n == 0 then
+	 return {descs = torch.ByteTensor(), pos = torch.FloatTensor()}
+      end
+      return {descs = self.descs:narrow(1, first+1, n),
+	      pos = self.pos:narrow(1, first+1, n)}
+   end
+   return store
+end
+
+function opencv24.CloseFREAKStore(store)
+   libopencv24.CloseFREAKStore(store.iStore)
+   store.descs = nil
+   store.pos = nil
+end
+
+-- Selects the Hamming distance kernel ('auto', 'scalar', 'popcnt', 'avx2',
+-- 'avx512') and returns the name of the kernel in use
+function opencv24.HammingKernel(name)
+   return libopencv24.HammingKernel(name)
+end
+
+-- Instrumentation : opencv24.EnableStats(true) starts counting the calls,
+-- time, bytes and allocations of the bindings and of their stages
+-- (.convert, .kernel, .output). opencv24.Stats() returns them as a table
+-- name -> {calls, time, bytes, allocs}, and resets them if reset is true.
+-- The 'Scratch' entry counts the allocations of the per-thread scratch
+-- memory (none once warm) and its peak : the high-water mark of a call.
+function opencv24.EnableStats(enabled)
+   libopencv24.EnableStats(enabled ~= false)
+end
+
+function opencv24.Stats(reset)
+   return libopencv24.Stats(reset or false)
+end
+
+-- Number of threads used by the parallel bindings (cf. cv::setNumThreads)
+-- and by the worker pool of the batch bindings
+function opencv24.SetNumThreads(nThreads)
+   libopencv24.SetNumThreads(nThreads)
+end
+
+function opencv24.GetNumThreads()
+   return libopencv24.GetNumThreads()
+end
+
+-- Streaming FREAK training : the images are added by batches, in
+-- parallel, and only the statistics of the pair tests are kept, so the
+-- memory does not depend on the number of images. maxKeypoints is the
+-- number of keypoints kept per image (the strongest ones, 0 for all).
+--   local trainer = opencv24.CreateFREAKTrainer(iFREAK, 40, 1000)
+--   for each batch of images : opencv24.FREAKTrainerAdd(trainer, images)
+--   local pairs = opencv24.FREAKTrainerSelect(trainer, 0.7)
+--   opencv24.DeleteFREAKTrainer(trainer)
+function opencv24.CreateFREAKTrainer(iFREAK, keypoints_threshold, maxKeypoints)
+   return libopencv24.CreateFREAKTrainer(iFREAK, keypoints_threshold, maxKeypoints or 0)
+end
+
+function opencv24.DeleteFREAKTrainer(iTrainer)
+   libopencv24.DeleteFREAKTrainer(iTrainer)
+end
+
+-- Adds a table of images, returns the number of keypoints added so far
+function opencv24.FREAKTrainerAdd(iTrainer, images)
+   local images_cv = {}
+   for i = 1,#images do
+      images_cv[i] = opencv24.TH2CVImage(images[i])
+   end
+   return libopencv24.FREAKTrainerAdd(iTrainer, images_cv)
+end
+
+function opencv24.FREAKTrainerSelect(iTrainer, correlation_threshold)
+   local pairs = torch.IntTensor()
+   libopencv24.FREAKTrainerSelect(iTrainer, pairs, correlation_threshold)
+   return pairs
+end
+
+-- images is a table of images or of file names. The file names are decoded
+-- (in gray, cf. opencv24.DecodeImages) by batches of batchSize images
+-- (default : 4 per thread), so that only a batch is in memory at once.
+function opencv24.TrainFREAK(images, iFREAK, keypoints_threshold, correlation_threshold,
+			     maxKeypoints, batchSize)
    if #images < 1 then
       error("opencv24.TrainFREAK : there must be at least one image...")
    end
+   batchSize = batchSize or 4 * opencv24.GetNumThreads()
+   local trainer = opencv24.CreateFREAKTrainer(iFREAK, keypoints_threshold, maxKeypoints)
+   local ok, err = pcall(function()
+      for i0 = 1,#images,batchSize do
+	 local batch = {}
+	 local files, iFiles = {}, {}
+	 for i = i0,math.min(#images, i0+batchSize-1) do
+	    table.insert(batch, images[i])
+	    if type(images[i]) == 'string' then
+	       table.insert(files, images[i])
+	       table.insert(iFiles, #batch)
+	    end
+	 end
+	 if #files > 0 then
+	    local decoded = opencv24.DecodeImages(files, true)
+	    for j = 1,#files do
+	       batch[iFiles[j]] = decoded[j]
+	    end
+	 end
+	 opencv24.FREAKTrainerAdd(trainer, batch)
+	 collectgarbage()
+      end
+   end)
+   if not ok then
+      opencv24.DeleteFREAKTrainer(trainer)
+      error(err)
+   end
+   local ok, pairs = pcall(opencv24.FREAKTrainerSelect, trainer, correlation_threshold)
+   opencv24.DeleteFREAKTrainer(trainer)
+   if not ok then
+      error(pairs)
+   end
+   return pairs
+end
+
+-- Asynchronous TrainFREAK, on a table of images : returns a future whose
+-- wait() returns the pairs
+function opencv24.TrainFREAKAsync(images, iFREAK, keypoints_threshold, correlation_threshold,
+				  maxKeypoints)
+   if #images < 1 then
+      error("opencv24.TrainFREAKAsync : there must be at least one image...")
+   end
    local images_cv = {}
    for i = 1,#images do
       images_cv[i] = opencv24.TH2CVImage(images[i])
    end
    local pairs = torch.IntTensor()
-   libopencv24.TrainFREAK(images_cv, pairs, iFREAK, keypoints_threshold,
-			  correlation_threshold)
-   return pairs
+   local handle = libopencv24.TrainFREAKAsync(images_cv, pairs, iFREAK, keypoints_threshold,
+					      correlation_threshold, maxKeypoints or 0)
+   return newFuture(handle, function() return pairs end)
 end
 
-function opencv24.ComputeFAST(im, detection_threshold)
+-- mask, maxPoints, gridRows and gridCols : cf. ComputeFREAK
+function opencv24.ComputeFAST(im, detection_threshold, mask, maxPoints, gridRows, gridCols)
    local pos = torch.FloatTensor()
-   libopencv24.ComputeFAST(opencv24.TH2CVImage(im), pos, 
-                           detection_threshold);
+   libopencv24.ComputeFAST(im, pos, detection_threshold, mask, maxPoints,
+			   gridRows, gridCols);
+   return pos
+end
+
+-- Batch version of ComputeFAST : returns a table of positions
+function opencv24.ComputeFASTBatch(ims, detection_threshold)
+   local ims_cv = {}
+   local pos = {}
+   for i = 1,#ims do
+      ims_cv[i] = opencv24.TH2CVImage(ims[i])
+      pos[i] = torch.FloatTensor()
+   end
+   libopencv24.ComputeFASTBatch(ims_cv, pos, detection_threshold)
    return pos
 end
 
@@ -377,6 +1083,32 @@ function opencv24.ImageConversion_testme()
    assert(diff == 0)
 end
 
+-- the views of a store outlive opencv24.CloseFREAKStore
+function opencv24.FREAKStore_testme()
+   local iFREAK = opencv24.CreateFREAK()
+   local freaks = opencv24.ComputeFREAK(image.lena(), 20, iFREAK)
+   local path = os.tmpname()
+   local writer = opencv24.CreateFREAKStoreWriter(path)
+   opencv24.FREAKStoreAppend(writer, freaks)
+   opencv24.FREAKStoreAppend(writer, freaks)
+   opencv24.CloseFREAKStoreWriter(writer)
+
+   local store = opencv24.OpenFREAKStore(path)
+   local frame = store:frame(2)
+   opencv24.CloseFREAKStore(store)
+   store = nil
+   collectgarbage()
+   collectgarbage()
+   assert(frame.descs:ne(freaks.descs):sum() == 0)
+   assert(frame.pos:ne(freaks.pos):sum() == 0)
+   local matches = opencv24.MatchFREAK(frame, freaks, 1)
+   assert(matches:size(1) == freaks.descs:size(1))
+   frame = nil
+   collectgarbage()
+   os.remove(path)
+   opencv24.DeleteFREAK(iFREAK)
+end
+
 function opencv24.TrackPointsLK_testme()
    require 'draw'
    local im = image.lena()
@@ -449,6 +1181,34 @@ function opencv24.FREAK_testme()
    opencv24.DeleteFREAK(iFREAK)
 end
 
+function opencv24.MatchFREAK_benchmark(n1, n2, nIters)
+   n1 = n1 or 2000
+   n2 = n2 or 2000
+   nIters = nIters or 5
+   local freaks1 = {descs = torch.ByteTensor(n1, 64):random(0, 255)}
+   local freaks2 = {descs = torch.ByteTensor(n2, 64):random(0, 255)}
+   local kernel = opencv24.HammingKernel()
+   local nThreads = opencv24.GetNumThreads()
+   local function run()
+      local timer = torch.Timer()
+      local matches, dists
+      for i = 1,nIters do
+	 matches, dists = opencv24.MatchFREAK(freaks1, freaks2, 512)
+      end
+      return timer:time().real / nIters, matches, dists
+   end
+   -- reference : scalar popcount on a single thread (former MatchFREAK loop)
+   opencv24.HammingKernel('scalar')
+   opencv24.SetNumThreads(1)
+   local tref, mref, dref = run()
+   opencv24.HammingKernel(kernel)
+   opencv24.SetNumThreads(nThreads)
+   local t, m, d = run()
+   assert((m-mref):abs():sum() == 0 and (d-dref):abs():sum() == 0)
+   print(string.format("MatchFREAK %dx%d : scalar/1 thread %.4fs, %s/%d threads %.4fs (x%.1f)",
+		       n1, n2, tref, kernel, nThreads, t, tref/t))
+end
+
 function opencv24.FAST_testme()
    local im    = image.lena()
    local timer = torch.Timer()
@@ -510,3 +1270,6 @@ function opencv24.DetectExtract_testme(dtype,etype)
    image.display{image=im, zoom=1}
    return pos, feat
 end
+
+torch.include('opencv24', 'benchmark.lua')
+torch.include('opencv24', 'stress.lua')
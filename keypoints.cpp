@@ -0,0 +1,173 @@
+#include "keypoints.hpp"
+
+#include<algorithm>
+
+// FAST needs 3 pixels around a keypoint, and 1 more for the non-maximum
+// suppression
+#define FAST_TILE_MARGIN 4
+
+void DetectFASTMasked(const matb & gray, const matb & mask, int threshold,
+		      vector<KeyPoint> & keypoints) {
+  keypoints.clear();
+  if (mask.empty()) {
+    FAST(gray, keypoints, threshold, true);
+    return;
+  }
+  THassert(mask.size() == gray.size());
+  const Rect image(0, 0, gray.cols, gray.rows);
+  ScratchVector<KeyPoint> scratchTileKeypoints;
+  vector<KeyPoint> & tileKeypoints = *scratchTileKeypoints;
+  for (int y0 = 0; y0 < gray.rows; y0 += KEYPOINTS_TILE_SIZE)
+    for (int x0 = 0; x0 < gray.cols; x0 += KEYPOINTS_TILE_SIZE) {
+      const Rect tile = Rect(x0, y0, KEYPOINTS_TILE_SIZE, KEYPOINTS_TILE_SIZE) & image;
+      if (countNonZero(mask(tile)) == 0)
+	continue;
+      const Rect roi = Rect(tile.x - FAST_TILE_MARGIN, tile.y - FAST_TILE_MARGIN,
+			    tile.width + 2*FAST_TILE_MARGIN,
+			    tile.height + 2*FAST_TILE_MARGIN) & image;
+      tileKeypoints.clear();
+      FAST(gray(roi), tileKeypoints, threshold, true);
+      for (size_t i = 0; i < tileKeypoints.size(); ++i) {
+	KeyPoint kpt = tileKeypoints[i];
+	kpt.pt.x += roi.x;
+	kpt.pt.y += roi.y;
+	const Point p(cvRound(kpt.pt.x), cvRound(kpt.pt.y));
+	if (tile.contains(p) && mask(p))
+	  keypoints.push_back(kpt);
+      }
+    }
+}
+
+void DetectMasked(const FeatureDetector & detector, const matb & gray, const matb & mask,
+		  vector<KeyPoint> & keypoints) {
+  keypoints.clear();
+  if (mask.empty()) {
+    detector.detect(gray, keypoints);
+    return;
+  }
+  THassert(mask.size() == gray.size());
+  // bounding box of the mask, by tiles
+  Rect bbox;
+  const Rect image(0, 0, gray.cols, gray.rows);
+  for (int y0 = 0; y0 < gray.rows; y0 += KEYPOINTS_TILE_SIZE)
+    for (int x0 = 0; x0 < gray.cols; x0 += KEYPOINTS_TILE_SIZE) {
+      const Rect tile = Rect(x0, y0, KEYPOINTS_TILE_SIZE, KEYPOINTS_TILE_SIZE) & image;
+      if (countNonZero(mask(tile)) != 0)
+	bbox = (bbox.area() == 0) ? tile : (bbox | tile);
+    }
+  if (bbox.area() == 0)
+    return;
+  const Rect roi = Rect(bbox.x - KEYPOINTS_DETECT_MARGIN, bbox.y - KEYPOINTS_DETECT_MARGIN,
+			bbox.width + 2*KEYPOINTS_DETECT_MARGIN,
+			bbox.height + 2*KEYPOINTS_DETECT_MARGIN) & image;
+  detector.detect(gray(roi), keypoints, mask(roi));
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    keypoints[i].pt.x += roi.x;
+    keypoints[i].pt.y += roi.y;
+  }
+}
+
+namespace {
+  struct ResponseGreater {
+    bool operator()(const KeyPoint & a, const KeyPoint & b) const {
+      return a.response > b.response;
+    }
+  };
+}
+
+// keeps the n strongest keypoints of [begin, end) in [begin, begin+n)
+static inline void PartialSelect(vector<KeyPoint>::iterator begin,
+				 vector<KeyPoint>::iterator end, size_t n) {
+  if ((size_t)(end - begin) > n)
+    nth_element(begin, begin + n, end, ResponseGreater());
+}
+
+void SelectKeypoints(vector<KeyPoint> & keypoints, const KeypointSelection & sel,
+		     Size imageSize) {
+  STATS_SCOPE("SelectKeypoints");
+  if (!sel.mask.empty()) {
+    size_t n = 0;
+    for (size_t i = 0; i < keypoints.size(); ++i) {
+      const Point p(cvRound(keypoints[i].pt.x), cvRound(keypoints[i].pt.y));
+      if ((p.x >= 0) && (p.y >= 0) && (p.x < sel.mask.cols) && (p.y < sel.mask.rows) &&
+	  sel.mask(p))
+	keypoints[n++] = keypoints[i];
+    }
+    keypoints.resize(n);
+  }
+
+  const size_t maxPoints = sel.maxPoints;
+  const int nCells = max(1, sel.gridRows) * max(1, sel.gridCols);
+  if ((maxPoints == 0) || (keypoints.size() <= maxPoints)) {
+    sort(keypoints.begin(), keypoints.end(), ResponseGreater());
+    return;
+  }
+  if (nCells == 1) {
+    PartialSelect(keypoints.begin(), keypoints.end(), maxPoints);
+    keypoints.resize(maxPoints);
+    sort(keypoints.begin(), keypoints.end(), ResponseGreater());
+    return;
+  }
+
+  // bucket the keypoints by cell (counting sort)
+  const int gridRows = max(1, sel.gridRows), gridCols = max(1, sel.gridCols);
+  ScratchVector<int> scratchCells, scratchStarts;
+  vector<int> & cells = *scratchCells;
+  vector<int> & starts = *scratchStarts;
+  cells.resize(keypoints.size());
+  starts.assign(nCells + 1, 0);
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    const int cx = min(gridCols - 1, max(0, (int)(keypoints[i].pt.x * gridCols / imageSize.width)));
+    const int cy = min(gridRows - 1, max(0, (int)(keypoints[i].pt.y * gridRows / imageSize.height)));
+    cells[i] = cy * gridCols + cx;
+    ++starts[cells[i] + 1];
+  }
+  for (int c = 0; c < nCells; ++c)
+    starts[c + 1] += starts[c];
+  ScratchVector<KeyPoint> scratchBucketed, scratchRest;
+  vector<KeyPoint> & bucketed = *scratchBucketed;
+  vector<KeyPoint> & rest = *scratchRest;
+  bucketed.resize(keypoints.size());
+  {
+    ScratchVector<int> scratchNext;
+    vector<int> & next = *scratchNext;
+    next.assign(starts.begin(), starts.end() - 1);
+    for (size_t i = 0; i < keypoints.size(); ++i)
+      bucketed[next[cells[i]]++] = keypoints[i];
+  }
+
+  // the best of each cell, then the best of the others
+  const size_t quota = max((size_t)1, maxPoints / nCells);
+  keypoints.clear();
+  for (int c = 0; c < nCells; ++c) {
+    vector<KeyPoint>::iterator begin = bucketed.begin() + starts[c];
+    vector<KeyPoint>::iterator end = bucketed.begin() + starts[c + 1];
+    PartialSelect(begin, end, quota);
+    vector<KeyPoint>::iterator mid = begin + min((size_t)(end - begin), quota);
+    keypoints.insert(keypoints.end(), begin, mid);
+    rest.insert(rest.end(), mid, end);
+  }
+  if (keypoints.size() > maxPoints) {
+    PartialSelect(keypoints.begin(), keypoints.end(), maxPoints);
+    keypoints.resize(maxPoints);
+  } else if (keypoints.size() < maxPoints) {
+    const size_t n = min(maxPoints - keypoints.size(), rest.size());
+    PartialSelect(rest.begin(), rest.end(), n);
+    keypoints.insert(keypoints.end(), rest.begin(), rest.begin() + n);
+  }
+  sort(keypoints.begin(), keypoints.end(), ResponseGreater());
+}
+
+KeypointSelection KeypointSelectionFromLuaStack(lua_State* L, int i) {
+  KeypointSelection ret;
+  if (luaT_isudata(L, i, luaT_typenameid(L, "torch.ByteTensor")))
+    ret.mask = MaskFromTensor(FromLuaStack<TH::Tensor<ubyte> >(L, i));
+  else if (luaT_isudata(L, i, luaT_typenameid(L, "torch.FloatTensor")))
+    ret.mask = MaskFromTensor(FromLuaStack<TH::Tensor<float> >(L, i));
+  else if (luaT_isudata(L, i, luaT_typenameid(L, "torch.DoubleTensor")))
+    ret.mask = MaskFromTensor(FromLuaStack<TH::Tensor<double> >(L, i));
+  ret.maxPoints = max(0, (int)lua_tointeger(L, i+1));
+  ret.gridRows = max(1, (int)lua_tointeger(L, i+2));
+  ret.gridCols = max(1, (int)lua_tointeger(L, i+3));
+  return ret;
+}
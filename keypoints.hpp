@@ -0,0 +1,64 @@
+#ifndef __KEYPOINTS_HPP__
+#define __KEYPOINTS_HPP__
+
+#include "common.hpp"
+
+//============================================================
+// Keypoint selection
+//
+// Detection and selection stage shared by DetectExtract, ComputeFAST and
+// ComputeFREAK. The mask is given to the detection, so that the masked
+// areas are not processed : FAST runs tile by tile on the tiles where the
+// mask is set (with the same results as on the whole image), the other
+// detectors on the bounding box of the mask. The selection then removes
+// the keypoints outside the mask and keeps the maxPoints strongest ones
+// with a partial selection (nth_element) : with a grid, each cell first
+// keeps its maxPoints/nCells strongest keypoints, and the rest of the budget
+// goes to the strongest of the others, so that the keypoints are spread
+// over the image. The keypoints are returned by decreasing response.
+//
+
+struct KeypointSelection {
+  matb mask;          // CV_8U, 0 where masked out. Empty : no mask
+  size_t maxPoints;   // 0 : all
+  int gridRows, gridCols;
+  KeypointSelection()
+    :maxPoints(0), gridRows(1), gridCols(1) {};
+  // true if SelectKeypoints would only sort
+  inline bool empty() const {return mask.empty() && (maxPoints == 0);};
+};
+
+// side of the detection tiles
+#define KEYPOINTS_TILE_SIZE 64
+// border added around the bounding box of the mask (other detectors)
+#define KEYPOINTS_DETECT_MARGIN 32
+
+// FAST with non-maximum suppression, on the tiles where mask is set
+void DetectFASTMasked(const matb & gray, const matb & mask, int threshold,
+		      vector<KeyPoint> & keypoints);
+// detector on the bounding box of mask
+void DetectMasked(const FeatureDetector & detector, const matb & gray, const matb & mask,
+		  vector<KeyPoint> & keypoints);
+// Removes the keypoints outside sel.mask and keeps the best sel.maxPoints
+// (cf. above). imageSize is the size of the image (grid cells).
+void SelectKeypoints(vector<KeyPoint> & keypoints, const KeypointSelection & sel,
+		     Size imageSize);
+
+// HxW tensor to a mask in scratch memory (set where the tensor is not
+// zero). An empty tensor gives an empty mask.
+template<typename T> matb MaskFromTensor(TH::Tensor<T> mask) {
+  if (mask.nDimension() == 0)
+    return matb();
+  if (mask.nDimension() != 2)
+    THerror("masks must be HxW tensors");
+  Mat mask_cv = TensorToMat(mask);
+  matb ret = ScratchMat(mask_cv.rows, mask_cv.cols, CV_8U);
+  compare(mask_cv, Scalar(0), ret, CMP_NE);
+  return ret;
+}
+
+// Optional arguments i (mask tensor), i+1 (maxPoints), i+2 and i+3 (grid
+// rows and columns) of a binding. The mask is in scratch memory.
+KeypointSelection KeypointSelectionFromLuaStack(lua_State* L, int i);
+
+#endif
@@ -0,0 +1,211 @@
+#include "common.hpp"
+#include "lsh.hpp"
+#include "matching.hpp"
+
+#include<climits>
+#include<cstring>
+
+//============================================================
+// Construction
+//
+
+unsigned int HammingIndex::Table::key(const unsigned char* desc) const {
+  unsigned int ret = 0;
+  for (size_t i = 0; i < bits.size(); ++i)
+    ret |= (unsigned int)((desc[bits[i] >> 3] >> (bits[i] & 7)) & 1) << i;
+  return ret;
+}
+
+class HammingIndexBuildBody : public ParallelLoopBody {
+public:
+  HammingIndexBuildBody(vector<HammingIndex::Table> & tables,
+			const unsigned char* descs, long n, size_t nBytes)
+    :tables(tables), descs(descs), n(n), nBytes(nBytes) {};
+  virtual void operator()(const Range & range) const {
+    for (int t = range.start; t < range.end; ++t) {
+      HammingIndex::Table & table = tables[t];
+      vector<pair<unsigned int, int> > entries(n);
+      for (long i = 0; i < n; ++i)
+	entries[i] = pair<unsigned int, int>(table.key(descs + i*nBytes), (int)i);
+      sort(entries.begin(), entries.end());
+      table.keys.resize(n);
+      table.ids.resize(n);
+      for (long i = 0; i < n; ++i) {
+	table.keys[i] = entries[i].first;
+	table.ids[i] = entries[i].second;
+      }
+    }
+  }
+private:
+  vector<HammingIndex::Table> & tables;
+  const unsigned char* descs;
+  long n;
+  size_t nBytes;
+};
+
+HammingIndex::HammingIndex(const unsigned char* descs_, long n, long stride,
+			   size_t nBytes, int nTables, int keyBits,
+			   unsigned int seed)
+  :n(n), nBytes(nBytes), nKeyBits(keyBits), descs(n*nBytes), tables(nTables) {
+  THassert(nBytes % sizeof(unsigned long long) == 0);
+  THassert((0 < keyBits) && (keyBits <= 32) && ((size_t)keyBits <= nBytes*8));
+  THassert(nTables > 0);
+  for (long i = 0; i < n; ++i)
+    memcpy(&(descs[i*nBytes]), descs_ + i*stride, nBytes);
+
+  RNG rng(seed);
+  vector<int> allBits(nBytes*8);
+  for (size_t i = 0; i < allBits.size(); ++i)
+    allBits[i] = (int)i;
+  for (int t = 0; t < nTables; ++t) {
+    // partial Fisher-Yates : keyBits distinct bits per table
+    for (int i = 0; i < keyBits; ++i)
+      swap(allBits[i], allBits[i + rng.uniform(0, (int)allBits.size() - i)]);
+    tables[t].bits.assign(allBits.begin(), allBits.begin() + keyBits);
+  }
+  if (n > 0)
+    parallel_for_(Range(0, nTables),
+		  HammingIndexBuildBody(tables, &(descs[0]), n, nBytes));
+  pthread_mutex_init(&statsMutex, NULL);
+  resetStats();
+}
+
+HammingIndex::~HammingIndex() {
+  pthread_mutex_destroy(&statsMutex);
+}
+
+HammingIndexStats HammingIndex::stats() const {
+  pthread_mutex_lock(&statsMutex);
+  HammingIndexStats ret = stats_;
+  pthread_mutex_unlock(&statsMutex);
+  return ret;
+}
+
+void HammingIndex::resetStats() {
+  pthread_mutex_lock(&statsMutex);
+  memset(&stats_, 0, sizeof(stats_));
+  pthread_mutex_unlock(&statsMutex);
+}
+
+void HammingIndex::addStats(const HammingIndexStats & delta) {
+  pthread_mutex_lock(&statsMutex);
+  stats_.nQueries += delta.nQueries;
+  stats_.nCandidates += delta.nCandidates;
+  stats_.queryTime += delta.queryTime;
+  stats_.nRecallQueries += delta.nRecallQueries;
+  stats_.nRecallHits += delta.nRecallHits;
+  pthread_mutex_unlock(&statsMutex);
+}
+
+//============================================================
+// Queries
+//
+
+class HammingIndexQueryBody : public ParallelLoopBody {
+public:
+  HammingIndexQueryBody(HammingIndex & index, const unsigned char* queries,
+			long stride, int nProbes, long* bestIdx,
+			unsigned int* bestDist)
+    :index(index), queries(queries), stride(stride), nProbes(nProbes),
+     bestIdx(bestIdx), bestDist(bestDist) {};
+  virtual void operator()(const Range & range) const {
+    HammingRowKernel kernel = GetHammingKernel();
+    const int keyBits = index.nKeyBits;
+    const unsigned char* descs = (index.n > 0) ? &(index.descs[0]) : NULL;
+    vector<unsigned int> probes;
+    // candidates of the current query, over all the tables (an id can be in
+    // several of them : they are sorted and deduplicated before the exact
+    // distances)
+    vector<int> candidates;
+    long nCandidates = 0;
+    for (long iq = range.start; iq < range.end; ++iq) {
+      const unsigned char* q = queries + iq*stride;
+      candidates.clear();
+      for (size_t t = 0; t < index.tables.size(); ++t) {
+	const HammingIndex::Table & table = index.tables[t];
+	const unsigned int key = table.key(q);
+	probes.clear();
+	probes.push_back(key);
+	if (nProbes >= 1)
+	  for (int b1 = 0; b1 < keyBits; ++b1) {
+	    probes.push_back(key ^ (1u << b1));
+	    if (nProbes >= 2)
+	      for (int b2 = b1+1; b2 < keyBits; ++b2)
+		probes.push_back(key ^ (1u << b1) ^ (1u << b2));
+	  }
+	for (size_t p = 0; p < probes.size(); ++p) {
+	  vector<unsigned int>::const_iterator begin =
+	    lower_bound(table.keys.begin(), table.keys.end(), probes[p]);
+	  for (vector<unsigned int>::const_iterator it = begin;
+	       (it != table.keys.end()) && (*it == probes[p]); ++it)
+	    candidates.push_back(table.ids[it - table.keys.begin()]);
+	}
+      }
+      sort(candidates.begin(), candidates.end());
+      candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+      // (in increasing id order : the first one at the best distance wins)
+      long bestj = -1;
+      unsigned int bestd = UINT_MAX;
+      for (size_t c = 0; c < candidates.size(); ++c) {
+	unsigned int dist;
+	kernel(q, descs + (size_t)candidates[c]*index.nBytes, 0, 1, index.nBytes, &dist);
+	if (dist < bestd) {
+	  bestd = dist;
+	  bestj = candidates[c];
+	}
+      }
+      nCandidates += candidates.size();
+      bestIdx[iq] = bestj;
+      bestDist[iq] = bestd;
+    }
+    HammingIndexStats delta;
+    memset(&delta, 0, sizeof(delta));
+    delta.nCandidates = nCandidates;
+    index.addStats(delta);
+  }
+private:
+  HammingIndex & index;
+  const unsigned char* queries;
+  long stride;
+  int nProbes;
+  long* bestIdx;
+  unsigned int* bestDist;
+};
+
+void HammingIndex::query(const unsigned char* queries, long nQueries, long stride,
+			 int nProbes, long* bestIdx, unsigned int* bestDist) {
+  THassert((0 <= nProbes) && (nProbes <= 2));
+  if (nQueries == 0)
+    return;
+  int64 t0 = getTickCount();
+  parallel_for_(Range(0, nQueries),
+		HammingIndexQueryBody(*this, queries, stride, nProbes, bestIdx, bestDist),
+		ParallelStripes(nQueries, 64));
+  HammingIndexStats delta;
+  memset(&delta, 0, sizeof(delta));
+  delta.nQueries = nQueries;
+  delta.queryTime = (double)(getTickCount() - t0) / getTickFrequency();
+  addStats(delta);
+}
+
+double HammingIndex::evaluateRecall(const unsigned char* queries, long nQueries,
+				    long stride, int nProbes) {
+  if (nQueries == 0)
+    return 0.;
+  vector<long> idx(nQueries), exactIdx(nQueries);
+  vector<unsigned int> dist(nQueries), exactDist(nQueries);
+  query(queries, nQueries, stride, nProbes, &(idx[0]), &(dist[0]));
+  MatchHammingBest(queries, nQueries, stride, (n > 0) ? &(descs[0]) : NULL, n, nBytes,
+		   nBytes, &(exactIdx[0]), &(exactDist[0]));
+  long nHits = 0;
+  for (long i = 0; i < nQueries; ++i)
+    // another neighbour at the same distance is as good
+    if ((exactIdx[i] >= 0) && (dist[i] == exactDist[i]))
+      ++nHits;
+  HammingIndexStats delta;
+  memset(&delta, 0, sizeof(delta));
+  delta.nRecallQueries = nQueries;
+  delta.nRecallHits = nHits;
+  addStats(delta);
+  return (double)nHits / (double)nQueries;
+}
@@ -0,0 +1,71 @@
+#ifndef __LSH_HPP__
+#define __LSH_HPP__
+
+#include<vector>
+#include<cstddef>
+#include<pthread.h>
+
+//============================================================
+// Approximate Hamming index (LSH with bit sampling + multi-probe)
+//
+// Each of the nTables hash tables keys the descriptors on keyBits randomly
+// sampled bits. A table is stored as a sorted array of (key, index), so a
+// bucket lookup is a binary search. A query visits, in every table, its own
+// bucket and (multi-probe) the buckets whose keys are within Hamming
+// distance nProbes (0, 1 or 2) of its key, and computes the exact distance
+// to the candidates only. The descriptors are copied into the index.
+//
+
+struct HammingIndexStats {
+  long   nQueries;
+  long   nCandidates;      // exact distances computed
+  double queryTime;        // seconds, summed over queries
+  long   nRecallQueries;   // queries checked against the exact matcher
+  long   nRecallHits;      // ... whose exact nearest neighbour was found
+};
+
+class HammingIndex {
+public:
+  HammingIndex(const unsigned char* descs, long n, long stride, size_t nBytes,
+	       int nTables, int keyBits, unsigned int seed);
+  ~HammingIndex();
+
+  // Closest indexed descriptor of each query among the probed candidates,
+  // -1 / UINT_MAX if there is no candidate. Queries run in parallel.
+  void query(const unsigned char* queries, long nQueries, long stride,
+	     int nProbes, long* bestIdx, unsigned int* bestDist);
+  // Runs the queries against both the index and the exact matcher, and
+  // accumulates the recall in the statistics. Returns the recall.
+  double evaluateRecall(const unsigned char* queries, long nQueries, long stride,
+			int nProbes);
+
+  inline long size() const {return n;};
+  inline size_t descriptorSize() const {return nBytes;};
+  inline int nTables() const {return (int)tables.size();};
+  inline int keyBits() const {return nKeyBits;};
+  // (the statistics are updated by concurrent queries, under a mutex)
+  HammingIndexStats stats() const;
+  void resetStats();
+
+private:
+  HammingIndex(const HammingIndex &);
+  HammingIndex & operator=(const HammingIndex &);
+  void addStats(const HammingIndexStats & delta);
+  struct Table {
+    std::vector<int> bits;                 // sampled bit positions
+    std::vector<unsigned int> keys;        // sorted
+    std::vector<int> ids;                  // ids[i] has key keys[i]
+    unsigned int key(const unsigned char* desc) const;
+  };
+  long n;
+  size_t nBytes;
+  int nKeyBits;
+  std::vector<unsigned char> descs;
+  std::vector<Table> tables;
+  HammingIndexStats stats_;
+  mutable pthread_mutex_t statsMutex;
+  friend class HammingIndexBuildBody;
+  friend class HammingIndexQueryBody;
+};
+
+#endif
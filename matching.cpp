@@ -0,0 +1,507 @@
+#include "common.hpp"
+#include "matching.hpp"
+
+#include<climits>
+#include<cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && (__GNUC__ >= 5)
+#define MATCHING_X86_KERNELS
+#include<immintrin.h>
+#if __GNUC__ >= 8
+#define MATCHING_AVX512_KERNEL
+#endif
+#endif
+
+//============================================================
+// Hamming kernels
+//
+
+static inline unsigned long long Load64(const unsigned char* p) {
+  unsigned long long ret;
+  memcpy(&ret, p, sizeof(ret));
+  return ret;
+}
+
+// Without -mpopcnt, __builtin_popcountll is a table lookup in libgcc
+static void HammingRowScalar(const unsigned char* query, const unsigned char* train,
+			     long trainStride, long nTrain, size_t nBytes,
+			     unsigned int* dists) {
+  for (long j = 0; j < nTrain; ++j) {
+    const unsigned char* t = train + j*trainStride;
+    unsigned int dist = 0;
+    for (size_t k = 0; k < nBytes; k += 8)
+      dist += __builtin_popcountll(Load64(query+k) ^ Load64(t+k));
+    dists[j] = dist;
+  }
+}
+
+#ifdef MATCHING_X86_KERNELS
+
+__attribute__((target("popcnt")))
+static void HammingRowPopcnt(const unsigned char* query, const unsigned char* train,
+			     long trainStride, long nTrain, size_t nBytes,
+			     unsigned int* dists) {
+  for (long j = 0; j < nTrain; ++j) {
+    const unsigned char* t = train + j*trainStride;
+    unsigned int dist = 0;
+    for (size_t k = 0; k < nBytes; k += 8)
+      dist += __builtin_popcountll(Load64(query+k) ^ Load64(t+k));
+    dists[j] = dist;
+  }
+}
+
+// nibble lookup popcount (W. Mula), 32 bytes at a time
+__attribute__((target("avx2,popcnt")))
+static void HammingRowAVX2(const unsigned char* query, const unsigned char* train,
+			   long trainStride, long nTrain, size_t nBytes,
+			   unsigned int* dists) {
+  const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+					  0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m256i lowMask = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+  const size_t nVec = nBytes / 32;
+  for (long j = 0; j < nTrain; ++j) {
+    const unsigned char* t = train + j*trainStride;
+    __m256i acc = zero;
+    for (size_t k = 0; k < nVec; ++k) {
+      const __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(query+32*k)),
+					 _mm256_loadu_si256((const __m256i*)(t+32*k)));
+      const __m256i lo = _mm256_and_si256(x, lowMask);
+      const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), lowMask);
+      const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+					  _mm256_shuffle_epi8(lookup, hi));
+      acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, zero));
+    }
+    // (stored rather than _mm256_extract_epi64, which is x86-64 only)
+    unsigned long long sums[4];
+    _mm256_storeu_si256((__m256i*)sums, acc);
+    unsigned int dist = (unsigned int)(sums[0] + sums[1] + sums[2] + sums[3]);
+    for (size_t k = nVec*32; k < nBytes; k += 8)
+      dist += __builtin_popcountll(Load64(query+k) ^ Load64(t+k));
+    dists[j] = dist;
+  }
+}
+
+#ifdef MATCHING_AVX512_KERNEL
+// one 512 bits FREAK descriptor per iteration
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+static void HammingRowAVX512(const unsigned char* query, const unsigned char* train,
+			     long trainStride, long nTrain, size_t nBytes,
+			     unsigned int* dists) {
+  const size_t nVec = nBytes / 64;
+  for (long j = 0; j < nTrain; ++j) {
+    const unsigned char* t = train + j*trainStride;
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t k = 0; k < nVec; ++k) {
+      const __m512i x = _mm512_xor_si512(_mm512_loadu_si512(query+64*k),
+					 _mm512_loadu_si512(t+64*k));
+      acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    unsigned int dist = (unsigned int)_mm512_reduce_add_epi64(acc);
+    for (size_t k = nVec*64; k < nBytes; k += 8)
+      dist += __builtin_popcountll(Load64(query+k) ^ Load64(t+k));
+    dists[j] = dist;
+  }
+}
+#endif // MATCHING_AVX512_KERNEL
+
+#endif // MATCHING_X86_KERNELS
+
+struct HammingKernelEntry {
+  const char* name;
+  HammingRowKernel kernel;
+};
+
+static bool HammingKernelSupported(const string & name) {
+  if (name == "scalar")
+    return true;
+#ifdef MATCHING_X86_KERNELS
+  __builtin_cpu_init();
+  if (name == "popcnt")
+    return __builtin_cpu_supports("popcnt");
+  if (name == "avx2")
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#ifdef MATCHING_AVX512_KERNEL
+  if (name == "avx512")
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+#endif
+#endif
+  return false;
+}
+
+// (the entries are never modified : a kernel is selected by swapping a
+// pointer to one of them, so that its name and function stay consistent)
+static const HammingKernelEntry hammingKernels_g[] = {
+  {"scalar", HammingRowScalar},
+#ifdef MATCHING_X86_KERNELS
+  {"popcnt", HammingRowPopcnt},
+  {"avx2", HammingRowAVX2},
+#ifdef MATCHING_AVX512_KERNEL
+  {"avx512", HammingRowAVX512},
+#endif
+#endif
+};
+
+static const HammingKernelEntry* HammingKernelFromName(const string & name) {
+  for (size_t i = 0; i < sizeof(hammingKernels_g)/sizeof(hammingKernels_g[0]); ++i)
+    if (name == hammingKernels_g[i].name)
+      return &(hammingKernels_g[i]);
+  return &(hammingKernels_g[0]);
+}
+
+static const HammingKernelEntry* HammingKernelAuto() {
+  const char* preferred[] = {"avx512", "avx2", "popcnt"};
+  for (size_t i = 0; i < sizeof(preferred)/sizeof(preferred[0]); ++i)
+    if (HammingKernelSupported(preferred[i]))
+      return HammingKernelFromName(preferred[i]);
+  return HammingKernelFromName("scalar");
+}
+
+// Read by the worker threads : selected at the first call by a
+// compare-and-swap (concurrent first calls agree on the same entry), and
+// replaced atomically by SetHammingKernel
+static const HammingKernelEntry* volatile hammingKernel_g = NULL;
+
+static const HammingKernelEntry* CurrentHammingKernel() {
+  const HammingKernelEntry* entry = hammingKernel_g;
+  if (entry == NULL) {
+    __sync_bool_compare_and_swap(&hammingKernel_g, (const HammingKernelEntry*)NULL,
+				 HammingKernelAuto());
+    entry = hammingKernel_g;
+  }
+  return entry;
+}
+
+HammingRowKernel GetHammingKernel() {
+  return CurrentHammingKernel()->kernel;
+}
+
+string GetHammingKernelName() {
+  return CurrentHammingKernel()->name;
+}
+
+bool SetHammingKernel(const string & name) {
+  const HammingKernelEntry* entry;
+  if (name == "auto")
+    entry = HammingKernelAuto();
+  else if (HammingKernelSupported(name))
+    entry = HammingKernelFromName(name);
+  else
+    return false;
+  __sync_synchronize();
+  hammingKernel_g = entry;
+  return true;
+}
+
+//============================================================
+// Brute-force matcher
+//
+
+// train descriptors are processed by blocks that fit in L2 cache
+static const long HAMMING_TRAIN_BLOCK = 2048;
+
+class HammingBestBody : public ParallelLoopBody {
+public:
+  HammingBestBody(const unsigned char* descs1, long stride1,
+		  const unsigned char* descs2, long n2, long stride2,
+		  size_t nBytes, long* bestIdx, unsigned int* bestDist)
+    :descs1(descs1), stride1(stride1), descs2(descs2), n2(n2), stride2(stride2),
+     nBytes(nBytes), bestIdx(bestIdx), bestDist(bestDist) {};
+  virtual void operator()(const Range & range) const {
+    HammingRowKernel kernel = GetHammingKernel();
+    vector<unsigned int> dists(min(n2, HAMMING_TRAIN_BLOCK));
+    for (long i = range.start; i < range.end; ++i) {
+      bestIdx[i] = -1;
+      bestDist[i] = UINT_MAX;
+    }
+    for (long j0 = 0; j0 < n2; j0 += HAMMING_TRAIN_BLOCK) {
+      const long nj = min(n2 - j0, HAMMING_TRAIN_BLOCK);
+      for (long i = range.start; i < range.end; ++i) {
+	kernel(descs1 + i*stride1, descs2 + j0*stride2, stride2, nj, nBytes, &(dists[0]));
+	long bestj = bestIdx[i];
+	unsigned int bestd = bestDist[i];
+	for (long j = 0; j < nj; ++j)
+	  if (dists[j] < bestd) {
+	    bestd = dists[j];
+	    bestj = j0 + j;
+	  }
+	bestIdx[i] = bestj;
+	bestDist[i] = bestd;
+      }
+    }
+  }
+private:
+  const unsigned char* descs1;
+  long stride1;
+  const unsigned char* descs2;
+  long n2, stride2;
+  size_t nBytes;
+  long* bestIdx;
+  unsigned int* bestDist;
+};
+
+void MatchHammingBest(const unsigned char* descs1, long n1, long stride1,
+		      const unsigned char* descs2, long n2, long stride2,
+		      size_t nBytes, long* bestIdx, unsigned int* bestDist) {
+  if (n1 == 0)
+    return;
+  parallel_for_(Range(0, n1), HammingBestBody(descs1, stride1, descs2, n2, stride2,
+					      nBytes, bestIdx, bestDist),
+		ParallelStripes(n1, 16));
+}
+
+//============================================================
+// k-NN matcher
+//
+
+typedef pair<unsigned int, long> HammingCandidate; // (distance, index)
+
+// reverse best match of a train descriptor, packed as (distance << 32 | query)
+// so that an atomic min keeps the closest query (smallest index on ties)
+static inline void AtomicMinPacked(unsigned long long* p, unsigned long long v) {
+  unsigned long long cur = *p;
+  while (v < cur) {
+    unsigned long long prev = __sync_val_compare_and_swap(p, cur, v);
+    if (prev == cur)
+      break;
+    cur = prev;
+  }
+}
+
+class HammingKnnBody : public ParallelLoopBody {
+public:
+  HammingKnnBody(const unsigned char* descs1, long stride1,
+		 const unsigned char* descs2, long n2, long stride2,
+		 size_t nBytes, int k, long* knnIdx, unsigned int* knnDist,
+		 unsigned long long* reverseBest)
+    :descs1(descs1), stride1(stride1), descs2(descs2), n2(n2), stride2(stride2),
+     nBytes(nBytes), k(k), knnIdx(knnIdx), knnDist(knnDist),
+     reverseBest(reverseBest) {};
+  virtual void operator()(const Range & range) const {
+    HammingRowKernel kernel = GetHammingKernel();
+    vector<unsigned int> dists(min(n2, HAMMING_TRAIN_BLOCK));
+    const long nQueries = range.end - range.start;
+    // one max-heap of size <= k per query
+    vector<HammingCandidate> heaps(nQueries * k);
+    vector<int> heapSizes(nQueries, 0);
+    for (long j0 = 0; j0 < n2; j0 += HAMMING_TRAIN_BLOCK) {
+      const long nj = min(n2 - j0, HAMMING_TRAIN_BLOCK);
+      for (long i = range.start; i < range.end; ++i) {
+	kernel(descs1 + i*stride1, descs2 + j0*stride2, stride2, nj, nBytes, &(dists[0]));
+	HammingCandidate* heap = &(heaps[(i-range.start)*k]);
+	int & heapSize = heapSizes[i-range.start];
+	for (long j = 0; j < nj; ++j) {
+	  const HammingCandidate c(dists[j], j0 + j);
+	  if (heapSize < k) {
+	    heap[heapSize++] = c;
+	    push_heap(heap, heap + heapSize);
+	  } else if (c < heap[0]) {
+	    pop_heap(heap, heap + k);
+	    heap[k-1] = c;
+	    push_heap(heap, heap + k);
+	  }
+	  if (reverseBest != NULL)
+	    AtomicMinPacked(reverseBest + j0 + j,
+			    ((unsigned long long)dists[j] << 32) | (unsigned long long)i);
+	}
+      }
+    }
+    for (long i = range.start; i < range.end; ++i) {
+      HammingCandidate* heap = &(heaps[(i-range.start)*k]);
+      const int heapSize = heapSizes[i-range.start];
+      sort_heap(heap, heap + heapSize);
+      for (int l = 0; l < k; ++l) {
+	knnIdx [i*k+l] = (l < heapSize) ? heap[l].second : -1;
+	knnDist[i*k+l] = (l < heapSize) ? heap[l].first  : UINT_MAX;
+      }
+    }
+  }
+private:
+  const unsigned char* descs1;
+  long stride1;
+  const unsigned char* descs2;
+  long n2, stride2;
+  size_t nBytes;
+  int k;
+  long* knnIdx;
+  unsigned int* knnDist;
+  unsigned long long* reverseBest;
+};
+
+long MatchHammingKnn(const unsigned char* descs1, long n1, long stride1,
+		     const unsigned char* descs2, long n2, long stride2,
+		     size_t nBytes, int k, float ratio, bool crossCheck,
+		     long* knnIdx, unsigned int* knnDist, unsigned char* flags) {
+  if (n1 == 0)
+    return 0;
+  THassert(k >= 1);
+  vector<unsigned long long> reverseBest(crossCheck ? n2 : 0, ULLONG_MAX);
+  parallel_for_(Range(0, n1),
+		HammingKnnBody(descs1, stride1, descs2, n2, stride2, nBytes, k,
+			       knnIdx, knnDist,
+			       (crossCheck && n2 > 0) ? &(reverseBest[0]) : NULL),
+		ParallelStripes(n1, 16));
+  long nAccepted = 0;
+  for (long i = 0; i < n1; ++i) {
+    const long best = knnIdx[i*k];
+    bool accepted = (best >= 0);
+    if (accepted && (ratio > 0.f) && (k >= 2) && (knnIdx[i*k+1] >= 0))
+      accepted = ((float)knnDist[i*k] < ratio * (float)knnDist[i*k+1]);
+    if (accepted && crossCheck)
+      accepted = ((long)(reverseBest[best] & 0xffffffffULL) == i);
+    flags[i] = accepted ? 1 : 0;
+    if (accepted)
+      ++nAccepted;
+  }
+  return nAccepted;
+}
+
+//============================================================
+// Guided matcher
+//
+
+// at most that many grid cells (they grow on sparse, spread out positions)
+static const long HAMMING_GRID_MAX_CELLS = 1 << 20;
+
+// The train descriptors and positions sorted by cell (row-major), so that
+// the cells of a row of the search window are consecutive rows.
+class HammingGrid {
+public:
+  HammingGrid(const unsigned char* descs2, long n, long stride, const float* pos,
+	      long posStride, size_t nBytes, float radius)
+    :nBytes(nBytes), index(n), xs(n), ys(n), descs(n * nBytes) {
+    float xmin = pos[0], ymin = pos[1], xmax = pos[0], ymax = pos[1];
+    for (long j = 1; j < n; ++j) {
+      xmin = min(xmin, pos[j*posStride]);
+      xmax = max(xmax, pos[j*posStride]);
+      ymin = min(ymin, pos[j*posStride+1]);
+      ymax = max(ymax, pos[j*posStride+1]);
+    }
+    x0 = xmin;
+    y0 = ymin;
+    cellSize = max(radius, 1.f);
+    while (((long)((xmax-xmin)/cellSize) + 1) * ((long)((ymax-ymin)/cellSize) + 1) >
+	   HAMMING_GRID_MAX_CELLS)
+      cellSize *= 2;
+    cols = (int)((xmax-xmin)/cellSize) + 1;
+    rows = (int)((ymax-ymin)/cellSize) + 1;
+
+    // counting sort by cell
+    vector<int> cells(n);
+    cellStart.assign(rows*cols + 1, 0);
+    for (long j = 0; j < n; ++j) {
+      cells[j] = cellRow(pos[j*posStride+1]) * cols + cellCol(pos[j*posStride]);
+      ++cellStart[cells[j] + 1];
+    }
+    for (int c = 0; c < rows*cols; ++c)
+      cellStart[c+1] += cellStart[c];
+    vector<long> next(cellStart.begin(), cellStart.end() - 1);
+    for (long j = 0; j < n; ++j) {
+      const long k = next[cells[j]]++;
+      index[k] = j;
+      xs[k] = pos[j*posStride];
+      ys[k] = pos[j*posStride+1];
+      memcpy(&(descs[k*nBytes]), descs2 + j*stride, nBytes);
+    }
+  };
+  // clamped to the grid
+  inline int cellCol(float x) const {
+    return max(0, min(cols-1, (int)floor((x - x0) / cellSize)));
+  };
+  inline int cellRow(float y) const {
+    return max(0, min(rows-1, (int)floor((y - y0) / cellSize)));
+  };
+  size_t nBytes;
+  float x0, y0, cellSize;
+  int cols, rows;
+  vector<long> cellStart;
+  vector<long> index;   // original index of the sorted rows
+  vector<float> xs, ys;
+  vector<unsigned char> descs;
+};
+
+class HammingGuidedBody : public ParallelLoopBody {
+public:
+  HammingGuidedBody(const unsigned char* descs1, long stride1, const float* pos1,
+		    long posStride1, const HammingGrid & grid, const double* H,
+		    float radius, long* bestIdx, unsigned int* bestDist)
+    :descs1(descs1), stride1(stride1), pos1(pos1), posStride1(posStride1), grid(grid),
+     H(H), radius(radius), bestIdx(bestIdx), bestDist(bestDist) {};
+  virtual void operator()(const Range & range) const {
+    HammingRowKernel kernel = GetHammingKernel();
+    const size_t nBytes = grid.nBytes;
+    const float r2 = radius * radius;
+    vector<unsigned int> dists;
+    for (long i = range.start; i < range.end; ++i) {
+      long bestj = -1;
+      unsigned int bestd = UINT_MAX;
+      // predicted position in the second image
+      const double x = pos1[i*posStride1], y = pos1[i*posStride1+1];
+      const double w = H[6]*x + H[7]*y + H[8];
+      if (fabs(w) > 1e-12) {
+	const float px = (float)((H[0]*x + H[1]*y + H[2]) / w);
+	const float py = (float)((H[3]*x + H[4]*y + H[5]) / w);
+	if ((px + radius >= grid.x0) && (py + radius >= grid.y0) &&
+	    (px - radius <= grid.x0 + grid.cols*grid.cellSize) &&
+	    (py - radius <= grid.y0 + grid.rows*grid.cellSize)) {
+	  const int cx0 = grid.cellCol(px - radius), cx1 = grid.cellCol(px + radius);
+	  const int cy0 = grid.cellRow(py - radius), cy1 = grid.cellRow(py + radius);
+	  for (int cy = cy0; cy <= cy1; ++cy) {
+	    const long k0 = grid.cellStart[cy*grid.cols + cx0];
+	    const long k1 = grid.cellStart[cy*grid.cols + cx1 + 1];
+	    if (k1 == k0)
+	      continue;
+	    if ((long)dists.size() < k1 - k0)
+	      dists.resize(k1 - k0);
+	    kernel(descs1 + i*stride1, &(grid.descs[k0*nBytes]), nBytes, k1 - k0, nBytes,
+		   &(dists[0]));
+	    for (long k = k0; k < k1; ++k) {
+	      const float dx = grid.xs[k] - px, dy = grid.ys[k] - py;
+	      if (dx*dx + dy*dy > r2)
+		continue;
+	      const unsigned int d = dists[k - k0];
+	      // (smallest index on ties, as the brute-force matcher)
+	      if ((d < bestd) || ((d == bestd) && (grid.index[k] < bestj))) {
+		bestd = d;
+		bestj = grid.index[k];
+	      }
+	    }
+	  }
+	}
+      }
+      bestIdx[i] = bestj;
+      bestDist[i] = bestd;
+    }
+  }
+private:
+  const unsigned char* descs1;
+  long stride1;
+  const float* pos1;
+  long posStride1;
+  const HammingGrid & grid;
+  const double* H;
+  float radius;
+  long* bestIdx;
+  unsigned int* bestDist;
+};
+
+void MatchHammingGuided(const unsigned char* descs1, long n1, long stride1,
+			const float* pos1, long posStride1,
+			const unsigned char* descs2, long n2, long stride2,
+			const float* pos2, long posStride2,
+			size_t nBytes, const double* H, float radius,
+			long* bestIdx, unsigned int* bestDist) {
+  if (n1 == 0)
+    return;
+  if (n2 == 0) {
+    for (long i = 0; i < n1; ++i) {
+      bestIdx[i] = -1;
+      bestDist[i] = UINT_MAX;
+    }
+    return;
+  }
+  const HammingGrid grid(descs2, n2, stride2, pos2, posStride2, nBytes, radius);
+  parallel_for_(Range(0, n1), HammingGuidedBody(descs1, stride1, pos1, posStride1, grid,
+						H, radius, bestIdx, bestDist),
+		ParallelStripes(n1, 64));
+}
@@ -0,0 +1,78 @@
+#ifndef __MATCHING_HPP__
+#define __MATCHING_HPP__
+
+#include<cstddef>
+#include<string>
+
+//============================================================
+// Hamming distance kernels
+//
+// A row kernel computes the Hamming distances between one query descriptor
+// and nTrain consecutive train descriptors (rows spaced by trainStride bytes).
+// nBytes must be a multiple of 8 (FREAK descriptors are 64 bytes long).
+// The fastest kernel supported by the CPU is picked at the first call.
+//
+
+typedef void (*HammingRowKernel)(const unsigned char* query,
+				 const unsigned char* train, long trainStride,
+				 long nTrain, size_t nBytes, unsigned int* dists);
+
+HammingRowKernel GetHammingKernel();
+std::string GetHammingKernelName();
+// name is one of "auto", "scalar", "popcnt", "avx2", "avx512".
+// Returns false if the kernel is unknown or not supported by this CPU.
+bool SetHammingKernel(const std::string & name);
+
+//============================================================
+// Brute-force matcher
+//
+// For each of the n1 descriptors of descs1, finds the closest descriptor
+// of descs2 (smallest index on ties). Query rows are split across threads
+// (cv::parallel_for_, cf. cv::setNumThreads).
+// bestIdx is set to -1 if descs2 is empty.
+//
+
+void MatchHammingBest(const unsigned char* descs1, long n1, long stride1,
+		      const unsigned char* descs2, long n2, long stride2,
+		      size_t nBytes, long* bestIdx, unsigned int* bestDist);
+
+//============================================================
+// k-NN matcher
+//
+// For each descriptor of descs1, keeps the k closest descriptors of descs2
+// in a fixed-size heap. knnIdx and knnDist are n1 x k row-major arrays, sorted
+// by increasing distance and padded with -1 / UINT_MAX.
+// flags[i] is 1 if the match (i, knnIdx[i*k]) is accepted, that is :
+//  - it passes the ratio test dist1 < ratio * dist2 (ratio <= 0 disables it,
+//    as well as k == 1 or a single candidate),
+//  - if crossCheck, i is also the best match of knnIdx[i*k] in descs1.
+// The cross-check is computed in the same pass as the k-NN search.
+// Returns the number of accepted matches.
+//
+
+long MatchHammingKnn(const unsigned char* descs1, long n1, long stride1,
+		     const unsigned char* descs2, long n2, long stride2,
+		     size_t nBytes, int k, float ratio, bool crossCheck,
+		     long* knnIdx, unsigned int* knnDist, unsigned char* flags);
+
+//============================================================
+// Guided matcher
+//
+// Same as MatchHammingBest, among the descriptors of descs2 whose position
+// is within radius of the predicted position of the query : H * pos1[i]
+// (H is a 3x3 row-major homography, the identity plus an offset for a
+// translation). The positions are the first two columns (x, y) of pos1 and
+// pos2, rows spaced by posStride floats. descs2 is bucketed in a grid of
+// radius wide cells, so that only the cells around the prediction are
+// scanned : the cost is linear in n1 + n2 for a bounded density of
+// keypoints. bestIdx is set to -1 if there is no candidate.
+//
+
+void MatchHammingGuided(const unsigned char* descs1, long n1, long stride1,
+			const float* pos1, long posStride1,
+			const unsigned char* descs2, long n2, long stride2,
+			const float* pos2, long posStride2,
+			size_t nBytes, const double* H, float radius,
+			long* bestIdx, unsigned int* bestDist);
+
+#endif
@@ -7,18 +7,339 @@ extern "C" {
 
 #include<opencv/cv.h>
 #include<opencv/cvaux.h>
+#include "opencv2/nonfree/features2d.hpp"
 #include "common.hpp"
+#include "matching.hpp"
+#include "lsh.hpp"
+#include "flow.hpp"
+#include "tracker.hpp"
+#include "threadpool.hpp"
+#include "harris.hpp"
+#include "blockflow.hpp"
+#include "store.hpp"
+#include "frame.hpp"
+#include "registry.hpp"
+#include "async.hpp"
+#include "freaktrain.hpp"
+#include "keypoints.hpp"
+#include "geometry.hpp"
+#include "videosource.hpp"
 
 using namespace TH;
 
+//============================================================
+// Batches
+//
+
+// Checks, in the lua thread, that an image can be converted by the workers
+// (TensorToMatGray would call THerror otherwise)
+static void CheckImageTensor(const Tensor<ubyte> & im) {
+  if (!((im.nDimension() == 2) ||
+	((im.nDimension() == 3) && ((im.size(0) == 3) || (im.size(2) == 3)))))
+    THerror("image tensors must be HxW, 3xHxW or HxWx3");
+}
+
+// Task of a batch binding : run() computes in a worker and keeps its
+// results, output() writes them in the output tensors from the lua thread
+// (the workers never call the TH allocator)
+class BatchTask : public ThreadPool::Task {
+public:
+  virtual void output() {};
+};
+
+// Runs the tasks on the worker pool and, if none failed, writes their
+// outputs. Then deletes them and returns the first error, if any (raised by
+// the caller once it has released its objects, cf. registry.hpp).
+static string RunBatchTasks(vector<BatchTask*> & tasks) {
+  vector<ThreadPool::Task*> poolTasks(tasks.begin(), tasks.end());
+  RunOnThreadPool(poolTasks);
+  string error;
+  for (size_t i = 0; (i < tasks.size()) && error.empty(); ++i)
+    error = tasks[i]->error();
+  if (error.empty())
+    for (size_t i = 0; i < tasks.size(); ++i)
+      tasks[i]->output();
+  for (size_t i = 0; i < tasks.size(); ++i)
+    delete tasks[i];
+  tasks.clear();
+  return error;
+}
+
+//============================================================
+// Futures (cf. async.hpp)
+//
+
+// (future) : true if the task is done
+static int FutureReady(lua_State* L) {
+  setLuaState(L);
+  int iFuture = FromLuaStack<int>(1);
+  Ptr<Future> future = futures_g.get(iFuture);
+  lua_pushboolean(L, future->done());
+  return 1;
+}
+
+// (future) : waits for the task, raises its error or collects its outputs,
+// and releases the future
+static int FutureWait(lua_State* L) {
+  STATS_SCOPE("FutureWait");
+  setLuaState(L);
+  int iFuture = FromLuaStack<int>(1);
+  Ptr<Future> future = futures_g.get(iFuture);
+  future->wait();
+  futures_g.remove(iFuture);
+  if (!future->error().empty()) {
+    string error = future->error();
+    future.release(); // (THerror does not return)
+    THerror(error);
+  }
+  future->collect();
+  return 0;
+}
+
+//============================================================
+// Frames (cf. frame.hpp)
+//
+
+// (im) : converts im to gray once, returns a handle usable in place of im
+static int CreateFrame(lua_State* L) {
+  STATS_SCOPE("CreateFrame");
+  setLuaState(L);
+  SCRATCH_SCOPE();
+  THassert(FrameFromLuaStack(L, 1).empty());
+  PushOnLuaStack<int>(frames_g.add(new Frame(GrayFromLuaStack(L, 1))));
+  return 1;
+}
+
+static int DeleteFrame(lua_State* L) {
+  setLuaState(L);
+  int iFrame = FromLuaStack<int>(1);
+  frames_g.remove(iFrame);
+  return 0;
+}
+
+// (frame) : height, width
+static int FrameSize(lua_State* L) {
+  setLuaState(L);
+  Ptr<Frame> frame = FrameFromLuaStack(L, 1);
+  THassert(!frame.empty());
+  const matb & gray = frame->gray();
+  PushOnLuaStack<int>(gray.rows);
+  PushOnLuaStack<int>(gray.cols);
+  return 2;
+}
+
+//============================================================
+// Video sources (cf. videosource.hpp)
+//
+
+HandleRegistry<VideoSource> videoSources_g("VideoSource");
+
+// (path) : handle, height, width, fps, nFrames, after decoding the first
+// frame. The decoder is started by VideoSourceStart.
+static int OpenVideoSource(lua_State* L) {
+  STATS_SCOPE("OpenVideoSource");
+  setLuaState(L);
+  string path = FromLuaStack<string>(1);
+  Ptr<VideoSource> source = new VideoSource();
+  if (!source->open(path)) {
+    source.release(); // (THerror does not return)
+    THerror("OpenVideoSource: cannot read " + path);
+  }
+  PushOnLuaStack<int>(videoSources_g.add(source));
+  PushOnLuaStack<int>(source->height());
+  PushOnLuaStack<int>(source->width());
+  PushOnLuaStack<double>(source->fps());
+  PushOnLuaStack<long>(source->nFrames());
+  return 5;
+}
+
+// (source, slots) : slots is a table of HxWx3 ByteTensors, which must not be
+// resized afterwards
+static int VideoSourceStart(lua_State* L) {
+  setLuaState(L);
+  int iSource = FromLuaStack<int>(1);
+  vector<Tensor<ubyte> > slots = FromLuaStack<vector<Tensor<ubyte> > >(2);
+  THassert(slots.size() >= 2);
+  for (size_t i = 0; i < slots.size(); ++i)
+    THassert((slots[i].nDimension() == 3) && (slots[i].size(2) == 3) &&
+	     slots[i].isContiguous());
+  Ptr<VideoSource> source = videoSources_g.get(iSource);
+  bool ok = !source->started();
+  for (size_t i = 0; i < slots.size(); ++i)
+    ok = ok && (slots[i].size(0) == source->height()) && (slots[i].size(1) == source->width());
+  if (!ok) {
+    source.release(); // (THerror does not return)
+    THerror("VideoSourceStart: already started, or slots not of the size of the video");
+  }
+  for (size_t i = 0; i < slots.size(); ++i)
+    slots[i] = PinTensor(slots[i]);
+  source->start(slots);
+  return 0;
+}
+
+// (source) : 0-based slot and frame number of the next frame, nil at the end
+// of the video. The slot of the previous frame is given back to the decoder.
+static int VideoSourceNext(lua_State* L) {
+  STATS_SCOPE("VideoSourceNext");
+  setLuaState(L);
+  int iSource = FromLuaStack<int>(1);
+  Ptr<VideoSource> source = videoSources_g.get(iSource);
+  if (!source->started()) {
+    source.release(); // (THerror does not return)
+    THerror("VideoSourceNext: the source is not started");
+  }
+  long iFrame = 0;
+  const int slot = source->next(iFrame);
+  if (slot < 0) {
+    const string error = source->error();
+    source.release(); // (THerror does not return)
+    if (!error.empty())
+      THerror(error);
+    return 0;
+  }
+  PushOnLuaStack<int>(slot);
+  PushOnLuaStack<long>(iFrame);
+  return 2;
+}
+
+// stops the decoder and releases the slots
+static int CloseVideoSource(lua_State* L) {
+  setLuaState(L);
+  int iSource = FromLuaStack<int>(1);
+  videoSources_g.remove(iSource);
+  return 0;
+}
+
+//============================================================
+// Image decoding
+//
+
+// Decodes a file (path) or an encoded ByteTensor : HxWx3 BGR, or HxW if
+// gray. If the size is given, the image is resized directly into dst (a
+// view of the output tensor, sized by the lua thread), otherwise it is kept
+// in decoded, to be copied by the lua thread, which resizes the output (the
+// workers do not call the TH allocator).
+class DecodeImageTask : public ThreadPool::Task {
+public:
+  DecodeImageTask(const string & path, const Tensor<ubyte> & encoded, const Mat & dst,
+		  bool gray)
+    :path(path), encoded(encoded), dst(dst), gray(gray) {};
+  virtual void run() {
+    STATS_START(kernel, "DecodeImages.kernel");
+    const int flags = gray ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR;
+    if (path.empty())
+      decoded = imdecode(Mat(1, encoded.size(0), CV_8U, (void*)encoded.data()), flags);
+    else
+      decoded = imread(path, flags);
+    if (decoded.empty())
+      THerror("DecodeImages: cannot decode " + (path.empty() ? string("a tensor") : path));
+    if (!dst.empty()) {
+      if (dst.size() == decoded.size())
+	decoded.copyTo(dst);
+      else
+	resize(decoded, dst, dst.size(), 0, 0,
+	       (dst.size().area() < decoded.size().area()) ? INTER_AREA : INTER_LINEAR);
+      decoded.release();
+    }
+    STATS_STOP(kernel);
+  }
+  // empty if it was written in dst
+  Mat decoded;
+private:
+  string path;
+  Tensor<ubyte> encoded;
+  Mat dst;
+  bool gray;
+};
+
+class CopyDecodedBody : public ParallelLoopBody {
+public:
+  CopyDecodedBody(const vector<DecodeImageTask*> & tasks, vector<Mat> & dsts)
+    :tasks(tasks), dsts(dsts) {};
+  virtual void operator()(const Range & range) const {
+    for (int i = range.start; i < range.end; ++i)
+      if (!tasks[i]->decoded.empty())
+	tasks[i]->decoded.copyTo(dsts[i]);
+  }
+private:
+  const vector<DecodeImageTask*> & tasks;
+  vector<Mat> & dsts;
+};
+
+// (sources, outputs, gray, width, height) : sources is a table of paths or
+// ByteTensors holding encoded images (jpeg, png...), decoded in parallel by
+// the worker pool into the ByteTensors of outputs (cf. DecodeImageTask).
+// They are resized to width x height unless these are 0.
+static int DecodeImages(lua_State* L) {
+  STATS_SCOPE("DecodeImages");
+  setLuaState(L);
+  vector<Tensor<ubyte> > outputs = FromLuaStack<vector<Tensor<ubyte> > >(2);
+  bool                   gray    = FromLuaStack<bool>(3);
+  int                    width   = FromLuaStack<int>(4);
+  int                    height  = FromLuaStack<int>(5);
+
+  const int n = luaL_getn(L, 1);
+  THassert((int)outputs.size() == n);
+  THassert((width >= 0) && (height >= 0) && ((width == 0) == (height == 0)));
+  vector<string> paths(n);
+  vector<Tensor<ubyte> > encoded(n);
+  for (int i = 0; i < n; ++i) {
+    lua_rawgeti(L, 1, i+1);
+    if (lua_type(L, -1) == LUA_TSTRING) {
+      paths[i] = FromLuaStack<string>(L, -1);
+      THassert(!paths[i].empty());
+    } else {
+      encoded[i] = FromLuaStack<Tensor<ubyte> >(L, -1);
+      THassert((encoded[i].nDimension() == 1) && encoded[i].isContiguous());
+    }
+    lua_pop(L, 1); // the table keeps a reference
+    THassert(outputs[i].isContiguous());
+  }
+
+  // the outputs are sized here when their size is known
+  vector<Mat> dsts(n);
+  if (width > 0)
+    for (int i = 0; i < n; ++i) {
+      if (gray)
+	outputs[i].resize(height, width);
+      else
+	outputs[i].resize(height, width, 3);
+      dsts[i] = TensorToMat(outputs[i]);
+    }
+  vector<DecodeImageTask*> decodeTasks;
+  for (int i = 0; i < n; ++i)
+    decodeTasks.push_back(new DecodeImageTask(paths[i], encoded[i], dsts[i], gray));
+  vector<ThreadPool::Task*> tasks(decodeTasks.begin(), decodeTasks.end());
+  RunOnThreadPool(tasks);
+  string error;
+  for (int i = 0; (i < n) && error.empty(); ++i)
+    error = tasks[i]->error();
+  if (error.empty() && (width == 0)) {
+    for (int i = 0; i < n; ++i) {
+      const Mat & decoded = decodeTasks[i]->decoded;
+      if (gray)
+	outputs[i].resize(decoded.rows, decoded.cols);
+      else
+	outputs[i].resize(decoded.rows, decoded.cols, 3);
+      dsts[i] = TensorToMat(outputs[i]);
+    }
+    parallel_for_(Range(0, n), CopyDecodedBody(decodeTasks, dsts), ParallelStripes(n));
+  }
+  for (int i = 0; i < n; ++i)
+    delete tasks[i];
+  if (!error.empty())
+    THerror(error);
+  return 0;
+}
+
 //============================================================
 // Tracking
 //
 
 static int TrackPoints(lua_State* L) {
+  STATS_SCOPE("TrackPoints");
   setLuaState(L);
-  Tensor<ubyte> im1          = FromLuaStack<Tensor<ubyte> >(1);
-  Tensor<ubyte> im2          = FromLuaStack<Tensor<ubyte> >(2);
+  SCRATCH_SCOPE();
   Tensor<float> corresps     = FromLuaStack<Tensor<float> >(3);
   size_t        maxCorners   = FromLuaStack<size_t>        (4);
   float         qualityLevel = FromLuaStack<float>         (5);
@@ -28,29 +349,40 @@ static int TrackPoints(lua_State* L) {
   int           maxLevel     = FromLuaStack<int>           (9);
   bool          useHarris    = FromLuaStack<bool>          (10);
   
-  Mat im1_cv, im2_cv, im1_cv_gray;
-  if (im1.nDimension() == 3) { //color images
-    im1_cv = TensorToMat3b(im1);
-    im2_cv = TensorToMat3b(im2);
-    cvtColor(im1_cv, im1_cv_gray, CV_BGR2GRAY);
-  } else {
-    im1_cv = TensorToMat(im1);
-    im2_cv = TensorToMat(im2);
-    im1_cv_gray = im1_cv;
-  }
+  // (LK tracks on the gray images, or on the pyramids cached by frames)
+  Ptr<Frame> frame1 = FrameFromLuaStack(L, 1);
+  Ptr<Frame> frame2 = FrameFromLuaStack(L, 2);
+  STATS_START(convert, "TrackPoints.convert");
+  matb im1_cv_gray = GrayFromLuaStack(L, 1);
+  matb im2_cv_gray = GrayFromLuaStack(L, 2);
   matf corresps_cv = TensorToMat(corresps);
+  STATS_STOP(convert);
 
+  STATS_START(kernel, "TrackPoints.kernel");
   const Size winSize2(winSize, winSize);
   const TermCriteria criteria = TermCriteria(TermCriteria::COUNT+TermCriteria::EPS, 100, 0.1);
-  vector<Point2f> points1, points2;
-  vector<ubyte> status;
-  vector<float> err;
+  ScratchVector<Point2f> scratch1, scratch2;
+  ScratchVector<ubyte> scratchStatus;
+  ScratchVector<float> scratchErr;
+  vector<Point2f> & points1 = *scratch1, & points2 = *scratch2;
+  vector<ubyte> & status = *scratchStatus;
+  vector<float> & err = *scratchErr;
   Mat mask;
   goodFeaturesToTrack(im1_cv_gray, points1, maxCorners, qualityLevel, minDistance,
 		      mask, blockSize, useHarris, 0.04f);
-  calcOpticalFlowPyrLK(im1_cv, im2_cv, points1, points2, status, err, winSize2,
-		       maxLevel, criteria, 0, 0);
+  if (!frame1.empty() && !frame2.empty()) {
+    vector<Mat> pyr1, pyr2;
+    const int levels1 = frame1->lkPyramid(winSize2, maxLevel, pyr1);
+    const int levels2 = frame2->lkPyramid(winSize2, maxLevel, pyr2);
+    calcOpticalFlowPyrLK(pyr1, pyr2, points1, points2, status, err, winSize2,
+			 min(levels1, levels2), criteria, 0, 0);
+  } else {
+    calcOpticalFlowPyrLK(im1_cv_gray, im2_cv_gray, points1, points2, status, err, winSize2,
+			 maxLevel, criteria, 0, 0);
+  }
+  STATS_STOP(kernel);
 
+  STATS_SCOPE("TrackPoints.output");
   size_t i, iCorresps = 0;
   for (i = 0; i < points2.size(); ++i)
     if (status[i]) {
@@ -65,6 +397,173 @@ static int TrackPoints(lua_State* L) {
   return 0;
 }
 
+// Streaming tracker (cf. LKTracker)
+HandleRegistry<LKTracker> trackersLK_g("LKTracker");
+
+static int CreateTrackerLK(lua_State* L) {
+  setLuaState(L);
+  size_t maxCorners   = FromLuaStack<size_t>(1);
+  float  qualityLevel = FromLuaStack<float >(2);
+  float  minDistance  = FromLuaStack<float >(3);
+  int    blockSize    = FromLuaStack<int   >(4);
+  int    winSize      = FromLuaStack<int   >(5);
+  int    maxLevel     = FromLuaStack<int   >(6);
+  bool   useHarris    = FromLuaStack<bool  >(7);
+  size_t minTracked   = FromLuaStack<size_t>(8);
+
+  PushOnLuaStack<int>(trackersLK_g.add(new LKTracker(maxCorners, qualityLevel, minDistance,
+						      blockSize, useHarris, winSize, maxLevel,
+						      minTracked)));
+  return 1;
+}
+
+static int DeleteTrackerLK(lua_State* L) {
+  setLuaState(L);
+  int iTracker = FromLuaStack<int>(1);
+  trackersLK_g.remove(iTracker);
+  return 0;
+}
+
+// Pushes a frame, fills corresps (Nx4 : x1, y1, x2, y2) with the points
+// tracked from the previous frame and returns N
+static int TrackerLKPush(lua_State* L) {
+  STATS_SCOPE("TrackerLKPush");
+  setLuaState(L);
+  SCRATCH_SCOPE();
+  int           iTracker = FromLuaStack<int>(1);
+  Tensor<float> corresps = FromLuaStack<Tensor<float> >(3);
+
+  Ptr<Frame> frame = FrameFromLuaStack(L, 2);
+  matb im_cv_gray;
+  if (frame.empty()) {
+    STATS_START(convert, "TrackerLKPush.convert");
+    im_cv_gray = GrayFromLuaStack(L, 2);
+    STATS_STOP(convert);
+  }
+  Ptr<LKTracker> trackerPtr = trackersLK_g.tryGet(iTracker);
+  if (trackerPtr.empty()) {
+    frame.release();
+    trackersLK_g.get(iTracker); // (raises the error)
+  }
+  LKTracker & tracker = *trackerPtr;
+  ScratchVector<Point2f> scratch1, scratch2;
+  vector<Point2f> & points1 = *scratch1, & points2 = *scratch2;
+  if (!frame.empty()) {
+    STATS_START(kernel, "TrackerLKPush.kernel");
+    tracker.push(*frame, points1, points2);
+    STATS_STOP(kernel);
+  } else {
+    STATS_START(kernel, "TrackerLKPush.kernel");
+    tracker.push(im_cv_gray, points1, points2);
+    STATS_STOP(kernel);
+  }
+
+  STATS_SCOPE("TrackerLKPush.output");
+  corresps.resize(max<size_t>(points1.size(), 1), 4);
+  for (size_t i = 0; i < points1.size(); ++i) {
+    corresps(i, 0) = points1[i].x;
+    corresps(i, 1) = points1[i].y;
+    corresps(i, 2) = points2[i].x;
+    corresps(i, 3) = points2[i].y;
+  }
+  PushOnLuaStack<int>(points1.size());
+  return 1;
+}
+
+//============================================================
+// Geometric verification (cf. geometry.hpp)
+
+// (corresps, scores, model, threshold, confidence, maxIters, seed, M, inliers) :
+// corresps is Nx4 (x1, y1, x2, y2), scores is empty or N (lower is better,
+// for the PROSAC ordering). M is resized to 3x3 and inliers to N. Returns
+// the number of inliers, 0 if no model was found (M is then zero).
+static int FindGeometry(lua_State* L) {
+  STATS_SCOPE("FindGeometry");
+  setLuaState(L);
+  Tensor<float > corresps = FromLuaStack<Tensor<float > >(1);
+  Tensor<float > scores   = FromLuaStack<Tensor<float > >(2);
+  GeometryParams params;
+  params.model            = (GeometryModel)FromLuaStack<int>(3);
+  params.threshold        = FromLuaStack<double>(4);
+  params.confidence       = FromLuaStack<double>(5);
+  params.maxIters         = FromLuaStack<int>(6);
+  params.seed             = FromLuaStack<int>(7);
+  Tensor<double> M        = FromLuaStack<Tensor<double> >(8);
+  Tensor<ubyte > inliers  = FromLuaStack<Tensor<ubyte > >(9);
+
+  const long n = (corresps.nDimension() == 2) ? corresps.size(0) : 0;
+  THassert((n == 0) || (corresps.size(1) >= 4));
+  THassert((scores.nDimension() == 0) ||
+	   ((scores.nDimension() == 1) && (scores.size(0) == n)));
+  THassert((params.model >= GEOMETRY_HOMOGRAPHY) && (params.model <= GEOMETRY_FUNDAMENTAL));
+  THassert((params.threshold > 0.) && (params.maxIters > 0));
+  THassert((params.confidence > 0.) && (params.confidence < 1.));
+  if (scores.nDimension() != 0)
+    scores = scores.newContiguous();
+
+  STATS_START(kernel, "FindGeometry.kernel");
+  vector<Point2f> x1(n), x2(n);
+  for (long i = 0; i < n; ++i) {
+    x1[i] = Point2f(corresps(i, 0), corresps(i, 1));
+    x2[i] = Point2f(corresps(i, 2), corresps(i, 3));
+  }
+  matd model;
+  vector<ubyte> mask;
+  const long nInliers = EstimateGeometry(x1, x2, (scores.nDimension() != 0) ? scores.data() : NULL,
+					 params, model, mask);
+  STATS_STOP(kernel);
+
+  M.resize(3, 3);
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      M(i, j) = (nInliers > 0) ? model(i, j) : 0.;
+  inliers.resize(max(n, 1L));
+  for (long i = 0; i < n; ++i)
+    inliers(i) = mask[i];
+  PushOnLuaStack<int>(nInliers);
+  return 1;
+}
+
+//============================================================
+// Harris corners
+//
+
+// (im, corners, blocksize, ksize, k, radius, threshold, quality, maxCorners) :
+// fills corners (Nx3 : x, y, response) with the local maxima of the Harris
+// response, strongest first (cf. HarrisCorners), and returns N
+static int HarrisCornersNMS(lua_State* L) {
+  STATS_SCOPE("HarrisCorners");
+  setLuaState(L);
+  SCRATCH_SCOPE();
+  Tensor<float> corners    = FromLuaStack<Tensor<float> >(2);
+  int           blockSize  = FromLuaStack<int   >(3);
+  int           ksize      = FromLuaStack<int   >(4);
+  double        k          = FromLuaStack<double>(5);
+  int           radius     = FromLuaStack<int   >(6);
+  double        threshold  = FromLuaStack<double>(7);
+  double        quality    = FromLuaStack<double>(8);
+  size_t        maxCorners = FromLuaStack<size_t>(9);
+
+  STATS_START(convert, "HarrisCorners.convert");
+  matb im_cv_gray = GrayFromLuaStack(L, 1);
+  STATS_STOP(convert);
+
+  STATS_START(kernel, "HarrisCorners.kernel");
+  vector<HarrisCorner> found;
+  HarrisCorners(im_cv_gray, blockSize, ksize, k, radius, threshold, quality,
+		maxCorners, found);
+  STATS_STOP(kernel);
+
+  corners.resize(max<size_t>(found.size(), 1), 3);
+  for (size_t i = 0; i < found.size(); ++i) {
+    corners(i, 0) = found[i].x;
+    corners(i, 1) = found[i].y;
+    corners(i, 2) = found[i].response;
+  }
+  PushOnLuaStack<int>(found.size());
+  return 1;
+}
+
 //============================================================
 // Dense Optical Flow
 //
@@ -75,17 +574,19 @@ extern void cvCalcOpticalFlowBM(const CvArr* prev, const CvArr* curr,
 				CvArr* velx, CvArr* vely);
 
 static int DenseOpticalFlowBlockMatching(lua_State *L) {
+  STATS_SCOPE("DenseOpticalFlowBlockMatching");
   setLuaState(L);
-  Tensor<ubyte> im1  = FromLuaStack<Tensor<ubyte> >(1);
-  Tensor<ubyte> im2  = FromLuaStack<Tensor<ubyte> >(2);
+  SCRATCH_SCOPE();
   Tensor<float> flow = FromLuaStack<Tensor<float> >(3);
   int  block_size    = FromLuaStack<int >(4);
   int  shift_size    = FromLuaStack<int >(5);
   int  max_range     = FromLuaStack<int >(6);
   bool use_previous  = FromLuaStack<bool>(7);
   
-  CvMat im1_cv = (CvMat)TensorToMat<ubyte>(im1);
-  CvMat im2_cv = (CvMat)TensorToMat<ubyte>(im2);
+  matb im1_gray = GrayFromLuaStack(L, 1);
+  matb im2_gray = GrayFromLuaStack(L, 2);
+  CvMat im1_cv = (CvMat)im1_gray;
+  CvMat im2_cv = (CvMat)im2_gray;
   
   Tensor<float> flowy = flow.newSelect(0,0);
   Tensor<float> flowx = flow.newSelect(0,1);
@@ -102,11 +603,141 @@ static int DenseOpticalFlowBlockMatching(lua_State *L) {
   return 0;
 }
 
+// Block matching flow (cf. BlockMatchingFlow), at full resolution : flow is
+// resized to 2xHxW, plane 0 being y and plane 1 x as in the legacy binding
+// above. If use_previous, flow holds the seed.
+static int DenseOpticalFlowBM(lua_State *L) {
+  STATS_SCOPE("DenseOpticalFlowBM");
+  setLuaState(L);
+  SCRATCH_SCOPE();
+  Tensor<float> flow = FromLuaStack<Tensor<float> >(3);
+  BlockFlowParams params;
+  params.blockSize    = FromLuaStack<int  >(4);
+  params.shift        = FromLuaStack<int  >(5);
+  params.maxRange     = FromLuaStack<int  >(6);
+  bool use_previous   = FromLuaStack<bool >(7);
+  params.exhaustive   = FromLuaStack<bool >(8);
+  params.earlyExitSAD = FromLuaStack<float>(9);
+
+  STATS_START(convert, "DenseOpticalFlowBM.convert");
+  matb im1_gray = GrayFromLuaStack(L, 1);
+  matb im2_gray = GrayFromLuaStack(L, 2);
+  const int h = im1_gray.rows, w = im1_gray.cols;
+  THassert((im2_gray.rows == h) && (im2_gray.cols == w));
+  Mat seed;
+  if (use_previous) {
+    THassert((flow.nDimension() == 3) && (flow.size(0) == 2) &&
+	     (flow.size(1) == h) && (flow.size(2) == w));
+    Tensor<float> flowc = flow.newContiguous();
+    Mat planes[2] = {Mat(h, w, CV_32F, flowc.data() + flowc.stride(0)),
+		     Mat(h, w, CV_32F, flowc.data())};
+    merge(planes, 2, seed);
+  }
+  STATS_STOP(convert);
+
+  STATS_START(kernel, "DenseOpticalFlowBM.kernel");
+  Mat flow_cv;
+  BlockMatchingFlow(im1_gray, im2_gray, params, seed, flow_cv);
+  STATS_STOP(kernel);
+
+  STATS_SCOPE("DenseOpticalFlowBM.output");
+  flow.resize(2, h, w);
+  Tensor<float> flowc = flow.newContiguous();
+  Mat planes[2] = {Mat(h, w, CV_32F, flowc.data() + flowc.stride(0)),
+		   Mat(h, w, CV_32F, flowc.data())};
+  split(flow_cv, planes);
+  if (flowc.data() != flow.data())
+    THFloatTensor_copy(flow, flowc);
+  return 0;
+}
+
+// Persistent Farneback flow (the frames are pushed by the generic
+// FarnebackFlowPush)
+HandleRegistry<FarnebackFlow> farnebackFlows_g("FarnebackFlow");
+
+static int CreateFarnebackFlow(lua_State *L) {
+  setLuaState(L);
+  double pyr_scale   = FromLuaStack<double>(1);
+  int    levels      = FromLuaStack<int   >(2);
+  int    winsize     = FromLuaStack<int   >(3);
+  int    iterations  = FromLuaStack<int   >(4);
+  int    poly_n      = FromLuaStack<int   >(5);
+  double poly_sigma  = FromLuaStack<double>(6);
+  bool   use_previous= FromLuaStack<bool  >(7);
+
+  PushOnLuaStack<int>(farnebackFlows_g.add(new FarnebackFlow(pyr_scale, levels, winsize,
+							     iterations, poly_n, poly_sigma,
+							     use_previous)));
+  return 1;
+}
+
+static int DeleteFarnebackFlow(lua_State *L) {
+  setLuaState(L);
+  int iFlow = FromLuaStack<int>(1);
+  farnebackFlows_g.remove(iFlow);
+  return 0;
+}
+
+// Asynchronous Farneback flow. flow is a HxWx2 FloatTensor (the size of
+// the images), written in place by the worker.
+class FarnebackFuture : public Future {
+public:
+  FarnebackFuture(const PinnedImage & im1, const PinnedImage & im2,
+		  const Tensor<float> & flow, double pyr_scale, int levels,
+		  int winsize, int iterations, int poly_n, double poly_sigma,
+		  bool use_previous)
+    :im1(im1), im2(im2), flow(PinTensor(flow)), pyr_scale(pyr_scale),
+     levels(levels), winsize(winsize), iterations(iterations), poly_n(poly_n),
+     poly_sigma(poly_sigma), use_previous(use_previous) {};
+  virtual void run() {
+    STATS_SCOPE("DenseOpticalFlowFarnebachAsync.kernel");
+    matb im1_cv_gray = im1.gray();
+    matb im2_cv_gray = im2.gray();
+    Mat flow_cv = TensorToMat(flow);
+    // (calcOpticalFlowFarneback would reallocate it)
+    THassert((flow_cv.size() == im1_cv_gray.size()) && (flow_cv.type() == CV_32FC2));
+    calcOpticalFlowFarneback(im1_cv_gray, im2_cv_gray, flow_cv, pyr_scale, levels,
+			     winsize, iterations, poly_n, poly_sigma,
+			     use_previous*OPTFLOW_USE_INITIAL_FLOW);
+  }
+private:
+  PinnedImage im1, im2;
+  Tensor<float> flow;
+  double pyr_scale;
+  int levels, winsize, iterations, poly_n;
+  double poly_sigma;
+  bool use_previous;
+};
+
+// Same arguments as DenseOpticalFlowFarnebach, returns a future
+static int DenseOpticalFlowFarnebachAsync(lua_State *L) {
+  STATS_SCOPE("DenseOpticalFlowFarnebachAsync");
+  setLuaState(L);
+  Tensor<float> flow = FromLuaStack<Tensor<float> >(3);
+  double pyr_scale   = FromLuaStack<double>(4);
+  int    levels      = FromLuaStack<int   >(5);
+  int    winsize     = FromLuaStack<int   >(6);
+  int    iterations  = FromLuaStack<int   >(7);
+  int    poly_n      = FromLuaStack<int   >(8);
+  double poly_sigma  = FromLuaStack<double>(9);
+  bool   use_previous= FromLuaStack<bool  >(10);
+  THassert((flow.nDimension() == 3) && (flow.size(2) == 2) &&
+	   THFloatTensor_isContiguous(flow));
+  CheckImageFromLuaStack(L, 1);
+  CheckImageFromLuaStack(L, 2);
+
+  PushOnLuaStack<int>(PushFuture(new FarnebackFuture(PinnedImage(L, 1), PinnedImage(L, 2),
+						     flow, pyr_scale, levels, winsize,
+						     iterations, poly_n, poly_sigma,
+						     use_previous)));
+  return 1;
+}
+
 //============================================================
 // FREAK
 //
 
-vector<FREAK*> freaks_g;
+HandleRegistry<FREAK> freaks_g("FREAK");
 
 static int CreateFREAK(lua_State* L) {
   setLuaState(L);
@@ -121,42 +752,43 @@ static int CreateFREAK(lua_State* L) {
     for (int i = 0; i < trainedPairs.size(0); ++i)
       pairs.push_back(trainedPairs(i));
 
-  freaks_g.push_back(new FREAK(orientedNormalization, scaleNormalization,
-			       patternSize, nOctave, pairs));
-  PushOnLuaStack<int>(freaks_g.size()-1);
+  Ptr<FREAK> freak = new FREAK(orientedNormalization, scaleNormalization,
+			       patternSize, nOctave, pairs);
+  BuildFREAKPattern(*freak);
+  PushOnLuaStack<int>(freaks_g.add(freak));
   return 1;
 }
 
 static int DeleteFREAK(lua_State* L) {
   setLuaState(L);
   int iFREAK = FromLuaStack<int  >(1);
-  delete freaks_g[iFREAK];
+  freaks_g.remove(iFREAK);
   return 0;
 }
 
 static int ComputeFREAKfromKeyPoints(lua_State* L){
+  STATS_SCOPE("ComputeFREAKfromKeyPoints");
   setLuaState(L);
-  Tensor<ubyte>         im        = FromLuaStack<Tensor<ubyte> >(1);
+  SCRATCH_SCOPE();
   Tensor<unsigned char> descs     = FromLuaStack<Tensor<unsigned char> >(2);
   Tensor<float>         positions = FromLuaStack<Tensor<float> >(3);
   int                   iFREAK    = FromLuaStack<int>(5);
 
-  matb im_cv_gray;
-  if (im.nDimension() == 3) //color images
-    cvtColor(TensorToMat3b(im), im_cv_gray, CV_BGR2GRAY);
-  else
-    im_cv_gray = TensorToMat(im);
+  // (checked before getting the FREAK, cf. registry.hpp)
+  THassert((positions.nDimension() == 0) ||
+	   ((positions.nDimension() == 2) && (positions.size(1) >= 2)));
+  CheckImageFromLuaStack(L, 1);
+  Ptr<FREAK> freakPtr = freaks_g.get(iFREAK);
+  FREAK & freak = *freakPtr;
 
-  cout << positions.size() << endl;
-  
-  vector<KeyPoint> keypoints (positions.size()[0]);
+  matb im_cv_gray = GrayFromLuaStack(L, 1);
+  vector<KeyPoint> keypoints ((positions.nDimension() == 2) ? positions.size(0) : 0);
   for (size_t i = 0; i < keypoints.size(); ++i) {
     KeyPoint & kpt = keypoints[i];
     kpt.pt.x = positions(i,0);
     kpt.pt.y = positions(i,1);
   }
   Mat descs_cv;
-  FREAK & freak = *(freaks_g[iFREAK]);
   freak.compute(im_cv_gray, keypoints, descs_cv);
   
   descs.resize(descs_cv.size().height, descs_cv.size().width);
@@ -165,30 +797,32 @@ static int ComputeFREAKfromKeyPoints(lua_State* L){
   return 0; 
 }
 
-static int ComputeFREAK(lua_State* L) {
-  setLuaState(L);
-  Tensor<ubyte>         im        = FromLuaStack<Tensor<ubyte> >(1);
-  Tensor<unsigned char> descs     = FromLuaStack<Tensor<unsigned char> >(2);
-  Tensor<float>         positions = FromLuaStack<Tensor<float> >(3);
-  float       keypoints_threshold = FromLuaStack<float>(4);
-  int                   iFREAK    = FromLuaStack<int>(5);
-
-  matb im_cv_gray;
-  if (im.nDimension() == 3) //color images
-    cvtColor(TensorToMat3b(im), im_cv_gray, CV_BGR2GRAY);
+// FAST + FREAK on one gray image, into keypoints and descs_cv. Does not use
+// the lua state nor the TH allocator (it runs in the worker threads of
+// ComputeFREAKBatch). If given, fast holds the FAST keypoints (cf.
+// Frame::fastKeypoints). The keypoints go through the selection stage of
+// keypoints.hpp unless sel is empty.
+static void ComputeFREAKImage(const matb & im_cv_gray, float keypoints_threshold,
+			      const FREAK & freak, vector<KeyPoint> & keypoints,
+			      Mat & descs_cv, const vector<KeyPoint>* fast = NULL,
+			      const KeypointSelection & sel = KeypointSelection()) {
+  // keypoints (FREAK::compute removes the ones too close to the border)
+  STATS_SCOPE("ComputeFREAK.kernel");
+  if (fast != NULL)
+    keypoints = *fast;
   else
-    im_cv_gray = TensorToMat(im);
-
-  // keypoints
-  vector<KeyPoint> keypoints;
-  FAST(im_cv_gray, keypoints, keypoints_threshold, true);
+    DetectFASTMasked(im_cv_gray, sel.mask, keypoints_threshold, keypoints);
+  if (!sel.empty())
+    SelectKeypoints(keypoints, sel, im_cv_gray.size());
   
   // descriptors
-  FREAK & freak = *(freaks_g[iFREAK]);
-  Mat descs_cv;
   freak.compute(im_cv_gray, keypoints, descs_cv);
-  
-  // output
+}
+
+// Writes the output of ComputeFREAKImage (in the lua thread)
+static void FREAKToTensors(const vector<KeyPoint> & keypoints, const Mat & descs_cv,
+			   Tensor<unsigned char> descs, Tensor<float> positions) {
+  STATS_SCOPE("ComputeFREAK.output");
   positions.resize(keypoints.size(), 4);
   for (size_t i = 0; i < keypoints.size(); ++i) {
     const KeyPoint & kpt = keypoints[i];
@@ -199,59 +833,301 @@ static int ComputeFREAK(lua_State* L) {
   }
   descs.resize(descs_cv.size().height, descs_cv.size().width);
   descs_cv.copyTo(TensorToMat(descs));
+}
+
+// (im, descs, positions, threshold, iFREAK[, mask, maxPoints, gridRows,
+// gridCols]) : cf. keypoints.hpp for the optional selection
+static int ComputeFREAK(lua_State* L) {
+  STATS_SCOPE("ComputeFREAK");
+  setLuaState(L);
+  SCRATCH_SCOPE();
+  Tensor<unsigned char> descs     = FromLuaStack<Tensor<unsigned char> >(2);
+  Tensor<float>         positions = FromLuaStack<Tensor<float> >(3);
+  float       keypoints_threshold = FromLuaStack<float>(4);
+  int                   iFREAK    = FromLuaStack<int>(5);
+
+  STATS_START(convert, "ComputeFREAK.convert");
+  KeypointSelection sel = KeypointSelectionFromLuaStack(L, 6);
+  Ptr<Frame> frame = FrameFromLuaStack(L, 1);
+  matb im_cv_gray = frame.empty() ? GrayFromLuaStack(L, 1) : frame->gray();
+  STATS_STOP(convert);
+  Ptr<FREAK> freak = freaks_g.tryGet(iFREAK);
+  if (freak.empty()) {
+    frame.release();
+    im_cv_gray.release(); // (the gray image of the frame)
+    freaks_g.get(iFREAK); // (raises the error)
+  }
+  vector<KeyPoint> fast;
+  if (!frame.empty())
+    frame->fastKeypoints(keypoints_threshold, fast);
+  ScratchVector<KeyPoint> scratchKeypoints;
+  vector<KeyPoint> & keypoints = *scratchKeypoints;
+  Mat descs_cv;
+  ComputeFREAKImage(im_cv_gray, keypoints_threshold, *freak, keypoints, descs_cv,
+		    frame.empty() ? NULL : &fast, sel);
+  FREAKToTensors(keypoints, descs_cv, descs, positions);
   
   return 0;
 }
 
-static int TrainFREAK(lua_State* L) {
+class ComputeFREAKTask : public BatchTask {
+public:
+  ComputeFREAKTask(const Tensor<ubyte> & im, const Tensor<unsigned char> & descs,
+		   const Tensor<float> & positions, float keypoints_threshold,
+		   const FREAK & freak)
+    :im(im), descs(descs), positions(positions),
+     keypoints_threshold(keypoints_threshold), freak(freak) {};
+  virtual void run() {
+    STATS_START(convert, "ComputeFREAK.convert");
+    matb im_cv_gray = TensorToMatGray(im);
+    STATS_STOP(convert);
+    ComputeFREAKImage(im_cv_gray, keypoints_threshold, freak, keypoints, descs_cv);
+  }
+  virtual void output() {
+    FREAKToTensors(keypoints, descs_cv, descs, positions);
+  }
+private:
+  Tensor<ubyte> im;
+  Tensor<unsigned char> descs;
+  Tensor<float> positions;
+  float keypoints_threshold;
+  const FREAK & freak;
+  vector<KeyPoint> keypoints;
+  Mat descs_cv;
+};
+
+// Batch version of ComputeFREAK : images, descs and positions are tables.
+// The FREAK object is shared by the workers, its pattern is built before.
+static int ComputeFREAKBatch(lua_State* L) {
+  STATS_SCOPE("ComputeFREAKBatch");
   setLuaState(L);
-  vector<Tensor<ubyte> > images  = FromLuaStack<vector<Tensor<ubyte> > >(1);
-  Tensor<int> pairs_out           = FromLuaStack<Tensor<int> >(2);
-  size_t      iFREAK              = FromLuaStack<size_t>(3);
-  float       keypoints_threshold = FromLuaStack<float>(4);
-  double      corrThres           = FromLuaStack<double>(5);
+  vector<Tensor<ubyte> >         ims       = FromLuaStack<vector<Tensor<ubyte> > >(1);
+  vector<Tensor<unsigned char> > descs     = FromLuaStack<vector<Tensor<unsigned char> > >(2);
+  vector<Tensor<float> >         positions = FromLuaStack<vector<Tensor<float> > >(3);
+  float             keypoints_threshold    = FromLuaStack<float>(4);
+  int                            iFREAK    = FromLuaStack<int>(5);
 
-  vector<Mat> images_cv;
-  vector<vector<KeyPoint> > keypoints;
-  for (size_t i = 0; i < images.size(); ++i) {
-    matb im_gray;
-    if (images[i].nDimension() == 3)
-      cvtColor(TensorToMat3b(images[i]), im_gray, CV_BGR2GRAY);
-    else
-      im_gray = TensorToMat(images[i]);
-    images_cv.push_back(im_gray);
-    keypoints.push_back(vector<KeyPoint>());
-    FAST(im_gray, keypoints.back(), keypoints_threshold, true);
+  THassert((descs.size() == ims.size()) && (positions.size() == ims.size()));
+  for (size_t i = 0; i < ims.size(); ++i)
+    CheckImageTensor(ims[i]);
+  Ptr<FREAK> freakPtr = freaks_g.get(iFREAK);
+  BuildFREAKPattern(*freakPtr);
+  const FREAK & freak = *freakPtr;
+  vector<BatchTask*> tasks;
+  for (size_t i = 0; i < ims.size(); ++i)
+    tasks.push_back(new ComputeFREAKTask(ims[i], descs[i], positions[i],
+					 keypoints_threshold, freak));
+  const string error = RunBatchTasks(tasks);
+  freakPtr.release();
+  if (!error.empty())
+    THerror(error);
+  return 0;
+}
+
+//============================================================
+// FREAK training (cf. freaktrain.hpp)
+//
+
+HandleRegistry<FREAKTrainer> freakTrainers_g("FREAKTrainer");
+
+// Adds the images first, first+step, ... to the trainer, converting them
+// one at a time
+class FREAKTrainTask : public BatchTask {
+public:
+  FREAKTrainTask(FREAKTrainer & trainer, const vector<Tensor<ubyte> > & images,
+		 size_t first, size_t step)
+    :trainer(trainer), images(images), first(first), step(step) {};
+  virtual void run() {
+    FREAKPairStats stats;
+    for (size_t i = first; i < images.size(); i += step) {
+      SCRATCH_SCOPE();
+      trainer.addImage(TensorToMatGray(images[i]), stats);
+    }
+    trainer.merge(stats);
   }
+private:
+  FREAKTrainer & trainer;
+  const vector<Tensor<ubyte> > & images;
+  size_t first, step;
+};
 
-  FREAK & freak = *(freaks_g[iFREAK]);
-  vector<int> pairs = freak.selectPairs(images_cv, keypoints, corrThres, false);
+// Adds the images (checked by CheckImageTensor) on the worker pool, each
+// worker keeping its own statistics (about 6.5MB) until the end of the
+// batch. Returns the first error, if any (cf. RunBatchTasks).
+static string FREAKTrainerAddImages(FREAKTrainer & trainer, const vector<Tensor<ubyte> > & images) {
+  const size_t nTasks = min(images.size(), (size_t)max(1, getNumThreads()));
+  vector<BatchTask*> tasks;
+  for (size_t i = 0; i < nTasks; ++i)
+    tasks.push_back(new FREAKTrainTask(trainer, images, i, nTasks));
+  return RunBatchTasks(tasks);
+}
 
+static void PairsToTensor(const vector<int> & pairs, Tensor<int> pairs_out) {
   pairs_out.resize(pairs.size());
   for (size_t i = 0; i < pairs.size(); ++i)
     pairs_out(i) = pairs[i];
+}
+
+#define FREAK_TRAIN_NO_PAIRS_ERROR \
+  "no keypoints, or correlation threshold too small (restrictive)"
+
+// (iFREAK, keypoints_threshold, maxKeypoints) : maxKeypoints is the number
+// of keypoints kept per image (the strongest ones), 0 for all
+static int CreateFREAKTrainer(lua_State* L) {
+  setLuaState(L);
+  int   iFREAK              = FromLuaStack<int>(1);
+  float keypoints_threshold = FromLuaStack<float>(2);
+  int   maxKeypoints        = FromLuaStack<int>(3);
+
+  Ptr<FREAKTrainer> trainer;
+  {
+    Ptr<FREAK> freak = freaks_g.get(iFREAK);
+    trainer = new FREAKTrainer(*freak, keypoints_threshold, maxKeypoints);
+  }
+  PushOnLuaStack<int>(freakTrainers_g.add(trainer));
+  return 1;
+}
 
+static int DeleteFREAKTrainer(lua_State* L) {
+  setLuaState(L);
+  int iTrainer = FromLuaStack<int>(1);
+  freakTrainers_g.remove(iTrainer);
   return 0;
 }
 
-// Just compute the FAST keypoints
-static int ComputeFAST(lua_State* L) {
+// (trainer, images) : adds a batch of images, returns the number of
+// keypoints added so far
+static int FREAKTrainerAdd(lua_State* L) {
+  STATS_SCOPE("FREAKTrainerAdd");
   setLuaState(L);
-  Tensor<ubyte>         im        = FromLuaStack<Tensor<ubyte> >(1);
-  Tensor<float>         positions = FromLuaStack<Tensor<float> >(2);
-  float       keypoints_threshold = FromLuaStack<float>(3);
+  int                    iTrainer = FromLuaStack<int>(1);
+  vector<Tensor<ubyte> > images   = FromLuaStack<vector<Tensor<ubyte> > >(2);
 
-  matb im_cv_gray;
-  if (im.nDimension() == 3) //color images
-    cvtColor(TensorToMat3b(im), im_cv_gray, CV_BGR2GRAY);
-  else
-    im_cv_gray = TensorToMat(im);
+  for (size_t i = 0; i < images.size(); ++i)
+    CheckImageTensor(images[i]);
+  Ptr<FREAKTrainer> trainer = freakTrainers_g.get(iTrainer);
+  const string error = FREAKTrainerAddImages(*trainer, images);
+  const long nKeypoints = (long)trainer->nKeypoints();
+  trainer.release();
+  if (!error.empty())
+    THerror(error);
+  PushOnLuaStack<long>(nKeypoints);
+  return 1;
+}
 
-  // keypoints
-  vector<KeyPoint> keypoints;
-  FAST(im_cv_gray, keypoints, keypoints_threshold, true);
-  
-  // output
+// (trainer, pairs, corrThres) : selects the pairs
+static int FREAKTrainerSelect(lua_State* L) {
+  STATS_SCOPE("FREAKTrainerSelect");
+  setLuaState(L);
+  int         iTrainer  = FromLuaStack<int>(1);
+  Tensor<int> pairs_out = FromLuaStack<Tensor<int> >(2);
+  double      corrThres = FromLuaStack<double>(3);
+
+  vector<int> pairs;
+  {
+    Ptr<FREAKTrainer> trainer = freakTrainers_g.get(iTrainer);
+    pairs = trainer->selectPairs(corrThres);
+  }
+  if (pairs.empty())
+    THerror("FREAKTrainerSelect: " FREAK_TRAIN_NO_PAIRS_ERROR);
+  PairsToTensor(pairs, pairs_out);
+  return 0;
+}
+
+// (images, pairs, iFREAK, keypoints_threshold, corrThres[, maxKeypoints]) :
+// one batch trainer
+static int TrainFREAK(lua_State* L) {
+  STATS_SCOPE("TrainFREAK");
+  setLuaState(L);
+  vector<Tensor<ubyte> > images  = FromLuaStack<vector<Tensor<ubyte> > >(1);
+  Tensor<int> pairs_out           = FromLuaStack<Tensor<int> >(2);
+  size_t      iFREAK              = FromLuaStack<size_t>(3);
+  float       keypoints_threshold = FromLuaStack<float>(4);
+  double      corrThres           = FromLuaStack<double>(5);
+  int         maxKeypoints        = FromLuaStack<int>(6);
+
+  for (size_t i = 0; i < images.size(); ++i)
+    CheckImageTensor(images[i]);
+
+  vector<int> pairs;
+  string error;
+  {
+    Ptr<FREAK> freak = freaks_g.get(iFREAK);
+    FREAKTrainer trainer(*freak, keypoints_threshold, maxKeypoints);
+    error = FREAKTrainerAddImages(trainer, images);
+    if (error.empty())
+      pairs = trainer.selectPairs(corrThres);
+  }
+  if (!error.empty())
+    THerror(error);
+  if (pairs.empty())
+    THerror("TrainFREAK: " FREAK_TRAIN_NO_PAIRS_ERROR);
+  PairsToTensor(pairs, pairs_out);
+  return 0;
+}
+
+// Asynchronous TrainFREAK (the images are added by the worker running the
+// future, one at a time)
+class TrainFREAKFuture : public Future {
+public:
+  TrainFREAKFuture(const vector<Tensor<ubyte> > & images, const Tensor<int> & pairs_out,
+		   const FREAK & freak, float keypoints_threshold, double corrThres,
+		   int maxKeypoints)
+    :pairs_out(PinTensor(pairs_out)), trainer(freak, keypoints_threshold, maxKeypoints),
+     corrThres(corrThres) {
+    for (size_t i = 0; i < images.size(); ++i)
+      this->images.push_back(PinTensor(images[i]));
+  };
+  virtual void run() {
+    STATS_SCOPE("TrainFREAKAsync.kernel");
+    {
+      FREAKPairStats stats;
+      for (size_t i = 0; i < images.size(); ++i) {
+	SCRATCH_SCOPE();
+	trainer.addImage(TensorToMatGray(images[i]), stats);
+      }
+      trainer.merge(stats);
+    }
+    pairs = trainer.selectPairs(corrThres);
+    if (pairs.empty())
+      THerror("TrainFREAKAsync: " FREAK_TRAIN_NO_PAIRS_ERROR);
+  }
+  virtual void collect() {
+    PairsToTensor(pairs, pairs_out);
+  }
+private:
+  vector<Tensor<ubyte> > images;
+  Tensor<int> pairs_out;
+  FREAKTrainer trainer;
+  double corrThres;
+  vector<int> pairs;
+};
+
+// Same arguments as TrainFREAK, returns a future
+static int TrainFREAKAsync(lua_State* L) {
+  STATS_SCOPE("TrainFREAKAsync");
+  setLuaState(L);
+  vector<Tensor<ubyte> > images  = FromLuaStack<vector<Tensor<ubyte> > >(1);
+  Tensor<int> pairs_out           = FromLuaStack<Tensor<int> >(2);
+  size_t      iFREAK              = FromLuaStack<size_t>(3);
+  float       keypoints_threshold = FromLuaStack<float>(4);
+  double      corrThres           = FromLuaStack<double>(5);
+  int         maxKeypoints        = FromLuaStack<int>(6);
+  for (size_t i = 0; i < images.size(); ++i)
+    CheckImageTensor(images[i]);
+
+  Future* future;
+  {
+    Ptr<FREAK> freak = freaks_g.get(iFREAK);
+    future = new TrainFREAKFuture(images, pairs_out, *freak, keypoints_threshold,
+				  corrThres, maxKeypoints);
+  }
+  PushOnLuaStack<int>(PushFuture(future));
+  return 1;
+}
+
+static void FASTToPositions(const vector<KeyPoint> & keypoints, Tensor<float> positions) {
+  STATS_SCOPE("ComputeFAST.output");
   positions.resize(keypoints.size(), 5);
   for (size_t i = 0; i < keypoints.size(); ++i) {
     const KeyPoint & kpt = keypoints[i];
@@ -261,64 +1137,822 @@ static int ComputeFAST(lua_State* L) {
     positions(i, 3) = kpt.angle;
     positions(i, 4) = kpt.response;
   }
+}
+
+// Just compute the FAST keypoints (no lua state nor TH allocator access, cf.
+// ComputeFASTBatch)
+static void ComputeFASTImage(const matb & im_cv_gray, float keypoints_threshold,
+			     vector<KeyPoint> & keypoints,
+			     const KeypointSelection & sel = KeypointSelection()) {
+  STATS_SCOPE("ComputeFAST.kernel");
+  DetectFASTMasked(im_cv_gray, sel.mask, keypoints_threshold, keypoints);
+  if (!sel.empty())
+    SelectKeypoints(keypoints, sel, im_cv_gray.size());
+}
+
+// (im, positions, threshold[, mask, maxPoints, gridRows, gridCols]) : cf.
+// keypoints.hpp for the optional selection
+static int ComputeFAST(lua_State* L) {
+  STATS_SCOPE("ComputeFAST");
+  setLuaState(L);
+  SCRATCH_SCOPE();
+  Tensor<float>         positions = FromLuaStack<Tensor<float> >(2);
+  float       keypoints_threshold = FromLuaStack<float>(3);
+  KeypointSelection           sel = KeypointSelectionFromLuaStack(L, 4);
+
+  Ptr<Frame> frame = FrameFromLuaStack(L, 1);
+  if (!frame.empty()) {
+    STATS_START(kernel, "ComputeFAST.kernel");
+    ScratchVector<KeyPoint> scratchKeypoints;
+    vector<KeyPoint> & keypoints = *scratchKeypoints;
+    frame->fastKeypoints(keypoints_threshold, keypoints);
+    if (!sel.empty())
+      SelectKeypoints(keypoints, sel, frame->gray().size());
+    STATS_STOP(kernel);
+    FASTToPositions(keypoints, positions);
+    return 0;
+  }
+  STATS_START(convert, "ComputeFAST.convert");
+  matb im_cv_gray = GrayFromLuaStack(L, 1);
+  STATS_STOP(convert);
+  ScratchVector<KeyPoint> scratchKeypoints;
+  vector<KeyPoint> & keypoints = *scratchKeypoints;
+  ComputeFASTImage(im_cv_gray, keypoints_threshold, keypoints, sel);
+  FASTToPositions(keypoints, positions);
   
   return 0;
 }
-inline size_t HammingDistance(unsigned long long int* p1, unsigned long long int* p2,
-			      size_t len) {
-  size_t dist = 0;
-  for (size_t i = 0; i < len; ++i) {
-    dist += __builtin_popcountll(p1[i] ^ p2[i]);
+
+class ComputeFASTTask : public BatchTask {
+public:
+  ComputeFASTTask(const Tensor<ubyte> & im, const Tensor<float> & positions,
+		  float keypoints_threshold)
+    :im(im), positions(positions), keypoints_threshold(keypoints_threshold) {};
+  virtual void run() {
+    STATS_START(convert, "ComputeFAST.convert");
+    matb im_cv_gray = TensorToMatGray(im);
+    STATS_STOP(convert);
+    ComputeFASTImage(im_cv_gray, keypoints_threshold, keypoints);
   }
-  return dist;
+  virtual void output() {
+    FASTToPositions(keypoints, positions);
+  }
+private:
+  Tensor<ubyte> im;
+  Tensor<float> positions;
+  float keypoints_threshold;
+  vector<KeyPoint> keypoints;
+};
+
+// Batch version of ComputeFAST : images and positions are tables
+static int ComputeFASTBatch(lua_State* L) {
+  STATS_SCOPE("ComputeFASTBatch");
+  setLuaState(L);
+  vector<Tensor<ubyte> > ims       = FromLuaStack<vector<Tensor<ubyte> > >(1);
+  vector<Tensor<float> > positions = FromLuaStack<vector<Tensor<float> > >(2);
+  float     keypoints_threshold    = FromLuaStack<float>(3);
+
+  THassert(positions.size() == ims.size());
+  for (size_t i = 0; i < ims.size(); ++i)
+    CheckImageTensor(ims[i]);
+  vector<BatchTask*> tasks;
+  for (size_t i = 0; i < ims.size(); ++i)
+    tasks.push_back(new ComputeFASTTask(ims[i], positions[i], keypoints_threshold));
+  const string error = RunBatchTasks(tasks);
+  if (!error.empty())
+    THerror(error);
+  return 0;
+}
+
+// The matching engines read the descriptors row by row, with their stride :
+// only tensors whose rows are not contiguous are copied (eg. the views of a
+// FREAK store are searched in place)
+static Tensor<unsigned char> DescriptorRows(const Tensor<unsigned char> & descs) {
+  if ((descs.nDimension() == 2) && (descs.stride(1) == 1))
+    return descs;
+  return descs.newContiguous();
 }
 
 static int MatchFREAK(lua_State* L) {
+  STATS_SCOPE("MatchFREAK");
   setLuaState(L);
   Tensor<unsigned char> descs1 = FromLuaStack<Tensor<unsigned char> >(1);
   Tensor<unsigned char> descs2 = FromLuaStack<Tensor<unsigned char> >(2);
   Tensor<long         > matches= FromLuaStack<Tensor<long         > >(3);
   size_t threshold = FromLuaStack<size_t>(4);
+  Tensor<int          > dists  = FromLuaStack<Tensor<int          > >(5);
 
-  descs1.newContiguous();
-  descs2.newContiguous();
-  unsigned char* descs1_p = descs1.data();
-  unsigned char* descs2_p = descs2.data();
-  const long* s1 = descs1.stride();
-  const long* s2 = descs2.stride();
-  matches.resize(descs1.size(0), 2);
-
+  descs1 = DescriptorRows(descs1);
+  descs2 = DescriptorRows(descs2);
+  const long n1 = (descs1.nDimension() == 2) ? descs1.size(0) : 0;
+  const long n2 = (descs2.nDimension() == 2) ? descs2.size(0) : 0;
+  matches.resize(n1, 2);
+  dists.resize(n1);
+  if (n1 == 0) {
+    PushOnLuaStack<int>(0);
+    return 1;
+  }
   THassert(descs1.size(1) % sizeof(unsigned long long int) == 0);
-  size_t bestj, bestdist, dist;
+  THassert((n2 == 0) || (descs1.size(1) == descs2.size(1)));
+
+  STATS_START(kernel, "MatchFREAK.kernel");
+  vector<long> bestj(n1);
+  vector<unsigned int> bestdist(n1);
+  MatchHammingBest(descs1.data(), n1, descs1.stride(0),
+		   descs2.data(), n2, (n2 == 0) ? 0 : descs2.stride(0),
+		   descs1.size(1), &(bestj[0]), &(bestdist[0]));
+  STATS_STOP(kernel);
+
+  STATS_SCOPE("MatchFREAK.output");
   long iMatches = 0;
-  for (long i = 0; i < descs1.size(0); ++i) {
-    bestj = 0;
-    bestdist = descs1.size(1)*8;
-    for (long j = i; j < descs2.size(0); ++j) {
-      dist = HammingDistance((unsigned long long*)(descs1_p + i*s1[0]),
-			     (unsigned long long*)(descs2_p + j*s2[0]),
-			     descs1.size(1)/sizeof(unsigned long long));
-      if (dist < bestdist) {
-	bestj = j;
-	bestdist = dist;
-      }
+  for (long i = 0; i < n1; ++i)
+    if ((bestj[i] >= 0) && (bestdist[i] < threshold)) {
+      matches(iMatches, 0) = i;
+      matches(iMatches, 1) = bestj[i];
+      dists(iMatches) = bestdist[i];
+      ++iMatches;
     }
-    if (bestdist < threshold) {
+  PushOnLuaStack<int>(iMatches);
+  return 1;
+}
+
+// True if the x and y of the n rows of pos are finite : the grid of
+// MatchHammingGuided converts the positions of image 2 to cell indices (the
+// predicted positions out of the grid, NaN included, are skipped).
+static bool FinitePositions(const Tensor<float> & pos, long n) {
+  for (long i = 0; i < n; ++i)
+    for (int k = 0; k < 2; ++k) {
+      const float v = pos(i, k);
+      if (cvIsNaN(v) || cvIsInf(v))
+	return false;
+    }
+  return true;
+}
+
+// (descs1, pos1, descs2, pos2, matches, threshold, dists, radius, H) :
+// MatchFREAK among the keypoints of image 2 within radius of the predicted
+// position (cf. MatchHammingGuided). H is a 3x3 DoubleTensor, or empty for
+// the identity.
+static int MatchFREAKGuided(lua_State* L) {
+  STATS_SCOPE("MatchFREAKGuided");
+  setLuaState(L);
+  Tensor<unsigned char> descs1 = FromLuaStack<Tensor<unsigned char> >(1);
+  Tensor<float        > pos1   = FromLuaStack<Tensor<float        > >(2);
+  Tensor<unsigned char> descs2 = FromLuaStack<Tensor<unsigned char> >(3);
+  Tensor<float        > pos2   = FromLuaStack<Tensor<float        > >(4);
+  Tensor<long         > matches= FromLuaStack<Tensor<long         > >(5);
+  size_t threshold = FromLuaStack<size_t>(6);
+  Tensor<int          > dists  = FromLuaStack<Tensor<int          > >(7);
+  float                 radius = FromLuaStack<float>(8);
+  Tensor<double       > Ht     = FromLuaStack<Tensor<double       > >(9);
+
+  descs1 = DescriptorRows(descs1);
+  descs2 = DescriptorRows(descs2);
+  const long n1 = (descs1.nDimension() == 2) ? descs1.size(0) : 0;
+  const long n2 = (descs2.nDimension() == 2) ? descs2.size(0) : 0;
+  matches.resize(n1, 2);
+  dists.resize(n1);
+  if (n1 == 0) {
+    PushOnLuaStack<int>(0);
+    return 1;
+  }
+  THassert(descs1.size(1) % sizeof(unsigned long long int) == 0);
+  THassert((n2 == 0) || (descs1.size(1) == descs2.size(1)));
+  THassert(radius > 0);
+  pos1 = pos1.newContiguous();
+  pos2 = pos2.newContiguous();
+  THassert((pos1.nDimension() == 2) && (pos1.size(0) == n1) && (pos1.size(1) >= 2));
+  THassert((n2 == 0) || ((pos2.nDimension() == 2) && (pos2.size(0) == n2) &&
+			 (pos2.size(1) >= 2)));
+  if (!FinitePositions(pos2, n2))
+    THerror("MatchFREAKGuided: the positions of image 2 must be finite");
+  double H[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+  if (Ht.nDimension() != 0) {
+    THassert((Ht.nDimension() == 2) && (Ht.size(0) == 3) && (Ht.size(1) == 3));
+    for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 3; ++j)
+	H[3*i+j] = Ht(i, j);
+  }
+
+  STATS_START(kernel, "MatchFREAKGuided.kernel");
+  vector<long> bestj(n1);
+  vector<unsigned int> bestdist(n1);
+  MatchHammingGuided(descs1.data(), n1, descs1.stride(0), pos1.data(), pos1.stride(0),
+		     descs2.data(), n2, (n2 == 0) ? 0 : descs2.stride(0),
+		     (n2 == 0) ? NULL : pos2.data(), (n2 == 0) ? 0 : pos2.stride(0),
+		     descs1.size(1), H, radius, &(bestj[0]), &(bestdist[0]));
+  STATS_STOP(kernel);
+
+  STATS_SCOPE("MatchFREAKGuided.output");
+  long iMatches = 0;
+  for (long i = 0; i < n1; ++i)
+    if ((bestj[i] >= 0) && (bestdist[i] < threshold)) {
       matches(iMatches, 0) = i;
-      matches(iMatches, 1) = bestj;
+      matches(iMatches, 1) = bestj[i];
+      dists(iMatches) = bestdist[i];
       ++iMatches;
     }
+  PushOnLuaStack<int>(iMatches);
+  return 1;
+}
+
+// k-NN matching with ratio test and cross-check (cf. MatchHammingKnn)
+static int MatchFREAKKnn(lua_State* L) {
+  STATS_SCOPE("MatchFREAKKnn");
+  setLuaState(L);
+  Tensor<unsigned char> descs1  = FromLuaStack<Tensor<unsigned char> >(1);
+  Tensor<unsigned char> descs2  = FromLuaStack<Tensor<unsigned char> >(2);
+  int                   k       = FromLuaStack<int>(3);
+  float                 ratio   = FromLuaStack<float>(4);
+  bool                  crossCheck = FromLuaStack<bool>(5);
+  Tensor<long         > indices = FromLuaStack<Tensor<long         > >(6);
+  Tensor<int          > dists   = FromLuaStack<Tensor<int          > >(7);
+  Tensor<unsigned char> flags   = FromLuaStack<Tensor<unsigned char> >(8);
+
+  THassert(k >= 1);
+  descs1 = DescriptorRows(descs1);
+  descs2 = DescriptorRows(descs2);
+  const long n1 = (descs1.nDimension() == 2) ? descs1.size(0) : 0;
+  const long n2 = (descs2.nDimension() == 2) ? descs2.size(0) : 0;
+  indices.resize(n1, k);
+  dists.resize(n1, k);
+  flags.resize(n1);
+  if (n1 == 0) {
+    PushOnLuaStack<int>(0);
+    return 1;
+  }
+  THassert(descs1.size(1) % sizeof(unsigned long long int) == 0);
+  THassert((n2 == 0) || (descs1.size(1) == descs2.size(1)));
+  THassert(indices.isContiguous() && flags.isContiguous());
+
+  vector<unsigned int> knnDist(n1*k);
+  long nAccepted = MatchHammingKnn(descs1.data(), n1, descs1.stride(0),
+				   descs2.data(), n2, (n2 == 0) ? 0 : descs2.stride(0),
+				   descs1.size(1), k, ratio, crossCheck,
+				   indices.data(), &(knnDist[0]), flags.data());
+  for (long i = 0; i < n1; ++i)
+    for (int l = 0; l < k; ++l)
+      dists(i, l) = (indices(i, l) < 0) ? -1 : (int)knnDist[i*k+l];
+  PushOnLuaStack<long>(nAccepted);
+  return 1;
+}
+
+//============================================================
+// Approximate FREAK matching (LSH index)
+//
+
+HandleRegistry<HammingIndex> hammingIndexes_g("HammingIndex");
+
+static int CreateHammingIndex(lua_State* L) {
+  STATS_SCOPE("CreateHammingIndex");
+  setLuaState(L);
+  Tensor<unsigned char> descs   = FromLuaStack<Tensor<unsigned char> >(1);
+  int                   nTables = FromLuaStack<int>(2);
+  int                   keyBits = FromLuaStack<int>(3);
+  unsigned int          seed    = FromLuaStack<unsigned int>(4);
+
+  descs = DescriptorRows(descs);
+  THassert(descs.nDimension() == 2);
+  PushOnLuaStack<int>(hammingIndexes_g.add(new HammingIndex(descs.data(), descs.size(0),
+							    descs.stride(0), descs.size(1),
+							    nTables, keyBits, seed)));
+  return 1;
+}
+
+static int DeleteHammingIndex(lua_State* L) {
+  setLuaState(L);
+  int iIndex = FromLuaStack<int>(1);
+  hammingIndexes_g.remove(iIndex);
+  return 0;
+}
+
+// same outputs as MatchFREAK, descs2 being the indexed descriptors
+static int QueryHammingIndex(lua_State* L) {
+  STATS_SCOPE("QueryHammingIndex");
+  setLuaState(L);
+  int                   iIndex    = FromLuaStack<int>(1);
+  Tensor<unsigned char> descs     = FromLuaStack<Tensor<unsigned char> >(2);
+  Tensor<long         > matches   = FromLuaStack<Tensor<long         > >(3);
+  size_t                threshold = FromLuaStack<size_t>(4);
+  Tensor<int          > dists     = FromLuaStack<Tensor<int          > >(5);
+  int                   nProbes   = FromLuaStack<int>(6);
+
+  THassert((0 <= nProbes) && (nProbes <= 2));
+  descs = DescriptorRows(descs);
+  const long n = (descs.nDimension() == 2) ? descs.size(0) : 0;
+  matches.resize(n, 2);
+  dists.resize(n);
+  Ptr<HammingIndex> indexPtr = hammingIndexes_g.get(iIndex);
+  HammingIndex & index = *indexPtr;
+  if (n == 0) {
+    PushOnLuaStack<int>(0);
+    return 1;
   }
+  if (descs.size(1) != (long)index.descriptorSize()) {
+    indexPtr.release(); // (THerror does not return)
+    THerror("QueryHammingIndex: the descriptors are not of the size of the indexed ones");
+  }
+
+  vector<long> bestj(n);
+  vector<unsigned int> bestdist(n);
+  index.query(descs.data(), n, descs.stride(0), nProbes, &(bestj[0]), &(bestdist[0]));
+
+  long iMatches = 0;
+  for (long i = 0; i < n; ++i)
+    if ((bestj[i] >= 0) && (bestdist[i] < threshold)) {
+      matches(iMatches, 0) = i;
+      matches(iMatches, 1) = bestj[i];
+      dists(iMatches) = bestdist[i];
+      ++iMatches;
+    }
   PushOnLuaStack<int>(iMatches);
   return 1;
 }
 
-// function to sort the KeyPoints returned in DetectorExtractor
-struct keyPointCompare {
-  bool operator ()(const KeyPoint & a, const KeyPoint & b) const {
-    return a.response>b.response;
+static int EvaluateHammingIndex(lua_State* L) {
+  STATS_SCOPE("EvaluateHammingIndex");
+  setLuaState(L);
+  int                   iIndex  = FromLuaStack<int>(1);
+  Tensor<unsigned char> descs   = FromLuaStack<Tensor<unsigned char> >(2);
+  int                   nProbes = FromLuaStack<int>(3);
+
+  THassert((0 <= nProbes) && (nProbes <= 2));
+  descs = DescriptorRows(descs);
+  const long n = (descs.nDimension() == 2) ? descs.size(0) : 0;
+  Ptr<HammingIndex> indexPtr = hammingIndexes_g.get(iIndex);
+  HammingIndex & index = *indexPtr;
+  if ((n > 0) && (descs.size(1) != (long)index.descriptorSize())) {
+    indexPtr.release(); // (THerror does not return)
+    THerror("EvaluateHammingIndex: the descriptors are not of the size of the indexed ones");
   }
-};
+  PushOnLuaStack<double>(index.evaluateRecall(descs.data(), n, (n == 0) ? 0 : descs.stride(0),
+					      nProbes));
+  return 1;
+}
+
+static int GetHammingIndexStats(lua_State* L) {
+  setLuaState(L);
+  int iIndex = FromLuaStack<int>(1);
+  bool reset = FromLuaStack<bool>(2);
+
+  Ptr<HammingIndex> indexPtr = hammingIndexes_g.get(iIndex);
+  HammingIndex & index = *indexPtr;
+  const HammingIndexStats stats = index.stats();
+  lua_newtable(L);
+  lua_pushnumber(L, index.size());
+  lua_setfield(L, -2, "size");
+  lua_pushnumber(L, index.nTables());
+  lua_setfield(L, -2, "nTables");
+  lua_pushnumber(L, index.keyBits());
+  lua_setfield(L, -2, "keyBits");
+  lua_pushnumber(L, stats.nQueries);
+  lua_setfield(L, -2, "nQueries");
+  lua_pushnumber(L, stats.nCandidates);
+  lua_setfield(L, -2, "nCandidates");
+  lua_pushnumber(L, (stats.nQueries > 0) ? (double)stats.nCandidates/stats.nQueries : 0.);
+  lua_setfield(L, -2, "candidatesPerQuery");
+  lua_pushnumber(L, stats.queryTime);
+  lua_setfield(L, -2, "queryTime");
+  lua_pushnumber(L, (stats.nQueries > 0) ? stats.queryTime/stats.nQueries : 0.);
+  lua_setfield(L, -2, "latencyPerQuery");
+  lua_pushnumber(L, stats.nRecallQueries);
+  lua_setfield(L, -2, "nRecallQueries");
+  if (stats.nRecallQueries > 0) {
+    lua_pushnumber(L, (double)stats.nRecallHits/stats.nRecallQueries);
+    lua_setfield(L, -2, "recall");
+  }
+  if (reset)
+    index.resetStats();
+  return 1;
+}
+
+//============================================================
+// FREAK store (cf. store.hpp)
+//
+
+HandleRegistry<FREAKStoreWriter> freakStoreWriters_g("FREAKStoreWriter");
+HandleRegistry<FREAKStore> freakStores_g("FREAKStore");
+
+// (path, descSize, posCols)
+static int CreateFREAKStoreWriter(lua_State* L) {
+  setLuaState(L);
+  string path    = FromLuaStack<string>(1);
+  int    descSize= FromLuaStack<int>(2);
+  int    posCols = FromLuaStack<int>(3);
+
+  PushOnLuaStack<int>(freakStoreWriters_g.add(new FREAKStoreWriter(path, descSize, posCols)));
+  return 1;
+}
+
+// (writer, descs, positions) : appends one frame
+static int FREAKStoreAppend(lua_State* L) {
+  STATS_SCOPE("FREAKStoreAppend");
+  setLuaState(L);
+  int                   iWriter   = FromLuaStack<int>(1);
+  Tensor<unsigned char> descs     = FromLuaStack<Tensor<unsigned char> >(2);
+  Tensor<float>         positions = FromLuaStack<Tensor<float> >(3);
+
+  const long n = (descs.nDimension() == 2) ? descs.size(0) : 0;
+  if (n > 0) {
+    descs = DescriptorRows(descs);
+    positions = positions.newContiguous();
+    THassert((positions.nDimension() == 2) && (positions.size(0) == n));
+  }
+  Ptr<FREAKStoreWriter> writerPtr = freakStoreWriters_g.get(iWriter);
+  FREAKStoreWriter & writer = *writerPtr;
+  string error;
+  if ((n > 0) && ((descs.size(1) != (long)writer.descSize()) ||
+		  (positions.size(1) != writer.posCols())))
+    error = "FREAKStoreAppend: the descriptors or positions are not of the size of the store";
+  else if (!writer.append((n > 0) ? descs.data() : NULL, (n > 0) ? descs.stride(0) : 0,
+			  (n > 0) ? positions.data() : NULL,
+			  (n > 0) ? positions.stride(0) : 0, n))
+    error = writer.error();
+  writerPtr.release();
+  if (!error.empty())
+    THerror(error);
+  return 0;
+}
+
+static int CloseFREAKStoreWriter(lua_State* L) {
+  setLuaState(L);
+  int iWriter = FromLuaStack<int>(1);
+  Ptr<FREAKStoreWriter> writer = freakStoreWriters_g.get(iWriter);
+  freakStoreWriters_g.remove(iWriter);
+  const string error = writer->close() ? string() : writer->error();
+  writer.release();
+  if (!error.empty())
+    THerror(error);
+  return 0;
+}
+
+// The views of a store keep it mapped : their storages hold a reference on
+// the store (allocator context), dropped when the lua garbage collector frees
+// them. They never allocate nor resize.
+static void* StoreViewMalloc(void*, long) {
+  return NULL;
+}
+
+static void* StoreViewRealloc(void*, void*, long) {
+  return NULL;
+}
+
+static void StoreViewFree(void* store, void*) {
+  delete (Ptr<FREAKStore>*)store;
+}
+
+static THAllocator storeViewAllocator_g = {StoreViewMalloc, StoreViewRealloc, StoreViewFree};
+
+static Tensor<unsigned char> ByteView(const Ptr<FREAKStore> & store, unsigned char* data,
+				      long rows, long cols) {
+  if (rows == 0)
+    return Tensor<unsigned char>();
+  THByteStorage* storage =
+    THByteStorage_newWithDataAndAllocator(data, rows*cols, &storeViewAllocator_g,
+					  new Ptr<FREAKStore>(store));
+  storage->flag = TH_STORAGE_REFCOUNTED | TH_STORAGE_FREEMEM;
+  Tensor<unsigned char> view(THByteTensor_newWithStorage2d(storage, 0, rows, cols, cols, 1),
+			     true);
+  THByteStorage_free(storage);
+  return view;
+}
+
+static Tensor<float> FloatView(const Ptr<FREAKStore> & store, float* data,
+			       long rows, long cols) {
+  if (rows == 0)
+    return Tensor<float>();
+  THFloatStorage* storage =
+    THFloatStorage_newWithDataAndAllocator(data, rows*cols, &storeViewAllocator_g,
+					   new Ptr<FREAKStore>(store));
+  storage->flag = TH_STORAGE_REFCOUNTED | TH_STORAGE_FREEMEM;
+  Tensor<float> view(THFloatTensor_newWithStorage2d(storage, 0, rows, cols, cols, 1), true);
+  THFloatStorage_free(storage);
+  return view;
+}
+
+// (path) : returns the handle, the descriptors (ByteTensor n x descSize) and
+// positions (FloatTensor n x posCols), which are views of the mapped file,
+// and the frame index (LongTensor nFrames+1, zero-based first keypoint of
+// each frame)
+static int OpenFREAKStore(lua_State* L) {
+  STATS_SCOPE("OpenFREAKStore");
+  setLuaState(L);
+  string path = FromLuaStack<string>(1);
+
+  Ptr<FREAKStore> store = new FREAKStore(path);
+  const FREAKStoreHeader & header = store->header();
+  Tensor<long> frames;
+  frames.resize(header.nFrames + 1);
+  for (uint64_t i = 0; i <= header.nFrames; ++i)
+    frames(i) = store->frames()[i];
+  Tensor<unsigned char> descs = ByteView(store, store->descs(), header.n, header.descSize);
+  Tensor<float> positions = FloatView(store, store->positions(), header.n, header.posCols);
+  PushOnLuaStack<int>(freakStores_g.add(store));
+  PushOnLuaStack<Tensor<unsigned char> >(descs);
+  PushOnLuaStack<Tensor<float> >(positions);
+  PushOnLuaStack<Tensor<long> >(frames);
+  return 4;
+}
+
+// Releases the handle. The file stays mapped until its views are freed.
+static int CloseFREAKStore(lua_State* L) {
+  setLuaState(L);
+  int iStore = FromLuaStack<int>(1);
+  freakStores_g.remove(iStore);
+  return 0;
+}
+
+// Returns the name of the Hamming kernel in use. If a name is given
+// ("auto", "scalar", "popcnt", "avx2", "avx512"), selects it first.
+static int HammingKernel(lua_State* L) {
+  setLuaState(L);
+  if (lua_gettop(L) >= 1 && !lua_isnil(L, 1)) {
+    string name = FromLuaStack<string>(1);
+    if (!SetHammingKernel(name))
+      THerror("HammingKernel: kernel " + name + " is unknown or not supported by this CPU");
+  }
+  lua_pushstring(L, GetHammingKernelName().c_str());
+  return 1;
+}
+
+//============================================================
+// Instrumentation (cf. stats.hpp)
+//
+
+// ([reset]) : table name -> {calls, time (seconds), bytes, allocs} of the
+// bindings and of their stages ("Scratch" : the growths of the scratch arenas
+// and, as peak, the largest scratch memory of a call, cf. arena.hpp). Resets
+// the counters afterwards if reset.
+static int Stats(lua_State* L) {
+  setLuaState(L);
+  bool reset = (lua_gettop(L) >= 1) && FromLuaStack<bool>(1);
+  vector<Stat*> stats = GetAllStats();
+  const double tickTime = 1. / getTickFrequency();
+  lua_newtable(L);
+  for (size_t i = 0; i < stats.size(); ++i) {
+    const Stat & stat = *(stats[i]);
+    if (stat.calls + stat.allocs + stat.peak == 0)
+      continue;
+    lua_newtable(L);
+    lua_pushnumber(L, stat.calls);
+    lua_setfield(L, -2, "calls");
+    lua_pushnumber(L, stat.ticks * tickTime);
+    lua_setfield(L, -2, "time");
+    lua_pushnumber(L, stat.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, stat.allocs);
+    lua_setfield(L, -2, "allocs");
+    if (stat.peak > 0) {
+      lua_pushnumber(L, stat.peak);
+      lua_setfield(L, -2, "peak");
+    }
+    lua_setfield(L, -2, stat.name.c_str());
+  }
+  if (reset)
+    ResetStats();
+  return 1;
+}
+
+// (enabled) : the counters are only updated when enabled (off by default)
+static int EnableStats(lua_State* L) {
+  setLuaState(L);
+  SetStatsEnabled(FromLuaStack<bool>(1));
+  return 0;
+}
+
+static int SetNumThreads(lua_State* L) {
+  setLuaState(L);
+  int nThreads = FromLuaStack<int>(1);
+  setNumThreads(nThreads);
+  SetThreadPoolSize(getNumThreads());
+  return 0;
+}
+
+static int GetNumThreads(lua_State* L) {
+  setLuaState(L);
+  PushOnLuaStack<int>(getNumThreads());
+  return 1;
+}
+
+//============================================================
+// Feature detectors and descriptor extractors
+//
+// Created once and reused by DetectExtract, so that their setup (SIFT/SURF
+// tables, ...) is not paid at every call.
+//
+
+HandleRegistry<FeatureDetector>     detectors_g("FeatureDetector");
+HandleRegistry<DescriptorExtractor> extractors_g("DescriptorExtractor");
+
+// "FAST", "STAR", "SIFT", "SURF", "ORB",
+// "MSER", "GFTT", "HARRIS", "Dense", "SimpleBlob",
+// Also combined format: 
+// "Grid" – GridAdaptedFeatureDetector,
+// "Pyramid" – PyramidAdaptedFeatureDetector )
+// for example: "GridFAST", "PyramidSTAR" .
+static Ptr<FeatureDetector> CreateDetectorFromName(const string & detectorType) {
+  Ptr<FeatureDetector> detector = FeatureDetector::create(detectorType);
+  if (detector.empty())
+    THerror("Unknown FeatureDetector " + detectorType);
+  return detector;
+}
+
+static Ptr<DescriptorExtractor> CreateExtractorFromName(const string & extractorType) {
+  /*
+    The create() function does not seem to work.  The features aren't
+    computed properly so I have replaced it with the messier if else
+    cases below.
+    
+    extractor = DescriptorExtractor::create(extractorType);
+  */
+  Ptr<DescriptorExtractor> extractor;
+  if (extractorType.compare("SURF") == 0) {
+    extractor = new SurfDescriptorExtractor; 
+  } else if (extractorType.compare("SIFT") == 0) { 
+    extractor = new SiftDescriptorExtractor;
+  } else if (extractorType.compare("BRIEF") == 0) { 
+    extractor = new BriefDescriptorExtractor;
+  } else if (extractorType.compare("ORB") == 0) { 
+    extractor = new OrbDescriptorExtractor;
+  } else {
+    printf("Warning unrecognized DescriptorExtractor (%s) using SURF\n",
+           extractorType.c_str());
+    extractor = new SurfDescriptorExtractor;
+  }
+  /*
+    } else if (extractorType.compare("OpponentSIFT") == 0) { 
+    extractor = new OpponentSiftDescriptorExtractor;
+    } else if (extractorType.compare("BOW") == 0) { 
+    extractor = new BOWImgDescriptorExtractor;
+    } else if (extractorType.compare("FREAK") == 0) { 
+    extractor = new FreakDescriptorExtractor;
+  */
+  return extractor;
+}
+
+// handle (number) or type name (string)
+static Ptr<FeatureDetector> DetectorFromLuaStack(lua_State* L, int i) {
+  if (lua_type(L, i) == LUA_TNUMBER)
+    return detectors_g.get(FromLuaStack<int>(L, i));
+  return CreateDetectorFromName(FromLuaStack<string>(L, i));
+}
+
+// Empty instead of raising an error : for a call that already holds an
+// extractor, which it releases before calling DetectorFromLuaStack to raise
+// the error (cf. registry.hpp)
+static Ptr<FeatureDetector> TryDetectorFromLuaStack(lua_State* L, int i) {
+  if (lua_type(L, i) == LUA_TNUMBER)
+    return detectors_g.tryGet(lua_tointeger(L, i));
+  if (lua_type(L, i) == LUA_TSTRING)
+    return FeatureDetector::create(lua_tostring(L, i));
+  return Ptr<FeatureDetector>();
+}
+
+static Ptr<DescriptorExtractor> ExtractorFromLuaStack(lua_State* L, int i) {
+  if (lua_type(L, i) == LUA_TNUMBER)
+    return extractors_g.get(FromLuaStack<int>(L, i));
+  return CreateExtractorFromName(FromLuaStack<string>(L, i));
+}
+
+// Pushes a table name -> value of the int, bool, double and string
+// parameters of an algorithm
+static void PushAlgorithmParams(lua_State* L, const Algorithm & algo) {
+  vector<string> names;
+  algo.getParams(names);
+  lua_newtable(L);
+  for (size_t i = 0; i < names.size(); ++i) {
+    switch (algo.paramType(names[i])) {
+    case Param::INT:
+      lua_pushnumber(L, algo.get<int>(names[i]));
+      break;
+    case Param::BOOLEAN:
+      lua_pushboolean(L, algo.get<bool>(names[i]));
+      break;
+    case Param::REAL:
+      lua_pushnumber(L, algo.get<double>(names[i]));
+      break;
+    case Param::STRING:
+      lua_pushstring(L, algo.get<string>(names[i]).c_str());
+      break;
+    default:
+      continue;
+    }
+    lua_setfield(L, -2, names[i].c_str());
+  }
+}
+
+// Sets the parameters of an algorithm from the table at index i (if it is
+// a table). Returns the error instead of raising it, so that the caller can
+// release the algorithm first (cf. registry.hpp).
+static string SetAlgorithmParams(lua_State* L, Algorithm & algo, int i) {
+  if (!lua_istable(L, i))
+    return string();
+  vector<string> names;
+  algo.getParams(names);
+  for (size_t j = 0; j < names.size(); ++j) {
+    lua_getfield(L, i, names[j].c_str());
+    string error;
+    if (!lua_isnil(L, -1)) {
+      switch (algo.paramType(names[j])) {
+      case Param::INT:
+	algo.set(names[j], FromLuaStack<int>(L, -1));
+	break;
+      case Param::BOOLEAN:
+	algo.set(names[j], FromLuaStack<bool>(L, -1));
+	break;
+      case Param::REAL:
+	algo.set(names[j], FromLuaStack<double>(L, -1));
+	break;
+      case Param::STRING:
+	if (lua_isstring(L, -1))
+	  algo.set(names[j], FromLuaStack<string>(L, -1));
+	else
+	  error = "Parameter " + names[j] + " must be a string";
+	break;
+      default:
+	error = "Parameter " + names[j] + " cannot be set from lua";
+      }
+    }
+    lua_pop(L, 1);
+    if (!error.empty())
+      return error;
+  }
+  return string();
+}
+
+static int CreateFeatureDetector(lua_State* L) {
+  setLuaState(L);
+  string detectorType = FromLuaStack<string>(1);
+  Ptr<FeatureDetector> detector = CreateDetectorFromName(detectorType);
+  const string error = SetAlgorithmParams(L, *detector, 2);
+  if (!error.empty()) {
+    detector.release(); // (THerror does not return)
+    THerror(error);
+  }
+  PushOnLuaStack<int>(detectors_g.add(detector));
+  return 1;
+}
+
+static int CreateDescriptorExtractor(lua_State* L) {
+  setLuaState(L);
+  string extractorType = FromLuaStack<string>(1);
+  Ptr<DescriptorExtractor> extractor = CreateExtractorFromName(extractorType);
+  const string error = SetAlgorithmParams(L, *extractor, 2);
+  if (!error.empty()) {
+    extractor.release(); // (THerror does not return)
+    THerror(error);
+  }
+  PushOnLuaStack<int>(extractors_g.add(extractor));
+  return 1;
+}
+
+static int DeleteFeatureDetector(lua_State* L) {
+  setLuaState(L);
+  int iDetector = FromLuaStack<int>(1);
+  detectors_g.remove(iDetector);
+  return 0;
+}
+
+static int DeleteDescriptorExtractor(lua_State* L) {
+  setLuaState(L);
+  int iExtractor = FromLuaStack<int>(1);
+  extractors_g.remove(iExtractor);
+  return 0;
+}
+
+// (handle, [params table]) : sets the params if given, returns all the params
+static int FeatureDetectorParams(lua_State* L) {
+  setLuaState(L);
+  Ptr<FeatureDetector> detector = DetectorFromLuaStack(L, 1);
+  const string error = SetAlgorithmParams(L, *detector, 2);
+  if (!error.empty()) {
+    detector.release(); // (THerror does not return)
+    THerror(error);
+  }
+  PushAlgorithmParams(L, *detector);
+  return 1;
+}
+
+static int DescriptorExtractorParams(lua_State* L) {
+  setLuaState(L);
+  Ptr<DescriptorExtractor> extractor = ExtractorFromLuaStack(L, 1);
+  const string error = SetAlgorithmParams(L, *extractor, 2);
+  if (!error.empty()) {
+    extractor.release(); // (THerror does not return)
+    THerror(error);
+  }
+  PushAlgorithmParams(L, *extractor);
+  return 1;
+}
+
+// (extractor) : descriptor size and whether the descriptors are binary (CV_8U)
+static int DescriptorExtractorInfo(lua_State* L) {
+  setLuaState(L);
+  Ptr<DescriptorExtractor> extractor = ExtractorFromLuaStack(L, 1);
+  PushOnLuaStack<int>(extractor->descriptorSize());
+  lua_pushboolean(L, extractor->descriptorType() == CV_8U);
+  return 2;
+}
 
 static int version (lua_State* L) {
   printf("%s\n", CV_VERSION);
@@ -336,15 +1970,65 @@ static int version (lua_State* L) {
 
 static const luaL_reg libopencv24_init [] =
   {
+    {"FutureReady",  FutureReady},
+    {"FutureWait",   FutureWait},
+    {"CreateFrame",  CreateFrame},
+    {"DeleteFrame",  DeleteFrame},
+    {"FrameSize",    FrameSize},
+    {"OpenVideoSource",  OpenVideoSource},
+    {"VideoSourceStart", VideoSourceStart},
+    {"VideoSourceNext",  VideoSourceNext},
+    {"CloseVideoSource", CloseVideoSource},
+    {"DecodeImages",     DecodeImages},
     {"TrackPoints",  TrackPoints},
+    {"CreateTrackerLK", CreateTrackerLK},
+    {"DeleteTrackerLK", DeleteTrackerLK},
+    {"TrackerLKPush",   TrackerLKPush},
+    {"FindGeometry",    FindGeometry},
+    {"HarrisCorners", HarrisCornersNMS},
     {"DenseOpticalFlowBlockMatching", DenseOpticalFlowBlockMatching},
+    {"DenseOpticalFlowBM", DenseOpticalFlowBM},
+    {"CreateFarnebackFlow", CreateFarnebackFlow},
+    {"DeleteFarnebackFlow", DeleteFarnebackFlow},
+    {"DenseOpticalFlowFarnebachAsync", DenseOpticalFlowFarnebachAsync},
     {"CreateFREAK",  CreateFREAK},
     {"DeleteFREAK",  DeleteFREAK},
     {"ComputeFREAK", ComputeFREAK},
+    {"ComputeFREAKBatch", ComputeFREAKBatch},
     {"ComputeFREAKfromKeyPoints", ComputeFREAKfromKeyPoints},
     {"TrainFREAK",   TrainFREAK},
+    {"TrainFREAKAsync", TrainFREAKAsync},
+    {"CreateFREAKTrainer", CreateFREAKTrainer},
+    {"DeleteFREAKTrainer", DeleteFREAKTrainer},
+    {"FREAKTrainerAdd",    FREAKTrainerAdd},
+    {"FREAKTrainerSelect", FREAKTrainerSelect},
     {"MatchFREAK",   MatchFREAK},
+    {"MatchFREAKKnn", MatchFREAKKnn},
+    {"MatchFREAKGuided", MatchFREAKGuided},
+    {"CreateHammingIndex",   CreateHammingIndex},
+    {"DeleteHammingIndex",   DeleteHammingIndex},
+    {"QueryHammingIndex",    QueryHammingIndex},
+    {"EvaluateHammingIndex", EvaluateHammingIndex},
+    {"HammingIndexStats",    GetHammingIndexStats},
+    {"CreateFREAKStoreWriter", CreateFREAKStoreWriter},
+    {"FREAKStoreAppend",       FREAKStoreAppend},
+    {"CloseFREAKStoreWriter",  CloseFREAKStoreWriter},
+    {"OpenFREAKStore",         OpenFREAKStore},
+    {"CloseFREAKStore",        CloseFREAKStore},
     {"ComputeFAST",  ComputeFAST}, 
+    {"ComputeFASTBatch", ComputeFASTBatch},
+    {"CreateFeatureDetector",     CreateFeatureDetector},
+    {"CreateDescriptorExtractor", CreateDescriptorExtractor},
+    {"DeleteFeatureDetector",     DeleteFeatureDetector},
+    {"DeleteDescriptorExtractor", DeleteDescriptorExtractor},
+    {"FeatureDetectorParams",     FeatureDetectorParams},
+    {"DescriptorExtractorParams", DescriptorExtractorParams},
+    {"DescriptorExtractorInfo",   DescriptorExtractorInfo},
+    {"HammingKernel", HammingKernel},
+    {"Stats",         Stats},
+    {"EnableStats",   EnableStats},
+    {"SetNumThreads", SetNumThreads},
+    {"GetNumThreads", GetNumThreads},
     {"Version",      version},
     {NULL, NULL}
   };
@@ -0,0 +1,136 @@
+#ifndef __REGISTRY_HPP__
+#define __REGISTRY_HPP__
+
+#include "common.hpp"
+#include<pthread.h>
+#include<sstream>
+
+//============================================================
+// Handle registry
+//
+// Objects handed to lua as integer handles (trackers, FREAKs, indexes...).
+// A registry is shared by all the lua states of the process (threads,
+// lanes) and guarded by a mutex. get() returns a reference counted pointer,
+// so that an object deleted by one thread stays alive until the calls of the
+// other threads using it return. A handle is made of a slot and of the
+// generation of that slot : the slots of the deleted objects are reused, and
+// a stale handle raises a lua error instead of reaching another object.
+//
+// A lua error does not unwind the C++ stack : the bindings check their
+// arguments before getting their objects, and release the pointers they
+// hold before raising an error.
+//
+
+#define HANDLE_SLOT_BITS 20
+#define HANDLE_SLOT_MASK ((1 << HANDLE_SLOT_BITS) - 1)
+#define HANDLE_GENERATION_MASK ((1 << (31 - HANDLE_SLOT_BITS)) - 1)
+
+template<typename T> class HandleRegistry {
+public:
+  explicit HandleRegistry(const string & name)
+    :name(name), nObjects(0) {
+    pthread_mutex_init(&mutex, NULL);
+  };
+  ~HandleRegistry() {
+    pthread_mutex_destroy(&mutex);
+  };
+  // (obj is released if the registry is full : it is then deleted, unless
+  // the caller holds other pointers to it)
+  int add(const Ptr<T> & obj) {
+    THassert(!obj.empty());
+    pthread_mutex_lock(&mutex);
+    int iSlot;
+    if (freeSlots.empty()) {
+      if (slots.size() > HANDLE_SLOT_MASK) {
+	pthread_mutex_unlock(&mutex);
+	const_cast<Ptr<T>&>(obj).release(); // (THerror does not return)
+	THerror(name + ": too many objects");
+      }
+      iSlot = slots.size();
+      slots.push_back(Slot());
+    } else {
+      iSlot = freeSlots.back();
+      freeSlots.pop_back();
+    }
+    slots[iSlot].obj = obj;
+    ++nObjects;
+    const int handle = (slots[iSlot].generation << HANDLE_SLOT_BITS) | iSlot;
+    pthread_mutex_unlock(&mutex);
+    return handle;
+  };
+  // THerror if the handle is not valid
+  Ptr<T> get(int handle) {
+    Ptr<T> ret = tryGet(handle);
+    if (ret.empty())
+      invalid(handle);
+    return ret;
+  };
+  // Empty if the handle is not valid : for a call that already holds
+  // pointers, which it releases before calling get to raise the error (a
+  // handle never becomes valid again)
+  Ptr<T> tryGet(int handle) {
+    Ptr<T> ret;
+    pthread_mutex_lock(&mutex);
+    Slot* slot = find(handle);
+    if (slot != NULL)
+      ret = slot->obj;
+    pthread_mutex_unlock(&mutex);
+    return ret;
+  };
+  // Removes the handle. The object is deleted when the last pointer to it
+  // is released (here, unless a call is using it).
+  void remove(int handle) {
+    Ptr<T> obj;
+    pthread_mutex_lock(&mutex);
+    Slot* slot = find(handle);
+    if (slot != NULL) {
+      obj = slot->obj;
+      slot->obj.release();
+      slot->generation = (slot->generation + 1) & HANDLE_GENERATION_MASK;
+      freeSlots.push_back(handle & HANDLE_SLOT_MASK);
+      --nObjects;
+    }
+    pthread_mutex_unlock(&mutex);
+    if (obj.empty())
+      invalid(handle);
+  };
+  // number of live handles
+  size_t size() {
+    pthread_mutex_lock(&mutex);
+    size_t ret = nObjects;
+    pthread_mutex_unlock(&mutex);
+    return ret;
+  };
+private:
+  HandleRegistry(const HandleRegistry &);
+  HandleRegistry & operator=(const HandleRegistry &);
+  struct Slot {
+    Ptr<T> obj;
+    int generation;
+    Slot()
+      :generation(0) {};
+  };
+  // (locked)
+  Slot* find(int handle) {
+    if (handle < 0)
+      return NULL;
+    const size_t iSlot = handle & HANDLE_SLOT_MASK;
+    if ((iSlot >= slots.size()) || slots[iSlot].obj.empty() ||
+	(slots[iSlot].generation != (handle >> HANDLE_SLOT_BITS)))
+      return NULL;
+    return &(slots[iSlot]);
+  };
+  // (not locked : THerror does not return)
+  void invalid(int handle) {
+    ostringstream msg;
+    msg << name << ": invalid handle " << handle << " (deleted or never created)";
+    THerror(msg.str());
+  };
+  string name;
+  vector<Slot> slots;
+  vector<int> freeSlots;
+  size_t nObjects;
+  pthread_mutex_t mutex;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include "stats.hpp"
+
+#include<map>
+#include<pthread.h>
+
+using namespace std;
+
+volatile bool statsEnabled_g = false;
+
+static pthread_mutex_t statsMutex_g = PTHREAD_MUTEX_INITIALIZER;
+
+static map<string, Stat*> & StatsRegistry() {
+  static map<string, Stat*> registry;
+  return registry;
+}
+
+Stat* GetStat(const char* name) {
+  pthread_mutex_lock(&statsMutex_g);
+  map<string, Stat*> & registry = StatsRegistry();
+  map<string, Stat*>::iterator it = registry.find(name);
+  Stat* ret;
+  if (it != registry.end()) {
+    ret = it->second;
+  } else {
+    ret = new Stat;
+    ret->name = name;
+    ret->calls = ret->ticks = ret->bytes = ret->allocs = ret->peak = 0;
+    registry[name] = ret;
+  }
+  pthread_mutex_unlock(&statsMutex_g);
+  return ret;
+}
+
+vector<Stat*> GetAllStats() {
+  pthread_mutex_lock(&statsMutex_g);
+  map<string, Stat*> & registry = StatsRegistry();
+  vector<Stat*> ret;
+  for (map<string, Stat*>::iterator it = registry.begin(); it != registry.end(); ++it)
+    ret.push_back(it->second);
+  pthread_mutex_unlock(&statsMutex_g);
+  return ret;
+}
+
+void ResetStats() {
+  vector<Stat*> stats = GetAllStats();
+  for (size_t i = 0; i < stats.size(); ++i) {
+    Stat* stat = stats[i];
+    __sync_lock_test_and_set(&(stat->calls), 0LL);
+    __sync_lock_test_and_set(&(stat->ticks), 0LL);
+    __sync_lock_test_and_set(&(stat->bytes), 0LL);
+    __sync_lock_test_and_set(&(stat->allocs), 0LL);
+    __sync_lock_test_and_set(&(stat->peak), 0LL);
+  }
+}
+
+void SetStatsEnabled(bool enabled) {
+  statsEnabled_g = enabled;
+}
@@ -0,0 +1,102 @@
+#ifndef __STATS_HPP__
+#define __STATS_HPP__
+
+#include<string>
+#include<vector>
+#include<opencv2/core/core.hpp>
+
+//============================================================
+// Instrumentation
+//
+// Named counters of calls, time, bytes, allocations and peaks, updated by the
+// bindings (whole call, argument parsing included) and by their stages
+// (".convert", ".kernel", ".output"). They are only updated when enabled
+// (SetStatsEnabled), which costs one test per scope otherwise, and are
+// compiled out with -DOPENCV24_NO_STATS.
+//
+
+struct Stat {
+  std::string name;
+  volatile long long calls;
+  volatile long long ticks;        // cv::getTickCount units
+  volatile long long bytes;        // bytes allocated or converted
+  volatile long long allocs;
+  volatile long long peak;         // largest value passed to UpdatePeak
+};
+
+// Created on first use and never freed : callers keep the pointer
+Stat* GetStat(const char* name);
+std::vector<Stat*> GetAllStats();
+void ResetStats();
+
+extern volatile bool statsEnabled_g;
+inline bool StatsEnabled() {
+  return statsEnabled_g;
+}
+void SetStatsEnabled(bool enabled);
+
+// Times the scope (or until stop()) and counts one call
+class ScopedStat {
+public:
+  inline ScopedStat(Stat* stat)
+    :stat(StatsEnabled() ? stat : NULL), t0(0) {
+    if (this->stat != NULL)
+      t0 = cv::getTickCount();
+  };
+  inline ~ScopedStat() {
+    stop();
+  };
+  inline void stop() {
+    if (stat != NULL) {
+      __sync_fetch_and_add(&(stat->ticks), (long long)(cv::getTickCount() - t0));
+      __sync_fetch_and_add(&(stat->calls), 1LL);
+      stat = NULL;
+    }
+  };
+private:
+  ScopedStat(const ScopedStat &);
+  ScopedStat & operator=(const ScopedStat &);
+  Stat* stat;
+  int64 t0;
+};
+
+inline void CountAlloc(Stat* stat, size_t bytes) {
+  __sync_fetch_and_add(&(stat->bytes), (long long)bytes);
+  __sync_fetch_and_add(&(stat->allocs), 1LL);
+}
+
+inline void UpdatePeak(Stat* stat, long long value) {
+  long long peak = stat->peak;
+  while ((value > peak) && !__sync_bool_compare_and_swap(&(stat->peak), peak, value))
+    peak = stat->peak;
+}
+
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+
+#ifndef OPENCV24_NO_STATS
+// times the rest of the scope
+#define STATS_SCOPE(name)						\
+  static Stat* const STATS_CONCAT(stat_, __LINE__) = GetStat(name);	\
+  ScopedStat STATS_CONCAT(scopedStat_, __LINE__)(STATS_CONCAT(stat_, __LINE__))
+// times from STATS_START to STATS_STOP (or the end of the scope)
+#define STATS_START(timer, name)				\
+  static Stat* const STATS_CONCAT(timer, _stat) = GetStat(name);	\
+  ScopedStat timer(STATS_CONCAT(timer, _stat))
+#define STATS_STOP(timer) timer.stop()
+// counts an allocation (or a conversion) of bytes
+#define STATS_ALLOC(name, nbytes)					\
+  do {									\
+    if (StatsEnabled()) {						\
+      static Stat* const stat_ = GetStat(name);				\
+      CountAlloc(stat_, (nbytes));					\
+    }									\
+  } while (0)
+#else
+#define STATS_SCOPE(name)
+#define STATS_START(timer, name)
+#define STATS_STOP(timer)
+#define STATS_ALLOC(name, nbytes)
+#endif
+
+#endif
@@ -0,0 +1,167 @@
+#include "store.hpp"
+
+#include<cstring>
+#include<cerrno>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+static inline uint64_t AlignStore(uint64_t offset) {
+  return (offset + FREAK_STORE_ALIGN - 1) / FREAK_STORE_ALIGN * FREAK_STORE_ALIGN;
+}
+
+static string StoreErrorMessage(const string & path, const string & msg) {
+  return "FREAK store " + path + " : " + msg + (errno ? string(" (") + strerror(errno) + ")" : "");
+}
+
+static void StoreError(const string & path, const string & msg) {
+  THerror(StoreErrorMessage(path, msg));
+}
+
+//============================================================
+// Writer
+//
+
+void FREAKStoreWriter::write(FILE* f, const void* data, size_t size, const string & fpath) {
+  if (error_.empty() && (size > 0) && (fwrite(data, 1, size, f) != size))
+    error_ = StoreErrorMessage(fpath, "write failed");
+}
+
+void FREAKStoreWriter::padTo(FILE* f, uint64_t offset, const string & fpath) {
+  static const char zeros[FREAK_STORE_ALIGN] = {0};
+  const long pos = ftell(f);
+  write(f, zeros, offset - pos, fpath);
+}
+
+// appends the content of tmp to file, then deletes tmp
+void FREAKStoreWriter::appendFile(FILE* tmp, const string & tmpPath) {
+  char buffer[1 << 16];
+  rewind(tmp);
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), tmp)) > 0)
+    write(file, buffer, n, path);
+  fclose(tmp);
+  remove(tmpPath.c_str());
+}
+
+FREAKStoreWriter::FREAKStoreWriter(const string & path, size_t descSize, int posCols)
+  :path(path), posPath(path + ".pos.tmp"), framesPath(path + ".frames.tmp"),
+   file(NULL), posFile(NULL), framesFile(NULL) {
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FREAK_STORE_MAGIC, 8);
+  header.version = FREAK_STORE_VERSION;
+  header.descSize = descSize;
+  header.posCols = posCols;
+  header.descsOffset = AlignStore(sizeof(FREAKStoreHeader));
+  errno = 0;
+  file = fopen(path.c_str(), "wb");
+  posFile = fopen(posPath.c_str(), "w+b");
+  framesFile = fopen(framesPath.c_str(), "w+b");
+  if ((file == NULL) || (posFile == NULL) || (framesFile == NULL)) {
+    close();
+    StoreError(path, "cannot create");
+  }
+  // the header is written by close()
+  padTo(file, header.descsOffset, path);
+  if (!error_.empty()) {
+    const string error = error_;
+    close();
+    THerror(error);
+  }
+}
+
+FREAKStoreWriter::~FREAKStoreWriter() {
+  if (file != NULL)
+    close();
+}
+
+bool FREAKStoreWriter::append(const unsigned char* descs, long descsStride,
+			      const float* pos, long posStride, long n) {
+  THassert(file != NULL);
+  write(framesFile, &(header.n), sizeof(uint64_t), framesPath);
+  for (long i = 0; i < n; ++i) {
+    write(file, descs + i*descsStride, header.descSize, path);
+    write(posFile, pos + i*posStride, header.posCols*sizeof(float), posPath);
+  }
+  header.n += n;
+  ++header.nFrames;
+  return error_.empty();
+}
+
+bool FREAKStoreWriter::close() {
+  if ((file == NULL) || (posFile == NULL) || (framesFile == NULL)) {
+    // failed construction
+    if (file != NULL) fclose(file);
+    if (posFile != NULL) fclose(posFile);
+    if (framesFile != NULL) fclose(framesFile);
+    remove(posPath.c_str());
+    remove(framesPath.c_str());
+    file = posFile = framesFile = NULL;
+    return false;
+  }
+  errno = 0;
+  // frame index : first keypoint of each frame, then the total
+  write(framesFile, &(header.n), sizeof(uint64_t), framesPath);
+  header.posOffset = AlignStore(header.descsOffset + header.n * header.descSize);
+  padTo(file, header.posOffset, path);
+  appendFile(posFile, posPath);
+  header.framesOffset = AlignStore(header.posOffset + header.n * header.posCols * sizeof(float));
+  padTo(file, header.framesOffset, path);
+  appendFile(framesFile, framesPath);
+  rewind(file);
+  write(file, &header, sizeof(header), path);
+  if ((fclose(file) != 0) && error_.empty())
+    error_ = StoreErrorMessage(path, "write failed");
+  file = posFile = framesFile = NULL;
+  return error_.empty();
+}
+
+//============================================================
+// Reader
+//
+
+FREAKStore::FREAKStore(const string & path)
+  :base(NULL), length(0) {
+  errno = 0;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    StoreError(path, "cannot open");
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    StoreError(path, "cannot stat");
+  }
+  length = st.st_size;
+  if (length < sizeof(FREAKStoreHeader)) {
+    ::close(fd);
+    errno = 0;
+    StoreError(path, "not a FREAK store");
+  }
+  void* map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED)
+    StoreError(path, "mmap failed");
+  base = (unsigned char*)map;
+  const FREAKStoreHeader & h = header();
+  const char* error = NULL;
+  if (memcmp(h.magic, FREAK_STORE_MAGIC, 8) != 0)
+    error = "not a FREAK store";
+  else if (h.version != FREAK_STORE_VERSION)
+    error = "unsupported version";
+  else if ((h.framesOffset + (h.nFrames + 1) * sizeof(uint64_t) > length) ||
+	   (h.posOffset + h.n * h.posCols * sizeof(float) > h.framesOffset) ||
+	   (h.descsOffset + h.n * h.descSize > h.posOffset))
+    error = "truncated or corrupted";
+  if (error != NULL) {
+    munmap(base, length);
+    base = NULL;
+    errno = 0;
+    StoreError(path, error);
+  }
+}
+
+FREAKStore::~FREAKStore() {
+  if (base != NULL)
+    munmap(base, length);
+}
@@ -0,0 +1,81 @@
+#ifndef __STORE_HPP__
+#define __STORE_HPP__
+
+#include "common.hpp"
+#include<stdint.h>
+
+//============================================================
+// FREAK store
+//
+// On-disk format for the output of ComputeFREAK over many frames :
+//  - a 64 bytes header,
+//  - the descriptors, packed (n x descSize bytes),
+//  - the positions (n x posCols floats),
+//  - the frame index (nFrames+1 uint64 : first keypoint of each frame),
+// each section starting on a 64 bytes boundary. A store is written
+// sequentially by FREAKStoreWriter and opened with mmap by FREAKStore, so
+// the sections can be used in place (eg. as tensor views).
+//
+
+#define FREAK_STORE_MAGIC "FRKSTORE"
+#define FREAK_STORE_VERSION 1
+#define FREAK_STORE_ALIGN 64
+
+struct FREAKStoreHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t descSize;      // bytes per descriptor
+  uint32_t posCols;       // floats per position
+  uint32_t reserved;
+  uint64_t n;             // keypoints
+  uint64_t nFrames;
+  uint64_t descsOffset;   // sections, in bytes from the beginning of the file
+  uint64_t posOffset;
+  uint64_t framesOffset;
+};
+
+class FREAKStoreWriter {
+public:
+  FREAKStoreWriter(const std::string & path, size_t descSize, int posCols);
+  ~FREAKStoreWriter();
+  // Appends one frame of n keypoints. The write errors are not raised (the
+  // caller may hold the writer, cf. registry.hpp) : append and close return
+  // false once a write has failed, cf. error().
+  bool append(const unsigned char* descs, long descsStride,
+	      const float* pos, long posStride, long n);
+  // writes the positions, the frame index and the header
+  bool close();
+  inline size_t descSize() const {return header.descSize;};
+  inline int posCols() const {return header.posCols;};
+  // empty unless a write failed
+  inline const std::string & error() const {return error_;};
+private:
+  FREAKStoreWriter(const FREAKStoreWriter &);
+  FREAKStoreWriter & operator=(const FREAKStoreWriter &);
+  // (keep the first error)
+  void write(FILE* f, const void* data, size_t size, const std::string & fpath);
+  void padTo(FILE* f, uint64_t offset, const std::string & fpath);
+  void appendFile(FILE* tmp, const std::string & tmpPath);
+  std::string path, posPath, framesPath;
+  FILE *file, *posFile, *framesFile;
+  FREAKStoreHeader header;
+  std::string error_;
+};
+
+class FREAKStore {
+public:
+  // maps the store (copy on write : the file is never modified)
+  FREAKStore(const std::string & path);
+  ~FREAKStore();
+  inline const FREAKStoreHeader & header() const {return *((const FREAKStoreHeader*)base);};
+  inline unsigned char* descs() {return base + header().descsOffset;};
+  inline float* positions() {return (float*)(base + header().posOffset);};
+  inline uint64_t* frames() {return (uint64_t*)(base + header().framesOffset);};
+private:
+  FREAKStore(const FREAKStore &);
+  FREAKStore & operator=(const FREAKStore &);
+  unsigned char* base;
+  size_t length;
+};
+
+#endif
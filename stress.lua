@@ -0,0 +1,92 @@
+--------------------------------------------------------------------------------
+-- Stress test
+--
+-- Runs the bindings from several lua states at once (with the threads
+-- package), sharing FREAK handles between them and creating and deleting
+-- frames, FREAKs and trackers concurrently. The results of each thread are
+-- compared to the ones of a serial run. Returns the number of failures
+-- (wrong results, or handles that are still valid after being deleted).
+--
+--   opencv24.StressThreads{nThreads=8, nIters=100}
+--
+
+local help_desc = [[
+      OpenCV 2.4 wrapper : concurrent use of the bindings
+]]
+
+function opencv24.StressThreads(...)
+   local self = {}
+   xlua.unpack_class(
+      self, {...}, 'opencv24.StressThreads', help_desc,
+      {arg='nThreads', type='number', default=8, help='number of lua threads'},
+      {arg='nIters', type='number', default=50, help='iterations per thread'},
+      {arg='width', type='number', default=320},
+      {arg='height', type='number', default=240},
+      {arg='verbose', type='boolean', default=true})
+   local threads = require 'threads'
+
+   -- serial reference
+   torch.manualSeed(1)
+   local im = image.scale(torch.rand(3, self.height/8, self.width/8),
+			  self.width, self.height, 'bilinear')
+   local im_cv = opencv24.TH2CVImage(im)
+   local iFREAK = opencv24.CreateFREAK()
+   local ref = opencv24.ComputeFREAK(im_cv, 20, iFREAK)
+
+   local pool = threads.Threads(self.nThreads, function()
+				   require 'opencv24'
+						end)
+   local nFailures = 0
+   for iThread = 1,self.nThreads do
+      local nIters = self.nIters
+      pool:addjob(
+	 function()
+	    local nFailures = 0
+	    for i = 1,nIters do
+	       -- shared handle
+	       local freaks = opencv24.ComputeFREAK(im_cv, 20, iFREAK)
+	       if (freaks.descs:nElement() ~= ref.descs:nElement()) or
+		  (freaks.descs:nElement() > 0 and
+		   freaks.descs:ne(ref.descs):sum() ~= 0) then
+		  nFailures = nFailures + 1
+	       end
+	       -- private handles, created and deleted while the other threads
+	       -- create and delete theirs
+	       local frame = opencv24.CreateFrame(im_cv)
+	       local iFREAK2 = opencv24.CreateFREAK()
+	       local freaks2 = opencv24.ComputeFREAK(frame, 20, iFREAK2)
+	       if freaks2.descs:nElement() ~= ref.descs:nElement() then
+		  nFailures = nFailures + 1
+	       end
+	       -- same descriptors : everything matches
+	       local matches = opencv24.MatchFREAK(freaks, freaks2, 512)
+	       local nMatches = (matches:dim() > 0) and matches:size(1) or 0
+	       local nRef = (ref.descs:dim() > 0) and ref.descs:size(1) or 0
+	       if nMatches ~= nRef then
+		  nFailures = nFailures + 1
+	       end
+	       opencv24.DeleteFrame(frame)
+	       opencv24.DeleteFREAK(iFREAK2)
+	       -- stale handles must raise an error
+	       if pcall(opencv24.FrameSize, frame) then
+		  nFailures = nFailures + 1
+	       end
+	       if pcall(opencv24.ComputeFREAK, im_cv, 20, iFREAK2) then
+		  nFailures = nFailures + 1
+	       end
+	    end
+	    return nFailures
+	 end,
+	 function(n)
+	    nFailures = nFailures + n
+	 end)
+   end
+   pool:synchronize()
+   pool:terminate()
+   opencv24.DeleteFREAK(iFREAK)
+   if self.verbose then
+      print(string.format('opencv24.StressThreads : %d threads x %d iterations, %d failures',
+			  self.nThreads, self.nIters, nFailures))
+   end
+   return nFailures
+end
@@ -0,0 +1,141 @@
+#include "common.hpp"
+#include "threadpool.hpp"
+
+//============================================================
+// Task
+//
+
+ThreadPool::Task::Task()
+  :done_(false) {
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&cond, NULL);
+}
+
+ThreadPool::Task::~Task() {
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&mutex);
+}
+
+bool ThreadPool::Task::done() const {
+  pthread_mutex_lock(&mutex);
+  bool ret = done_;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+void ThreadPool::Task::wait() {
+  pthread_mutex_lock(&mutex);
+  while (!done_)
+    pthread_cond_wait(&cond, &mutex);
+  pthread_mutex_unlock(&mutex);
+}
+
+void ThreadPool::Task::finish(const string & error) {
+  pthread_mutex_lock(&mutex);
+  errorMsg = error;
+  done_ = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+}
+
+//============================================================
+// ThreadPool
+//
+
+ThreadPool::ThreadPool(int nThreads)
+  :stopping(false) {
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&cond, NULL);
+  threads.resize(max(1, nThreads));
+  for (size_t i = 0; i < threads.size(); ++i)
+    pthread_create(&(threads[i]), NULL, workerMain, this);
+}
+
+// the queued tasks are run before the workers stop
+ThreadPool::~ThreadPool() {
+  pthread_mutex_lock(&mutex);
+  stopping = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+  for (size_t i = 0; i < threads.size(); ++i)
+    pthread_join(threads[i], NULL);
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&mutex);
+}
+
+void ThreadPool::push(Task* task) {
+  pthread_mutex_lock(&mutex);
+  queue.push_back(task);
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&mutex);
+}
+
+void ThreadPool::runAll(const vector<Task*> & tasks) {
+  for (size_t i = 0; i < tasks.size(); ++i)
+    push(tasks[i]);
+  for (size_t i = 0; i < tasks.size(); ++i)
+    tasks[i]->wait();
+}
+
+void* ThreadPool::workerMain(void* pool_) {
+  ThreadPool & pool = *((ThreadPool*)pool_);
+  while (true) {
+    pthread_mutex_lock(&pool.mutex);
+    while (pool.queue.empty() && !pool.stopping)
+      pthread_cond_wait(&pool.cond, &pool.mutex);
+    if (pool.queue.empty()) { // stopping
+      pthread_mutex_unlock(&pool.mutex);
+      return NULL;
+    }
+    Task* task = pool.queue.front();
+    pool.queue.pop_front();
+    pthread_mutex_unlock(&pool.mutex);
+
+    string error;
+    try {
+      SCRATCH_SCOPE();
+      task->run();
+    } catch (const cv::Exception & e) {
+      error = e.what();
+    } catch (const std::exception & e) {
+      error = e.what();
+    } catch (const string & e) {
+      error = e;
+    } catch (...) {
+      error = "unknown exception";
+    }
+    task->finish(error);
+  }
+}
+
+//============================================================
+// Shared pool
+//
+
+// The mutex protects the pointer, not the pool : pushing under it is enough,
+// since a replaced pool runs its queued tasks before being deleted.
+static ThreadPool* threadPool_g = NULL;
+static pthread_mutex_t threadPoolMutex_g = PTHREAD_MUTEX_INITIALIZER;
+
+void PushOnThreadPool(const vector<ThreadPool::Task*> & tasks) {
+  pthread_mutex_lock(&threadPoolMutex_g);
+  if (threadPool_g == NULL)
+    threadPool_g = new ThreadPool(getNumThreads());
+  for (size_t i = 0; i < tasks.size(); ++i)
+    threadPool_g->push(tasks[i]);
+  pthread_mutex_unlock(&threadPoolMutex_g);
+}
+
+void RunOnThreadPool(const vector<ThreadPool::Task*> & tasks) {
+  PushOnThreadPool(tasks);
+  for (size_t i = 0; i < tasks.size(); ++i)
+    tasks[i]->wait();
+}
+
+void SetThreadPoolSize(int nThreads) {
+  pthread_mutex_lock(&threadPoolMutex_g);
+  ThreadPool* old = threadPool_g;
+  threadPool_g = new ThreadPool(nThreads);
+  pthread_mutex_unlock(&threadPoolMutex_g);
+  delete old;
+}
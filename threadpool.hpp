@@ -0,0 +1,72 @@
+#ifndef __THREADPOOL_HPP__
+#define __THREADPOOL_HPP__
+
+#include<pthread.h>
+#include<deque>
+#include<vector>
+#include<string>
+
+//============================================================
+// Worker pool
+//
+// Runs Tasks on a fixed set of native threads, in the order they are pushed.
+// Tasks must not touch the Lua state. THerror throws in the workers (they
+// have no L_global), and the exceptions thrown by run() are caught and
+// reported by Task::error(), but the argument checks are better done before
+// pushing the tasks.
+//
+
+class ThreadPool {
+public:
+  class Task {
+  public:
+    Task();
+    virtual ~Task();
+    virtual void run() = 0;
+    // true once run() has returned (or thrown)
+    bool done() const;
+    // blocks until done()
+    void wait();
+    // empty if run() did not throw
+    inline const std::string & error() const {return errorMsg;};
+  private:
+    Task(const Task &);
+    Task & operator=(const Task &);
+    friend class ThreadPool;
+    void finish(const std::string & error);
+    mutable pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool done_;
+    std::string errorMsg;
+  };
+
+  explicit ThreadPool(int nThreads);
+  ~ThreadPool();
+  inline int nThreads() const {return (int)threads.size();};
+  // The pool does not take the ownership of the task, which must stay alive
+  // until it is done.
+  void push(Task* task);
+  // Pushes the tasks and waits for all of them.
+  void runAll(const std::vector<Task*> & tasks);
+
+private:
+  ThreadPool(const ThreadPool &);
+  ThreadPool & operator=(const ThreadPool &);
+  static void* workerMain(void* pool);
+  std::vector<pthread_t> threads;
+  std::deque<Task*> queue;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool stopping;
+};
+
+// Pool shared by the bindings, with cv::getNumThreads() threads by default.
+// These can be called from several Lua threads at once.
+void PushOnThreadPool(const std::vector<ThreadPool::Task*> & tasks);
+// Pushes the tasks on the shared pool and waits for all of them.
+void RunOnThreadPool(const std::vector<ThreadPool::Task*> & tasks);
+// Restarts the shared pool with nThreads threads. The tasks already pushed
+// still run, on the old pool.
+void SetThreadPoolSize(int nThreads);
+
+#endif
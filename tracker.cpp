@@ -0,0 +1,81 @@
+#include "tracker.hpp"
+
+LKTracker::LKTracker(size_t maxCorners, double qualityLevel, double minDistance,
+		     int blockSize, bool useHarris, int winSize, int maxLevel,
+		     size_t minTracked)
+  :maxCorners(maxCorners), qualityLevel(qualityLevel), minDistance(minDistance),
+   blockSize(blockSize), useHarris(useHarris), winSize(winSize, winSize),
+   maxLevel(maxLevel), minTracked(minTracked), prevMaxLevel(0),
+   prevPyrShared(false), nextPyrShared(false), hasPrev(false) {
+}
+
+void LKTracker::reset() {
+  hasPrev = false;
+  points.clear();
+}
+
+// tops the tracked points up to maxCorners, away from the current ones
+void LKTracker::detect(const Mat & gray) {
+  if (points.size() >= maxCorners)
+    return;
+  Mat mask;
+  if (!points.empty()) {
+    mask = Mat(gray.size(), CV_8U, Scalar(255));
+    for (size_t i = 0; i < points.size(); ++i)
+      circle(mask, points[i], max(1, cvRound(minDistance)), Scalar(0), -1);
+  }
+  vector<Point2f> newPoints;
+  goodFeaturesToTrack(gray, newPoints, maxCorners - points.size(), qualityLevel,
+		      minDistance, mask, blockSize, useHarris, 0.04);
+  points.insert(points.end(), newPoints.begin(), newPoints.end());
+}
+
+void LKTracker::push(const Mat & frame, vector<Point2f> & prevPts,
+		     vector<Point2f> & nextPts) {
+  THassert(frame.type() == CV_8U);
+  // the pyramid buffers of the frame before the previous one are reused,
+  // unless they belong to a Frame
+  if (nextPyrShared)
+    nextPyr.clear();
+  nextPyrShared = false;
+  int nextMaxLevel = buildOpticalFlowPyramid(frame, nextPyr, winSize, maxLevel, true);
+  track(nextMaxLevel, prevPts, nextPts);
+}
+
+void LKTracker::push(Frame & frame, vector<Point2f> & prevPts,
+		     vector<Point2f> & nextPts) {
+  int nextMaxLevel = frame.lkPyramid(winSize, maxLevel, nextPyr);
+  nextPyrShared = true;
+  track(nextMaxLevel, prevPts, nextPts);
+}
+
+void LKTracker::track(int nextMaxLevel, vector<Point2f> & prevPts,
+		      vector<Point2f> & nextPts) {
+  prevPts.clear();
+  nextPts.clear();
+  const Size size = nextPyr[0].size();
+  if (hasPrev && (prevPyr[0].size() != size))
+    reset();
+  if (hasPrev) {
+    if (points.size() < minTracked)
+      detect(prevPyr[0]);
+    if (!points.empty()) {
+      const TermCriteria criteria(TermCriteria::COUNT+TermCriteria::EPS, 100, 0.1);
+      calcOpticalFlowPyrLK(prevPyr, nextPyr, points, nextPoints, status, err, winSize,
+			   min(prevMaxLevel, nextMaxLevel), criteria, 0, 0);
+      const Rect bounds(0, 0, size.width, size.height);
+      size_t nSurviving = 0;
+      for (size_t i = 0; i < points.size(); ++i)
+	if (status[i] && bounds.contains(nextPoints[i])) {
+	  prevPts.push_back(points[i]);
+	  nextPts.push_back(nextPoints[i]);
+	  points[nSurviving++] = nextPoints[i];
+	}
+      points.resize(nSurviving);
+    }
+  }
+  swap(prevPyr, nextPyr);
+  swap(prevPyrShared, nextPyrShared);
+  prevMaxLevel = nextMaxLevel;
+  hasPrev = true;
+}
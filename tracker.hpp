@@ -0,0 +1,49 @@
+#ifndef __TRACKER_HPP__
+#define __TRACKER_HPP__
+
+#include "common.hpp"
+#include "frame.hpp"
+
+//============================================================
+// Streaming Lucas-Kanade tracker
+//
+// Tracks points from frame to frame of a video. The pyramid of the previous
+// frame is kept (and its buffers reused), so each frame's pyramid is built
+// once. The tracked points are carried forward, and goodFeaturesToTrack is
+// only called again when fewer than minTracked points survive, to top the
+// set up to maxCorners (away from the surviving points).
+//
+
+class LKTracker {
+public:
+  LKTracker(size_t maxCorners, double qualityLevel, double minDistance,
+	    int blockSize, bool useHarris, int winSize, int maxLevel,
+	    size_t minTracked);
+  // Pushes a new 8-bit gray frame. Returns the points tracked from the
+  // previous frame (prevPts) to this one (nextPts). Both are empty for the
+  // first frame.
+  void push(const Mat & frame, vector<Point2f> & prevPts, vector<Point2f> & nextPts);
+  // Same, with the pyramid cached by the frame (shared, not copied)
+  void push(Frame & frame, vector<Point2f> & prevPts, vector<Point2f> & nextPts);
+  void reset();
+  inline size_t nTracked() const {return points.size();};
+private:
+  void detect(const Mat & gray);
+  void track(int nextMaxLevel, vector<Point2f> & prevPts, vector<Point2f> & nextPts);
+  size_t maxCorners;
+  double qualityLevel, minDistance;
+  int blockSize;
+  bool useHarris;
+  Size winSize;
+  int maxLevel;
+  size_t minTracked;
+  vector<Mat> prevPyr, nextPyr;
+  int prevMaxLevel;
+  bool prevPyrShared, nextPyrShared; // (their buffers must not be reused)
+  bool hasPrev;
+  vector<Point2f> points, nextPoints;
+  vector<uchar> status;
+  vector<float> err;
+};
+
+#endif
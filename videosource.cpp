@@ -0,0 +1,115 @@
+#include "videosource.hpp"
+
+VideoSource::VideoSource()
+  :fps_(0.), nFrames_(0), started_(false), readSlot(0), nReady(0), lent(false),
+   ended(false), stopping(false) {
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&cond, NULL);
+}
+
+VideoSource::~VideoSource() {
+  if (started_) {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(decoder, NULL);
+  }
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&mutex);
+}
+
+bool VideoSource::open(const string & path) {
+  if (!capture.open(path) || !capture.read(first) || (first.type() != CV_8UC3))
+    return false;
+  size = first.size();
+  fps_ = max(0., capture.get(CV_CAP_PROP_FPS));
+  nFrames_ = max(0L, (long)capture.get(CV_CAP_PROP_FRAME_COUNT));
+  return true;
+}
+
+void VideoSource::start(const vector<TH::Tensor<ubyte> > & slots_) {
+  THassert(!started_ && !first.empty() && (slots_.size() >= 2));
+  slots = slots_;
+  slotFrame.assign(slots.size(), 0);
+  mat3b slot0(size, (Vec3b*)slots[0].data());
+  first.copyTo(slot0);
+  first.release();
+  nReady = 1;
+  started_ = true;
+  pthread_create(&decoder, NULL, decoderMain, this);
+}
+
+int VideoSource::next(long & iFrame) {
+  THassert(started_);
+  pthread_mutex_lock(&mutex);
+  if (lent) {
+    lent = false;
+    pthread_cond_broadcast(&cond);
+  }
+  while ((nReady == 0) && !ended)
+    pthread_cond_wait(&cond, &mutex);
+  int slot = -1;
+  if (nReady > 0) {
+    slot = readSlot;
+    iFrame = slotFrame[slot];
+    readSlot = (readSlot + 1) % slots.size();
+    --nReady;
+    lent = true;
+  }
+  pthread_mutex_unlock(&mutex);
+  return slot;
+}
+
+string VideoSource::error() const {
+  pthread_mutex_lock(&mutex);
+  string ret = errorMsg;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+void* VideoSource::decoderMain(void* source) {
+  ((VideoSource*)source)->decode();
+  return NULL;
+}
+
+void VideoSource::decode() {
+  const int nSlots = slots.size();
+  for (long iFrame = 1; ; ++iFrame) {
+    pthread_mutex_lock(&mutex);
+    while (!stopping && (nReady + (lent ? 1 : 0) == nSlots))
+      pthread_cond_wait(&cond, &mutex);
+    const int slot = (readSlot + nReady) % nSlots;
+    const bool stop = stopping;
+    pthread_mutex_unlock(&mutex);
+    if (stop)
+      return;
+
+    // the slot is free : the frame is decoded in place
+    Mat dst(size, CV_8UC3, slots[slot].data());
+    bool decoded = false;
+    string error;
+    try {
+      decoded = capture.read(dst);
+      if (decoded && (dst.data != (uchar*)slots[slot].data())) {
+	decoded = false;
+	error = "VideoSource: the size of the frames changed";
+      }
+    } catch (const cv::Exception & e) {
+      error = e.what();
+    }
+
+    pthread_mutex_lock(&mutex);
+    if (decoded) {
+      slotFrame[slot] = iFrame;
+      ++nReady;
+    } else {
+      ended = true;
+      errorMsg = error;
+    }
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+    if (!decoded)
+      return;
+  }
+}
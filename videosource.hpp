@@ -0,0 +1,66 @@
+#ifndef __VIDEOSOURCE_HPP__
+#define __VIDEOSOURCE_HPP__
+
+#include "common.hpp"
+#include<pthread.h>
+
+//============================================================
+// Video source
+//
+// A video file decoded ahead by a background thread (cv::VideoCapture)
+// into a ring of slots : HxWx3 BGR ByteTensors allocated once by the lua
+// side, in the layout of TH2CVImage, so that the bindings wrap them without
+// copying (TensorToMat3b). next() hands out the slots in order ; a slot
+// belongs to the caller until the following call to next(), the decoder
+// filling the other ones meanwhile. The decoder thread never touches the
+// lua state nor the TH allocator.
+//
+
+class VideoSource {
+public:
+  VideoSource();
+  // stops the decoder
+  ~VideoSource();
+  // Opens the file and decodes its first frame, which gives the size of the
+  // slots. Returns false if the file cannot be opened or is empty.
+  bool open(const string & path);
+  inline int height() const {return size.height;};
+  inline int width() const {return size.width;};
+  // (as reported by the container, 0 if unknown)
+  inline double fps() const {return fps_;};
+  inline long nFrames() const {return nFrames_;};
+  // Takes the slots (at least 2 contiguous height x width x 3 ByteTensors,
+  // retained until the source is destroyed) and starts the decoder.
+  void start(const vector<TH::Tensor<ubyte> > & slots);
+  inline bool started() const {return started_;};
+  // Gives back the previous slot, waits for the next frame and returns its
+  // slot (and its 0-based number in iFrame), or -1 at the end of the video
+  // or after a decoding error (cf. error()).
+  int next(long & iFrame);
+  // empty unless the decoder failed
+  string error() const;
+private:
+  VideoSource(const VideoSource &);
+  VideoSource & operator=(const VideoSource &);
+  static void* decoderMain(void* source);
+  void decode();
+  VideoCapture capture;
+  // (until start() copies it in the first slot)
+  mat3b first;
+  Size size;
+  double fps_;
+  long nFrames_;
+  vector<TH::Tensor<ubyte> > slots;
+  vector<long> slotFrame;
+  bool started_;
+  pthread_t decoder;
+  mutable pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  // the ready frames are in the slots readSlot, readSlot+1, ... (nReady of
+  // them), the slot before readSlot being lent if lent is true
+  int readSlot, nReady;
+  bool lent, ended, stopping;
+  string errorMsg;
+};
+
+#endif